@@ -0,0 +1,185 @@
+/******************************************************************************
+ *
+ * alloc.c -- the allocation profiler behind fP_Enable()
+ *
+ * Counts the allocations of the library as a whole and of every place
+ * that makes them, the call sites. A site is a function and a line of
+ * fd2inline.c; they are few, so a small hash table on the line number
+ * holds them all. Converters running side by side share the counts, so
+ * they are updated under a lock.
+ *
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "alloc.h"
+#include "fd2sfd.h"
+
+#define FP_SITES 256 /* a power of two, and more than fd2inline.c has */
+
+/* what a profiled block has in front, aligned for anything */
+
+typedef union
+{
+   size_t      size;
+   long double align1;
+   void*       align2;
+} fpHeader;
+
+static int	    fP_enabled=0;
+static fdAllocStats fP_stats;
+static fdAllocSite  fP_sites[FP_SITES];
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t fP_lock=PTHREAD_MUTEX_INITIALIZER;
+#define FP_LOCK()   pthread_mutex_lock(&fP_lock)
+#define FP_UNLOCK() pthread_mutex_unlock(&fP_lock)
+#else
+#define FP_LOCK()
+#define FP_UNLOCK()
+#endif
+
+/* counts an allocation of size bytes at function:line, in place of a block
+   of oldsize bytes; must be called with the lock held */
+
+static void
+fP_Count(size_t size, size_t oldsize, const char* function, int line)
+{
+   unsigned long slot;
+
+   fP_stats.allocs++;
+   fP_stats.bytes+=size;
+   fP_stats.live-=oldsize;
+   fP_stats.live+=size;
+   if (fP_stats.live>fP_stats.peak)
+      fP_stats.peak=fP_stats.live;
+
+   for (slot=(line*2654435761UL) & (FP_SITES-1); fP_sites[slot].function;
+	slot=(slot+1) & (FP_SITES-1))
+      if (fP_sites[slot].line==line && fP_sites[slot].function==function)
+	 break;
+
+   if (!fP_sites[slot].function)
+   {
+      if (fP_stats.sites==FP_SITES-1) /* keep one slot free to stop at */
+	 return;
+      fP_sites[slot].function=function;
+      fP_sites[slot].line=line;
+      fP_stats.sites++;
+   }
+   fP_sites[slot].allocs++;
+   fP_sites[slot].bytes+=size;
+}
+
+void*
+fP_Malloc(size_t size, const char* function, int line)
+{
+   fpHeader *block;
+
+   if (!fP_enabled)
+      return malloc(size);
+
+   if (size>(size_t) -1-sizeof(fpHeader) ||
+       !(block=malloc(sizeof(fpHeader)+size)))
+      return NULL;
+   block->size=size;
+
+   FP_LOCK();
+   fP_Count(size, 0, function, line);
+   FP_UNLOCK();
+   return block+1;
+}
+
+void*
+fP_Calloc(size_t num, size_t size, const char* function, int line)
+{
+   void *result;
+
+   if (!fP_enabled)
+      return calloc(num, size);
+
+   if (size && num>(size_t) -1/size)
+      return NULL;
+   if ((result=fP_Malloc(num*size, function, line)))
+      memset(result, 0, num*size);
+   return result;
+}
+
+void*
+fP_Realloc(void* ptr, size_t size, const char* function, int line)
+{
+   fpHeader *block;
+   size_t oldsize;
+
+   if (!fP_enabled)
+      return realloc(ptr, size);
+   if (!ptr)
+      return fP_Malloc(size, function, line);
+
+   block=(fpHeader*) ptr-1;
+   oldsize=block->size;
+   if (size>(size_t) -1-sizeof(fpHeader) ||
+       !(block=realloc(block, sizeof(fpHeader)+size)))
+      return NULL;
+   block->size=size;
+
+   FP_LOCK();
+   fP_Count(size, oldsize, function, line);
+   FP_UNLOCK();
+   return block+1;
+}
+
+void
+fP_Free(void* ptr)
+{
+   fpHeader *block;
+
+   if (!fP_enabled || !ptr)
+   {
+      free(ptr);
+      return;
+   }
+
+   block=(fpHeader*) ptr-1;
+   FP_LOCK();
+   fP_stats.frees++;
+   fP_stats.live-=block->size;
+   FP_UNLOCK();
+   free(block);
+}
+
+/******************************************************************************
+ *    the public part, see fd2sfd.h
+ ******************************************************************************/
+
+void
+fP_Enable(void)
+{
+   fP_enabled=1;
+}
+
+void
+fP_GetStats(fdAllocStats* stats)
+{
+   FP_LOCK();
+   *stats=fP_stats;
+   FP_UNLOCK();
+}
+
+long
+fP_GetSites(fdAllocSite* sites, long max)
+{
+   long slot, num=0;
+
+   FP_LOCK();
+   for (slot=0; slot<FP_SITES; slot++)
+      if (fP_sites[slot].function && num<max)
+	 sites[num++]=fP_sites[slot];
+   FP_UNLOCK();
+   return num;
+}
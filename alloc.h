@@ -0,0 +1,26 @@
+/******************************************************************************
+ *
+ * alloc.h -- the allocation profiler behind fP_Enable()
+ *
+ * fd2inline.c sends every malloc(), calloc(), realloc() and free() here,
+ * with the function and line they are made from. Without fP_Enable() they
+ * go straight on to the C library; with it, each block carries its size
+ * in front, so that the bytes still live are known when it is freed.
+ *
+ *****************************************************************************/
+
+#ifndef FD2SFD_ALLOC_H
+#define FD2SFD_ALLOC_H
+
+#include <stddef.h>
+
+void*
+fP_Malloc	(size_t size, const char* function, int line);
+void*
+fP_Calloc	(size_t num, size_t size, const char* function, int line);
+void*
+fP_Realloc	(void* ptr, size_t size, const char* function, int line);
+void
+fP_Free		(void* ptr);
+
+#endif /* FD2SFD_ALLOC_H */
@@ -0,0 +1,566 @@
+/******************************************************************************
+ *
+ * fd2sfd -- forked from fd2inline 1.38
+ *
+ * The on-disk output cache.
+ *
+ * An SFD file only depends on the bytes of the FD and clib files, their
+ * names (which are written into the header), the version of fd2sfd and
+ * CACHE_FORMAT, --quiet (which changes the diagnostics), the --only and
+ * --exclude globs, if there are any, and the -D and -U macros. The
+ * SHA-256 of all that is the key; the cache directory holds
+ *
+ *   key.sfd    the SFD file
+ *   key.err    the diagnostics: the length of the part printed while
+ *	       reading on the first line, then the text
+ *   usage      the total size of all entries, as far as we know
+ *   lock       locked while usage is updated or entries are evicted
+ *
+ * Entries are written to temporary files and renamed into place, .err
+ * before .sfd, so an entry is complete once its .sfd exists. A hit touches
+ * the .sfd, and when usage exceeds the size limit the least recently used
+ * entries are removed until a quarter of the space is free again.
+ *
+ *****************************************************************************/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "cache.h"
+
+/* Bump this with every change to what is written for the same input, so
+   that entries from before it are not used. Released versions differ in
+   VERSION anyway, but builds in between don't. 1 evaluated the #ifs of
+   the clib file, 2 ended statements at directives and took unknown
+   macros as unknown. */
+
+#define CACHE_FORMAT "2"
+
+/******************************************************************************
+ *    SHA-256 (FIPS 180-4)
+ ******************************************************************************/
+
+typedef unsigned int u32;
+
+typedef struct
+{
+   u32		 state[8];
+   unsigned char block[64];
+   unsigned long blocklen;
+   unsigned long long total;
+} cSHA;
+
+static const u32 sha_k[64]=
+{
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+   0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+   0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+   0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+   0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+   0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+   0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+   0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+   0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x,n) (((x)>>(n)) | ((x)<<(32-(n))))
+
+static void
+sha_block(cSHA* obj, const unsigned char* p)
+{
+   u32 w[64], a, b, c, d, e, f, g, h, t1, t2;
+   int i;
+
+   for (i=0; i<16; i++)
+      w[i]=(u32) p[i*4]<<24 | (u32) p[i*4+1]<<16 | (u32) p[i*4+2]<<8 |
+	   (u32) p[i*4+3];
+   for (; i<64; i++)
+      w[i]=(ROR(w[i-2], 17) ^ ROR(w[i-2], 19) ^ (w[i-2]>>10)) + w[i-7] +
+	   (ROR(w[i-15], 7) ^ ROR(w[i-15], 18) ^ (w[i-15]>>3)) + w[i-16];
+
+   a=obj->state[0]; b=obj->state[1]; c=obj->state[2]; d=obj->state[3];
+   e=obj->state[4]; f=obj->state[5]; g=obj->state[6]; h=obj->state[7];
+
+   for (i=0; i<64; i++)
+   {
+      t1=h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) +
+	 sha_k[i] + w[i];
+      t2=(ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h=g; g=f; f=e; e=d+t1; d=c; c=b; b=a; a=t1+t2;
+   }
+
+   obj->state[0]+=a; obj->state[1]+=b; obj->state[2]+=c; obj->state[3]+=d;
+   obj->state[4]+=e; obj->state[5]+=f; obj->state[6]+=g; obj->state[7]+=h;
+}
+
+static void
+sha_init(cSHA* obj)
+{
+   static const u32 init[8]=
+   {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+   };
+
+   memcpy(obj->state, init, sizeof init);
+   obj->blocklen=0;
+   obj->total=0;
+}
+
+static void
+sha_update(cSHA* obj, const void* data, size_t len)
+{
+   const unsigned char *p=data;
+
+   obj->total+=len;
+
+   if (obj->blocklen)
+   {
+      while (len && obj->blocklen<64)
+      {
+	 obj->block[obj->blocklen++]=*p++;
+	 len--;
+      }
+      if (obj->blocklen<64)
+	 return;
+      sha_block(obj, obj->block);
+      obj->blocklen=0;
+   }
+
+   for (; len>=64; p+=64, len-=64)
+      sha_block(obj, p);
+
+   memcpy(obj->block, p, len);
+   obj->blocklen=len;
+}
+
+static void
+sha_final(cSHA* obj, char* hex)
+{
+   unsigned long long bits=obj->total*8;
+   unsigned char pad[72];
+   unsigned long padlen;
+   int i;
+
+   padlen=(obj->blocklen<56 ? 56 : 120)-obj->blocklen;
+   memset(pad, 0, sizeof pad);
+   pad[0]=0x80;
+   for (i=0; i<8; i++)
+      pad[padlen+i]=(unsigned char) (bits>>(56-i*8));
+   sha_update(obj, pad, padlen+8);
+
+   for (i=0; i<32; i++)
+      sprintf(hex+i*2, "%02x",
+	      (unsigned int) (obj->state[i/4]>>(24-(i%4)*8)) & 0xff);
+}
+
+/******************************************************************************
+ *    cachekey
+ *
+ * hashes everything the output of a conversion depends on into key, which
+ * must hold CACHE_KEYSIZE chars. Returns non-zero if a file can't be read;
+ * the conversion will then report that itself.
+ ******************************************************************************/
+
+static void
+hashstring(cSHA* sha, const char* str)
+{
+   unsigned long len=strlen(str);
+
+   sha_update(sha, &len, sizeof len);
+   sha_update(sha, str, len);
+}
+
+/* the length comes first, like for strings, so that no two pairs of files
+   hash the same; a file that changes while it is read has no key */
+
+static int
+hashfile(cSHA* sha, const char* filename)
+{
+   char buffer[16384];
+   struct stat st;
+   unsigned long len, total=0;
+   size_t got;
+   FILE *file;
+   int rc;
+
+   if (!(file=fopen(filename, "r")))
+      return 1;
+   if (fstat(fileno(file), &st))
+   {
+      fclose(file);
+      return 1;
+   }
+   len=st.st_size;
+   sha_update(sha, &len, sizeof len);
+   while ((got=fread(buffer, 1, sizeof buffer, file)))
+   {
+      sha_update(sha, buffer, got);
+      total+=got;
+   }
+   rc=ferror(file) || total!=len;
+   fclose(file);
+   return rc;
+}
+
+int
+cachekey(const char* fdfilename, const char* clibfilename, int quiet,
+	 const char* filter, const char* macros, char* key)
+{
+   cSHA sha;
+
+   sha_init(&sha);
+   hashstring(&sha, "fd2sfd " VERSION " (" DATE ")");
+   hashstring(&sha, quiet ? "quiet" : "");
+   hashstring(&sha, filter);
+   hashstring(&sha, "format " CACHE_FORMAT);
+   hashstring(&sha, macros);
+   hashstring(&sha, fdfilename);
+   hashstring(&sha, clibfilename);
+   if (hashfile(&sha, fdfilename) || hashfile(&sha, clibfilename))
+      return 1;
+   sha_final(&sha, key);
+   return 0;
+}
+
+/******************************************************************************
+ *    cachelookup
+ *
+ * returns an open descriptor of the cached SFD file and its diagnostics in
+ * diag (to be freed by the caller), or -1 if the key is not in the cache.
+ ******************************************************************************/
+
+static char*
+entryname(const char* dir, const char* key, const char* suffix)
+{
+   char *name=malloc(strlen(dir)+1+CACHE_KEYSIZE+strlen(suffix)+1);
+
+   if (name)
+      sprintf(name, "%s/%s%s", dir, key, suffix);
+   return name;
+}
+
+static char*
+readfile(const char* filename, size_t* len)
+{
+   struct stat st;
+   char *text=NULL;
+   int fd;
+
+   if ((fd=open(filename, O_RDONLY))<0)
+      return NULL;
+   if (fstat(fd, &st)==0 && (text=malloc(st.st_size+1)))
+   {
+      if (read(fd, text, st.st_size)!=st.st_size)
+      {
+	 free(text);
+	 text=NULL;
+      }
+      else
+      {
+	 text[st.st_size]='\0';
+	 *len=st.st_size;
+      }
+   }
+   close(fd);
+   return text;
+}
+
+int
+cachelookup(const char* dir, const char* key, cDiag* diag)
+{
+   char *sfdname, *errname, *errtext=NULL, *end;
+   size_t errlen=0;
+   unsigned long readlen;
+   int fd=-1;
+
+   sfdname=entryname(dir, key, ".sfd");
+   errname=entryname(dir, key, ".err");
+
+   if (sfdname && errname && (fd=open(sfdname, O_RDONLY))>=0)
+   {
+      /* The entry might be evicted between opening the .sfd and reading the
+	 .err; then it's a miss */
+
+      if (!(errtext=readfile(errname, &errlen)) ||
+	  (readlen=strtoul(errtext, &end, 10), *end!='\n') ||
+	  readlen>errlen-(end+1-errtext))
+      {
+	 close(fd);
+	 fd=-1;
+      }
+      else
+      {
+	 diag->len=errlen-(end+1-errtext);
+	 diag->readlen=readlen;
+	 memmove(errtext, end+1, diag->len);
+	 diag->text=errtext;
+	 errtext=NULL;
+
+	 /* Mark as recently used */
+	 futimens(fd, NULL);
+      }
+   }
+
+   free(errtext);
+   free(sfdname);
+   free(errname);
+   return fd;
+}
+
+/******************************************************************************
+ *    cachecopy
+ *
+ * copies the cached SFD file to outfile, sharing the blocks if the file
+ * system can do that.
+ ******************************************************************************/
+
+int
+cachecopy(int cachefd, FILE* outfile)
+{
+   char buffer[16384];
+   ssize_t got;
+
+   fflush(outfile);
+
+#ifdef FICLONE
+   {
+      struct stat st;
+
+      if (fstat(fileno(outfile), &st)==0 && S_ISREG(st.st_mode) &&
+	  st.st_size==0 && ioctl(fileno(outfile), FICLONE, cachefd)==0)
+      {
+	 fseek(outfile, 0, SEEK_END);
+	 return 0;
+      }
+   }
+#endif
+
+   lseek(cachefd, 0, SEEK_SET);
+   while ((got=read(cachefd, buffer, sizeof buffer))>0)
+      if (fwrite(buffer, 1, got, outfile)!=(size_t) got)
+	 return 1;
+   return got<0;
+}
+
+/******************************************************************************
+ *    cachestore
+ *
+ * puts a conversion into the cache, and evicts old entries if the cache has
+ * grown beyond maxsize bytes. Failures are silently ignored; the cache is
+ * only an optimisation.
+ ******************************************************************************/
+
+static int
+writetemp(const char* dir, const char* header, const char* text, size_t len,
+	  const char* target)
+{
+   char *tmpname=malloc(strlen(dir)+16);
+   FILE *file;
+   int fd, rc=1;
+
+   if (!tmpname)
+      return 1;
+   sprintf(tmpname, "%s/tmp.XXXXXX", dir);
+
+   if ((fd=mkstemp(tmpname))>=0)
+   {
+      if ((file=fdopen(fd, "w")))
+      {
+	 fputs(header, file);
+	 fwrite(text, 1, len, file);
+	 fchmod(fd, 0644);
+	 rc=ferror(file);
+	 if (fclose(file))
+	    rc=1;
+      }
+      else
+	 close(fd);
+
+      if (rc || rename(tmpname, target))
+      {
+	 unlink(tmpname);
+	 rc=1;
+      }
+   }
+
+   free(tmpname);
+   return rc;
+}
+
+typedef struct
+{
+   char*  name;		/* the key */
+   time_t mtime;
+   off_t  size;		/* of .sfd and .err together */
+} cEntry;
+
+static int
+cmpentry(const void* a, const void* b) /* for qsort, oldest first */
+{
+   const cEntry *ea=a, *eb=b;
+
+   if (ea->mtime!=eb->mtime)
+      return ea->mtime<eb->mtime ? -1 : 1;
+   return strcmp(ea->name, eb->name);
+}
+
+/* removes the least recently used entries, returns the remaining size */
+
+static unsigned long
+evict(const char* dir, unsigned long maxsize)
+{
+   DIR *dirp;
+   struct dirent *de;
+   cEntry *entries=NULL;
+   long numentries=0, maxentries=0, count;
+   unsigned long total=0;
+
+   if (!(dirp=opendir(dir)))
+      return 0;
+
+   while ((de=readdir(dirp)))
+   {
+      size_t len=strlen(de->d_name);
+      struct stat st;
+      char *sfdname, *errname;
+
+      if (len!=CACHE_KEYSIZE-1+4 || strcmp(de->d_name+len-4, ".sfd"))
+	 continue;
+
+      if (numentries==maxentries)
+      {
+	 cEntry *newentries;
+
+	 maxentries=maxentries ? maxentries*2 : 256;
+	 if (!(newentries=realloc(entries, maxentries*sizeof(cEntry))))
+	    break;
+	 entries=newentries;
+      }
+
+      entries[numentries].name=malloc(CACHE_KEYSIZE);
+      if (!entries[numentries].name)
+	 break;
+      memcpy(entries[numentries].name, de->d_name, CACHE_KEYSIZE-1);
+      entries[numentries].name[CACHE_KEYSIZE-1]='\0';
+
+      sfdname=entryname(dir, entries[numentries].name, ".sfd");
+      errname=entryname(dir, entries[numentries].name, ".err");
+      if (sfdname && errname && stat(sfdname, &st)==0)
+      {
+	 entries[numentries].mtime=st.st_mtime;
+	 entries[numentries].size=st.st_size;
+	 if (stat(errname, &st)==0)
+	    entries[numentries].size+=st.st_size;
+	 total+=entries[numentries].size;
+	 numentries++;
+      }
+      else
+	 free(entries[numentries].name);
+      free(sfdname);
+      free(errname);
+   }
+   closedir(dirp);
+
+   if (total>maxsize)
+   {
+      qsort(entries, numentries, sizeof(cEntry), cmpentry);
+
+      for (count=0; count<numentries && total>maxsize/4*3; count++)
+      {
+	 char *sfdname=entryname(dir, entries[count].name, ".sfd");
+	 char *errname=entryname(dir, entries[count].name, ".err");
+
+	 if (sfdname && errname)
+	 {
+	    unlink(sfdname);
+	    unlink(errname);
+	    total-=entries[count].size;
+	 }
+	 free(sfdname);
+	 free(errname);
+      }
+   }
+
+   for (count=0; count<numentries; count++)
+      free(entries[count].name);
+   free(entries);
+
+   return total;
+}
+
+void
+cachestore(const char* dir, const char* key, unsigned long maxsize,
+	   const char* out, size_t outlen, const cDiag* diag)
+{
+   char *sfdname, *errname, *lockname, *usagename;
+   char header[32];
+   int lockfd;
+
+   sfdname=entryname(dir, key, ".sfd");
+   errname=entryname(dir, key, ".err");
+   lockname=malloc(strlen(dir)+8);
+   usagename=malloc(strlen(dir)+8);
+
+   if (!sfdname || !errname || !lockname || !usagename)
+      goto quit;
+
+   sprintf(lockname, "%s/lock", dir);
+   sprintf(usagename, "%s/usage", dir);
+   sprintf(header, "%lu\n", (unsigned long) diag->readlen);
+
+   mkdir(dir, 0755);
+
+   if (writetemp(dir, header, diag->text, diag->len, errname) ||
+       writetemp(dir, "", out, outlen, sfdname))
+      goto quit;
+
+   if ((lockfd=open(lockname, O_RDWR | O_CREAT, 0644))>=0)
+   {
+      if (flock(lockfd, LOCK_EX)==0)
+      {
+	 unsigned long usage=0;
+	 FILE *file;
+
+	 if ((file=fopen(usagename, "r")))
+	 {
+	    if (fscanf(file, "%lu", &usage)!=1)
+	       usage=0;
+	    fclose(file);
+	 }
+
+	 usage+=outlen+strlen(header)+diag->len;
+
+	 if (usage>maxsize)
+	    usage=evict(dir, maxsize);
+
+	 if ((file=fopen(usagename, "w")))
+	 {
+	    fprintf(file, "%lu\n", usage);
+	    fclose(file);
+	 }
+	 flock(lockfd, LOCK_UN);
+      }
+      close(lockfd);
+   }
+
+  quit:
+   free(sfdname);
+   free(errname);
+   free(lockname);
+   free(usagename);
+}
@@ -0,0 +1,34 @@
+/******************************************************************************
+ *
+ * cache.h -- the on-disk SFD output cache
+ *
+ *****************************************************************************/
+
+#ifndef FD2SFD_CACHE_H
+#define FD2SFD_CACHE_H
+
+#include <stdio.h>
+
+#define CACHE_KEYSIZE 65 /* 64 hex digits and a NUL */
+
+/* the diagnostics a cached conversion printed, split like convert() */
+
+typedef struct
+{
+   char*  text;
+   size_t readlen;	/* text[0..readlen-1] came from reading	    */
+   size_t len;		/* text[readlen..len-1] came from writing   */
+} cDiag;
+
+int
+cachekey	(const char* fdfilename, const char* clibfilename, int quiet,
+		 const char* filter, const char* macros, char* key);
+int
+cachelookup	(const char* dir, const char* key, cDiag* diag);
+int
+cachecopy	(int cachefd, FILE* outfile);
+void
+cachestore	(const char* dir, const char* key, unsigned long maxsize,
+		 const char* out, size_t outlen, const cDiag* diag);
+
+#endif /* FD2SFD_CACHE_H */
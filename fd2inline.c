@@ -13,9 +13,34 @@
  *****************************************************************************/
 
 #include <ctype.h>
+#include <limits.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "alloc.h"
+#include "fd2sfd.h"
+#include "scan.h"
+#include "tables.h"
+
+/* every allocation goes through the profiler, see fP_Enable() */
+
+#define malloc(size)	   fP_Malloc((size), __func__, __LINE__)
+#define calloc(num, size)  fP_Calloc((num), (size), __func__, __LINE__)
+#define realloc(ptr, size) fP_Realloc((ptr), (size), __func__, __LINE__)
+#define free(ptr)	   fP_Free(ptr)
+
+/* LibExcTable, TypeTable and the others, made from tables.def */
+
+#include "tables.inc"
 
 /******************************************************************************
  * The program has a few sort of class definitions, which are the result of
@@ -23,10 +48,11 @@
  * had the time to learn C++ or install the compiler. The design does however
  * improve robustness, which allows the source to be used over and over again.
  * if you use this code, please leave a little origin note.
+ *
+ * This file is the conversion library (libfd2sfd); the fd2sfd command line
+ * tool lives in fd2sfd.c and the public interface in fd2sfd.h.
  ******************************************************************************/
 
-static const char version_str[]="$VER: fd2sfd " VERSION " (" DATE ")\r\n";
-
 /******************************************************************************
  * These are general definitions including types for defining registers etc.
  ******************************************************************************/
@@ -44,7 +70,8 @@ static const char version_str[]="$VER: fd2sfd " VERSION " (" DATE ")\r\n";
 #endif
 
 #define REGS 16	 /* d0=0,...,a7=15 */
-#define FDS 1000
+#define FDS 64	 /* the least number of definitions to make room for */
+#define FD_LINE 32 /* guess at bytes per definition in an fd file */
 
 typedef enum
 {
@@ -55,131 +82,47 @@ typedef unsigned char shortcard;
 
 typedef enum { false, nodef, real_error } Error;
 
-static int Quiet = 0;
-
-static char BaseName[64], BaseNamU[64], BaseNamL[64], BaseNamC[64];
-static char Buffer[512];
-
-static const char *LibExcTable[]=
-{
-   "BattClockBase",	   "Node",
-   "BattMemBase",	   "Node",
-   "ConsoleDevice",	   "Device",
-   "DiskBase",		   "DiskResource",
-   "DOSBase",		   "DosLibrary",
-   "SysBase",		   "ExecBase",
-   "ExpansionBase",	   "ExpansionBase",
-   "GfxBase",		   "GfxBase",
-   "InputBase",		   "Device",
-   "IntuitionBase",	   "IntuitionBase",
-   "LocaleBase",	   "LocaleBase",
-   "MathIeeeDoubBasBase",  "MathIEEEBase",
-   "MathIeeeDoubTransBase","MathIEEEBase",
-   "MathIeeeSingBasBase",  "MathIEEEBase",
-   "MathIeeeSingTransBase","MathIEEEBase",
-   "MiscBase",		   "Node",
-   "PotgoBase",		   "Node",
-   "RamdriveDevice",	   "Device",
-   "RealTimeBase",	   "RealTimeBase",
-   "RexxSysBase",	   "RxsLib",
-   "TimerBase",		   "Device",
-   "UtilityBase",	   "UtilityBase"
-};
-static const char *StdLib; /* global lib-name ptr */
-
 #define CLASS		"class"
-#define DEVICE		"device"
 #define GADGET		"gadget"
 #define IMAGE		"image"
-#define RESOURCE	"resource"
-
-static const char *TypeTable[] =
-{
-   "ARexxBase",		CLASS,
-   "DTClassBase",	CLASS,
-   "RequesterBase",	CLASS,
-   "WindowBase",	CLASS,
-
-   "AHIBase",		DEVICE,
-   "ConsoleDevice",	DEVICE,
-   "InputBase",		DEVICE,
-   "RamdriveDevice",	DEVICE,
-   "TimerBase",		DEVICE,
-
-   "BGUIPaletteBase",	GADGET,
-   "ButtonBase",	GADGET,
-   "CheckBoxBase",	GADGET,
-   "ChooserBase",	GADGET,
-   "ColorWheelBase",	GADGET,
-   "ClickTabBase",	GADGET,
-   "DateBrowserBase",	GADGET,
-   "FuelGaugeBase",	GADGET,
-   "GetFileBase",	GADGET,
-   "GetFontBase",	GADGET,
-   "GetScreenModeBase",	GADGET,
-   "IntegerBase",	GADGET,
-   "LayoutBase",	GADGET,
-   "ListBrowserBase",	GADGET,
-   "PaletteBase",	GADGET,
-   "PopCycleBase",	GADGET,
-   "RadioButtonBase",	GADGET,
-   "ScrollerBase",	GADGET,
-   "SliderBase",	GADGET,
-   "SpaceBase",		GADGET,
-   "SpeedBarBase",	GADGET,
-   "StringBase",	GADGET,
-   "TextEditorBase",	GADGET,
-   "TextFieldBase",	GADGET,
-   "VirtualBase",	GADGET,
-
-   "BevelBase",		IMAGE,
-   "BitMapBase",	IMAGE,
-   "DrawListBase",	IMAGE,
-   "GlyphBase",		IMAGE,
-   "LabelBase",		IMAGE,
-   "PenMapBase",	IMAGE,
-
-   "BattClockBase",	RESOURCE,
-   "BattMemBase",	RESOURCE,
-   "CardResource",	RESOURCE,
-   "DiskBase",		RESOURCE,
-   "KeymapBase",	RESOURCE,
-   "MiscBase",		RESOURCE,
-   "PotgoBase"		RESOURCE,
-};
-
 
 /*******************************************
  * just some support functions, no checking
  *******************************************/
 
-char*
-NewString(char** new, const char* old)
-{
-   const char *high;
-   unsigned long len;
+/* the string between ptr and ptr+len without blanks at either end */
 
-   while (*old && (*old==' ' || *old=='\t'))
-      old++;
-   len=strlen(old);
-   for (high=old+len-1; high>=old && (*high==' ' || *high=='\t'); high--);
-   high++;
-   len=high-old;
-   *new=malloc(1+len);
-   if (*new)
+static const char*
+TrimView(const char* ptr, size_t* len)
+{
+   while (*len && (*ptr==' ' || *ptr=='\t'))
    {
-      strncpy(*new, old, len);
-      (*new)[len]='\0';
+      ptr++;
+      (*len)--;
    }
-   else
-      fprintf(stderr, "No mem for string\n");
-   return *new;
+   while (*len && (ptr[*len-1]==' ' || ptr[*len-1]=='\t'))
+      (*len)--;
+   return ptr;
+}
+
+/* the same for a string that may be changed: cut off in place */
+
+static char*
+TrimString(char* str)
+{
+   size_t len=strlen(str);
+   char *ptr=(char*) TrimView(str, &len);
+
+   ptr[len]='\0';
+   return ptr;
 }
 
+/* errfile is that of the object, if there is one to take it from */
+
 static INLINE void
-illparams(const char* funcname)
+illparams(FILE* errfile, const char* funcname)
 {
-   fprintf(stderr, "%s: illegal Parameters\n", funcname);
+   fprintf(errfile ? errfile : stderr, "%s: illegal Parameters\n", funcname);
 }
 
 static INLINE const char*
@@ -199,39 +142,10 @@ RegStr(regs reg)
 }
 
 
-static INLINE 
-
-/******************************************************************************
- *    StrNRBrk
- *
- * searches string in from position at downwards, as long as in does not
- * contain any character in not.
- *
- ******************************************************************************/
-
-const char*
-StrNRBrk(const char* in, const char* not, const char* at)
-{
-   const char *chcheck;
-   Error ready;
-
-   chcheck=""; /* if at<in, the result will be NULL */
-   for (ready=false; ready==false && at>=in;)
-   {
-      for (chcheck=not; *chcheck && *chcheck != *at; chcheck++);
-      if (*chcheck)
-	 ready=real_error;
-      else
-	 at--;
-   }
-   DBP(fprintf(stderr, "{%c}", *chcheck));
-   return *chcheck ? at : NULL;
-}
-
 /*
   Our own "strupr", since it is a non-standard function.
 */
-void
+static void
 StrUpr(char* str)
 {
    while (*str)
@@ -241,72 +155,20 @@ StrUpr(char* str)
    }
 }
 
-int
-MatchGlob( char* glob, char* str )
-{
-  while( *glob )
-  {
-    char c = *glob++;
-
-    switch( c )
-    {
-      case '?':
-	if( *str == 0 )
-	{
-	  return 0;
-	}
-	break;
-
-      case '\\':
-	c = *glob++;
-	if( c == 0 || *str != c )
-	{
-	  return 0;
-	}
-	break;
-	
-      case '*':
-	if( *glob == 0 )
-	{
-	  return 1;
-	}
-
-	while( *str )
-	{
-	  if( MatchGlob( glob, str ) )
-	  {
-	    return 1;
-	  }
-	  ++str;
-	}
-	return 0;
-
-      default:
-	if( *str != c )
-	{
-	  return 0;
-	}
-	break;
-    }
+/* skips blanks and comments in the string from ptr to end, where its NUL
+   is. As it always did, a comment's star may also be the one ending it. */
 
-    ++str;
-  }
-
-  return *str == 0;
-}
-
-const char*
-SkipWSAndComments( const char* ptr )
+static const char*
+SkipWSAndComments( const fdScan* scan, const char* ptr, const char* end )
 {
    for(;;)
    {
-      while (*ptr && (*ptr==' ' || *ptr=='\t'))
-	 ptr++;
+      ptr+=scan->blanks(ptr, end-ptr);
       if (ptr[0] == '/' && ptr[1] == '*' ) 
       {
-	 ptr+=2;
-	 while (ptr[0] && ! (ptr[-2] == '*' && ptr[-1] == '/') )
-	    ptr++;
+	 ptr++;
+	 ptr+=scan->commentend(ptr, end-ptr);
+	 ptr=ptr<end ? ptr+2 : end;
       }
       else
 	 break;
@@ -320,44 +182,95 @@ SkipWSAndComments( const char* ptr )
  *
  * stores a file with a temporary buffer (static length, sorry), a line number,
  * an offset (used for library offsets and an error field.
+ * Regular files are mapped into memory and the lines are cut out of the
+ * mapping; anything that cannot be mapped (pipes, mostly) is read with fgets.
+ * Line numbers are only counted when a diagnostic asks for one.
  * When there's no error, line will contain line #lineno and offset will be
  * the last offset set by the interpretation of the last line. If there's been
  * no ##bias line, this field assumes a bias of 30, which is the standard bias.
  * It is assumed offsets are always negative.
  ******************************************************************************/
 
-#define fF_BUFSIZE 8192
+#define fF_BUFSIZE 8192	/* the line buffer to start with; it grows */
 
 /* all you need to know about an fdFile you parse */
 
 typedef enum {FD_PRIVATE=1} fdflags;
 
+/* a '(' whose ')' fF_Proto() hasn't seen yet, and the word before it */
+
+typedef struct
+{
+   size_t open;
+   size_t name, nameend;
+   int	  nameok;	 /* the word is all letters, digits and '_'	  */
+} fdParen;
+
+/* what fF_Proto() found in the current line; offsets into it */
+
+typedef struct
+{
+   size_t start;	 /* after the blanks and comments at the start	  */
+   size_t name, namelen;
+   size_t open;		 /* the '(' after the name			  */
+   size_t firstopen;	 /* the line's first '(', or linelen		  */
+   size_t* args;	 /* the ',' or ')' ending each argument after	  */
+			 /* firstopen					  */
+   size_t numargs, maxargs;
+} fdProto;
+
 typedef struct
 {
    FILE*         file;	      /* the file we're reading from	  */
-   char	         line[fF_BUFSIZE]; /* the current line		  */
+   FILE*         errfile;     /* where diagnostics go		  */
+   const fdScan* scan;	      /* the kernels to scan lines with	  */
+   const char*   map;	      /* the mapped file, or NULL	  */
+   size_t        mapsize;
+   size_t        pos;	      /* next byte to read from map	  */
+   size_t        linepos;     /* where the current line starts	  */
+   size_t        countpos;    /* lineno is valid up to here	  */
+   char*         line;	      /* the current line		  */
+   size_t        linelen;     /* strlen(line)			  */
+   size_t        linesize;    /* the room line has		  */
+   unsigned long lines;	      /* read so far, for the stats	  */
+   size_t        bytes;
+   fdProto       proto;	      /* see fF_Proto			  */
+   fdParen*      parens;      /* ... and the '(' it has open	  */
+   size_t        maxparens;
    unsigned long lineno;      /* current line number		  */
    long	         offset;      /* current fd offset (-bias)	  */
    Error         error;	      /* is everything o.k.		  */
    fdflags       flags;	      /* for ##private			  */
+   char          basename[64]; /* from ##base			  */
+   fdConverter*  clib;	      /* gets every line, see fC_ClibLine */
+   int		 ended;	      /* a directive ended the statement  */
 } fdFile;
 
-fdFile*
-fF_ctor	       (const char* fname);
+static int
+fC_ClibLine    (fdConverter* obj, fdFile* file, const char* line,
+		size_t len); /* 1 to leave it out, 2 if a directive */
+
+static fdFile*
+fF_ctor	       (const char* fname, const fdScan* scan, FILE* errfile);
 static void
 fF_dtor	       (fdFile* obj);
 static void
 fF_SetError    (fdFile* obj, Error error);
 static void
 fF_SetOffset   (fdFile* obj, long at);
-Error
+static Error
 fF_readln      (fdFile* obj);
+static unsigned long
+fF_LineNo      (fdFile* obj);
 static Error
 fF_GetError    (const fdFile* obj);
 static long
 fF_GetOffset   (const fdFile* obj);
-char*
-fF_FuncName    (fdFile* obj); /* return name or null */
+static int
+fF_Proto       (fdFile* obj); /* 1 if line is a prototype */
+static int
+fF_SetLine     (fdFile* obj, const char* text, size_t len,
+		unsigned long lineno);
 static void
 fF_SetFlags    (fdFile* obj, fdflags flags);
 static fdflags
@@ -366,7 +279,14 @@ fF_GetFlags    (const fdFile* obj);
 static INLINE void
 fF_dtor(fdFile* obj)
 {
+#ifdef HAVE_SYS_MMAN_H
+  if (obj->map)
+    munmap((void*) obj->map, obj->mapsize);
+#endif
   fclose(obj->file);
+  free(obj->line);
+  free(obj->parens);
+  free(obj->proto.args);
   free(obj);
 }
 
@@ -376,7 +296,7 @@ fF_SetError(fdFile* obj, Error error)
    if (obj)
       obj->error=error;
    else
-      illparams("fF_SetError");
+      illparams(NULL, "fF_SetError");
 }
 
 #define FUNCTION_GAP (6)
@@ -387,7 +307,7 @@ fF_SetOffset(fdFile* obj, long at)
    if (obj)
       obj->offset= at;
    else
-      illparams("fFSetOffset");
+      illparams(NULL, "fFSetOffset");
 }
 
 static INLINE void
@@ -396,30 +316,59 @@ fF_SetFlags(fdFile* obj, fdflags flags)
   if (obj)
     obj->flags=flags;
   else
-    illparams("fF_SetFlags");
+    illparams(NULL, "fF_SetFlags");
 }
 
-fdFile*
-fF_ctor(const char* fname)
+static fdFile*
+fF_ctor(const char* fname, const fdScan* scan, FILE* errfile)
 {
    fdFile *result;
 
    if (fname)
    {
       result=calloc(1,sizeof(fdFile));
+      if (result && !(result->line=malloc(fF_BUFSIZE)))
+      {
+	 free(result);
+	 result=NULL;
+      }
       if (result)
       {
+	 result->linesize=fF_BUFSIZE;
 	 result->file=fopen(fname, "r");
 	 if (result->file)
 	 {
+#ifdef HAVE_SYS_MMAN_H
+	    struct stat st;
+
+	    if (fstat(fileno(result->file), &st)==0 && S_ISREG(st.st_mode) &&
+		st.st_size>0 && (size_t) st.st_size==(unsigned long) st.st_size)
+	    {
+	       void *map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+			      fileno(result->file), 0);
+
+	       if (map!=MAP_FAILED)
+	       {
+		  result->map=map;
+		  result->mapsize=st.st_size;
+#ifdef MADV_SEQUENTIAL
+		  madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+	       }
+	    }
+#endif
+	    result->scan=scan;
+	    result->errfile=errfile;
 	    result->lineno=0;
 	    fF_SetOffset(result, -30);
 	    fF_SetError(result, false);
 	    fF_SetFlags(result, 0);
 	    result->line[0]='\0';
+	    result->basename[0]='\0';
 	 }
 	 else
 	 {
+	    free(result->line);
 	    free(result);
 	    result=NULL;
 	 }
@@ -428,71 +377,264 @@ fF_ctor(const char* fname)
    else
    {
       result=NULL;
-      illparams("fF_ctor");
+      illparams(errfile, "fF_ctor");
    }
    return result;
 }
 
-Error
+/* makes room for size bytes in obj->line; 0 if there's no memory */
+
+static int
+fF_Room(fdFile* obj, size_t size)
+{
+   size_t max;
+   char *line;
+
+   if (size<=obj->linesize)
+      return 1;
+   for (max=obj->linesize; max<size; max*=2);
+   if (!(line=realloc(obj->line, max)))
+   {
+      fprintf(obj->errfile, "No mem for line %lu.\n", fF_LineNo(obj));
+      return 0;
+   }
+   obj->line=line;
+   obj->linesize=max;
+   return 1;
+}
+
+/* fgets() for both kinds of fdFile: reads a line, however long, to
+   obj->line+at. Returns the length of the string read, or -1 at the end of
+   the file, and sets *trimmed to its length without the blanks at the end.
+   A directive after a line of a statement (at>0) ends the statement: then
+   nothing is read, and obj->ended is set */
+
+static long
+fF_gets(fdFile* obj, size_t at, size_t* trimmed)
+{
+   const char *start, *end;
+   char *buf;
+   size_t len, stop;
+   int left=0;
+
+   obj->ended=0;
+   if (!obj->map)
+   {
+      /* fgets() fills the buffer up only if the line goes on */
+
+      do
+      {
+	 obj->lineno++;
+	 for (len=0;; len=obj->linesize-at-1)
+	 {
+	    size_t room;
+
+	    if (!fF_Room(obj, len ? 2*obj->linesize : at+2))
+	       return -1;
+	    buf=obj->line+at+len;
+	    room=obj->linesize-at-len;
+	    buf[room-1]='\n';
+	    if (!fgets(buf, room, obj->file))
+	    {
+	       if (!len)
+		  return -1;
+	       break;
+	    }
+	    if (buf[room-1]!='\0' || buf[room-2]=='\n')
+	       break;
+	 }
+	 buf=obj->line+at;
+	 stop=obj->scan->line(buf, obj->linesize-at, trimmed);
+	 len=buf[stop]=='\n' ? stop+1 : stop;
+	 obj->lines++;
+	 obj->bytes+=len;
+      }
+      while (obj->clib && (left=fC_ClibLine(obj->clib, obj, buf, len)) &&
+	     !(left==2 && at));
+      if (left==2)
+      {
+	 obj->ended=1;
+	 buf[0]='\0';
+	 *trimmed=0;
+	 return 0;
+      }
+      return len;
+   }
+
+   do
+   {
+      if (obj->pos>=obj->mapsize)
+	 return -1;
+
+      start=obj->map+obj->pos;
+      len=obj->mapsize-obj->pos;
+
+      /* the string ends at a NUL, but the line goes on to the newline */
+
+      stop=obj->scan->line(start, len, trimmed);
+      if (stop<len && start[stop]=='\n')
+	 len=stop+1;
+      else if (stop<len && (end=memchr(start+stop, '\n', len-stop)))
+	 len=end-start+1;
+
+      obj->linepos=obj->pos;
+      obj->pos+=len;
+      obj->lines++;
+      obj->bytes+=len;
+   }
+   while (obj->clib && (left=fC_ClibLine(obj->clib, obj, start, len)) &&
+	  !(left==2 && at));
+   if (left==2)
+   {
+      obj->ended=1;
+      obj->line[at]='\0';
+      *trimmed=0;
+      return 0;
+   }
+
+   if (!fF_Room(obj, at+len+1))
+      return -1;
+   buf=obj->line+at;
+   memcpy(buf, start, len);
+   buf[len]='\0';
+   return stop<len && start[stop]=='\0' ? stop : len;
+}
+
+/* the number of the line read last; counted from the mapping on demand */
+
+static unsigned long
+fF_LineNo(fdFile* obj)
+{
+   if (obj->map)
+   {
+      const char *ptr=obj->map+obj->countpos, *end=obj->map+obj->linepos;
+
+      if (obj->lineno==0)
+	 obj->lineno=1;
+      while (ptr<end && (ptr=memchr(ptr, '\n', end-ptr)))
+      {
+	 obj->lineno++;
+	 ptr++;
+      }
+      obj->countpos=obj->linepos;
+   }
+   return obj->lineno;
+}
+
+/******************************************************************************
+ * fF_readln reads a statement: lines are joined until one ends in ';' or ')',
+ * leaving out the blanks at the end of each and the blanks and comments at
+ * the start of every line but the first. Lines starting with '*', '#' or '/'
+ * are statements of their own. The scan kernel gives the end of each line's
+ * text along with the line, so nothing is looked at twice. obj->line grows
+ * to hold whatever a statement adds up to.
+ *
+ * In a clib file, a comment after the ';' or ')' is left out, and a
+ * directive ends the statement before it whatever that ends in.
+ ******************************************************************************/
+
+/* where line[start..end-1] ends without a comment at its end and the
+   blanks before that, or end if there is none */
+
+static size_t
+fF_CommentStart(const char* line, size_t start, size_t end)
+{
+   size_t at;
+
+   if (end-start<4 || line[end-2]!='*' || line[end-1]!='/')
+      return end;
+   for (at=end-3; at-->start;)
+      if (line[at]=='/' && line[at+1]=='*')
+      {
+	 while (at>start && (line[at-1]==' ' || line[at-1]=='\t'))
+	    at--;
+	 return at;
+      }
+   return end;
+}
+
+static Error
 fF_readln(fdFile* obj)
 {
-   char *low, *bpoint;
-   long glen,  /* the length we read until now */
-   len;	       /* the length of the last segment */
+   char *line;
+   size_t low,	/* where the last line went */
+	  end,	/* the end of its text */
+	  code,	/* ... without a comment at the end */
+	  skip, trimmed;
+   long got;	/* the length of the last line */
 
    if (obj)
    {
-      low=obj->line;
-      glen=0;
+      low=0;
 
       for (;;)
       {
-	 obj->lineno++;
-	 if (!fgets(low, fF_BUFSIZE-1-glen, obj->file))
+	 if ((got=fF_gets(obj, low, &trimmed))<0)
 	 {
 	    fF_SetError(obj, real_error);
 	    obj->line[0]='\0';
+	    obj->linelen=0;
 	    return real_error;
 	 }
-	 if (low==strpbrk(low, "*#/"))
+	 line=obj->line;
+	 obj->linelen=low+got;
+	 if (obj->ended)
 	 {
-	    DBP(fprintf(stderr, "in# %s\n", obj->line));
+	    obj->linelen=low;
 	    return false;
 	 }
-	 low=(char*) SkipWSAndComments(low);
-	 len=strlen(low);
-	 bpoint=low+len-1;
-	 while (len && isspace(*bpoint))
+	 if (line[low]=='*' || line[low]=='#' || line[low]=='/')
 	 {
-	    bpoint--;
-	    len--;
+	    DBP(fprintf(stderr, "in# %s\n", line));
+	    return false;
 	 }
-	 if (*bpoint==';' || *bpoint==')')
+	 skip=SkipWSAndComments(obj->scan, line+low, line+low+got)-(line+low);
+
+	 /* the last char of the segment, or the one before it if it's empty */
+
+	 end=low+(trimmed>skip ? trimmed : skip);
+	 if (end && (line[end-1]==';' || line[end-1]==')'))
 	 {
-	    DBP(fprintf(stderr, "\nin: %s\n", obj->line));
+	    DBP(fprintf(stderr, "\nin: %s\n", line));
 	    return false;
 	 }
-	 glen+=len;
-	 low+=len;
-	 if (glen>=fF_BUFSIZE-10) /* somewhat pessimistic? */
+	 code=obj->clib ? fF_CommentStart(line, low+skip, end) : end;
+	 if (code<end && code && (line[code-1]==';' || line[code-1]==')'))
 	 {
-	    fF_SetError(obj, real_error);
-	    fprintf(stderr, "Line %lu too long.\n", obj->lineno);
-	    return real_error;
+	    line[code]='\0';
+	    obj->linelen=code;
+	    return false;
 	 }
+	 low=end;
 	 DBP(fprintf(stderr, "+"));
       }
    }
-   illparams("fF_readln");
+   illparams(NULL, "fF_readln");
    return real_error;
 }
 
+/* makes text, read before from line lineno, the current line again */
+
+static int
+fF_SetLine(fdFile* obj, const char* text, size_t len, unsigned long lineno)
+{
+   if (!fF_Room(obj, len+1))
+      return 1;
+   memcpy(obj->line, text, len);
+   obj->line[len]='\0';
+   obj->linelen=len;
+   obj->lineno=lineno;
+   obj->countpos=obj->linepos;
+   fF_SetError(obj, false);
+   return 0;
+}
+
 static INLINE Error
 fF_GetError(const fdFile* obj)
 {
    if (obj)
       return obj->error;
-   illparams("fF_GetError");
+   illparams(NULL, "fF_GetError");
    return real_error;
 }
 
@@ -501,130 +643,156 @@ fF_GetOffset(const fdFile* obj)
 {
    if (obj)
       return obj->offset;
-   illparams("fF_GetOffset");
+   illparams(NULL, "fF_GetOffset");
    return -1;
 }
 
 /******************************************************************************
- * fF_FuncName
+ * fF_Proto
  *
- * checks if it can find a function-name and return it's address, or NULL
- * if the current line does not seem to contain one. The return value will
- * be a pointer into a malloced buffer, thus the caller will have to free().
+ * checks if the current line is a prototype, and notes where its parts are
+ * in obj->proto. This is one pass from left to right: every '(' is pushed
+ * together with the word before it, and every ')' pops the '(' it closes,
+ * so the last ')' of the line leaves the function's name and its '(' behind.
+ * On the way, the ',' and ')' ending the arguments after the line's first
+ * '(' are collected for fD_parsepr(). A line with a char that can't be part
+ * of a prototype (comments, past the start) is none.
  ******************************************************************************/
 
-char*
-fF_FuncName(fdFile* obj)
+static int
+fF_Proto(fdFile* obj)
 {
-   const char *lower;
-   const char *upper;
-   char *buf;
-   long obraces;  /* count of open braces */
-   Error ready;	  /* ready with searching */
+   fdProto *proto;
+   fdParen last={0, 0, 0, 0};
+   const char *line;
+   size_t len, at, start,
+	  brk=0,	/* one past the last ' ', '\t', '*' or ')'	*/
+	  word=0, end=0,/* the word up to the last char but a blank	*/
+	  bad=0,	/* one past the last char that can't be in one	*/
+	  nest=0,	/* the '(' open				*/
+	  depth=0;	/* ... of them, after the first one		*/
+   int	  closed=0, matched=0;
 
    if (!obj || fF_GetError(obj)==real_error)
    {
-      illparams("fF_FuncName");
-      return NULL;
-   }
-   lower=obj->line;
-   /* lcs: Skip whitespaces AND comments */
-   lower=SkipWSAndComments(lower);
-   if (!*lower || (!isalpha(*lower) && *lower!='_'))
-   {
-      fF_SetError(obj, nodef);
-      return NULL;
+      illparams(obj ? obj->errfile : NULL, "fF_Proto");
+      return 0;
    }
 
-   while (*lower)
+   proto=&obj->proto;
+   line=obj->line;
+   len=obj->linelen;
+   start=SkipWSAndComments(obj->scan, line, line+len)-line;
+   proto->start=start;
+   proto->firstopen=len;
+   proto->numargs=0;
+
+   if (start==len || (!isalpha((unsigned char) line[start]) &&
+		      line[start]!='_'))
+      return 0;
+
+   for (at=0; at<len; at++)
    {
-      if (!isalnum(*lower) && !isspace(*lower) && *lower!='*' && *lower!=','
-      && *lower!='.' && *lower!=';' && *lower!='(' && *lower!=')' &&
-      *lower!='[' && *lower!=']' && *lower!='_' && *lower!='\\')
+      int c=(unsigned char) line[at];
+
+      if (c==' ' || c=='\t')
       {
-	 fF_SetError(obj, nodef);
-	 return NULL;
+	 brk=at+1;
+	 continue;
       }
-      lower++;
-   }
 
-   lower=NULL;
-   buf=NULL;
-
-   if (obj && fF_GetError(obj)==false)
-   {
-      if ((upper=strrchr(obj->line, ')'))!=0)
+      if (!isalnum(c) && c!='_')
       {
-	 DBP(fprintf(stderr, "end:%s:", upper));
+	 if (at>=start && !isspace(c) && !strchr("*,.;()[]\\", c))
+	    return 0;
 
-	 for (obraces=1, ready=false; ready==false; upper=lower)
+	 switch (c)
 	 {
-	    lower=StrNRBrk(obj->line, "()", --upper);
-	    if (lower)
-	    {
-	       switch (*lower)
+	    case '*':
+	       brk=at+1;
+	       break;
+
+	    case '(':
+	       if (nest==obj->maxparens)
 	       {
-		  case ')':
-		     obraces++;
-		     DBP(fprintf(stderr, " )%ld%s", obraces, lower));
-		     break;
-		  case '(':
-		     obraces--;
-		     DBP(fprintf(stderr, " (%ld%s", obraces, lower));
-		     if (!obraces)
-			ready=nodef;
-		     break;
-		  default:
-		     fprintf(stderr, "Faulty StrNRBrk\n");
+		  size_t max=obj->maxparens ? 2*obj->maxparens : 16;
+		  fdParen *parens=realloc(obj->parens, max*sizeof(fdParen));
+
+		  if (!parens)
+		  {
+		     fprintf(obj->errfile, "No mem for fF_Proto\n");
+		     return 0;
+		  }
+		  obj->parens=parens;
+		  obj->maxparens=max;
 	       }
-	    }
-	    else
-	    {
-	       fprintf(stderr, "'(' or ')' expected in line %lu.\n",
-		  obj->lineno);
-	       ready=real_error;
-	    }
-	 }
-	 if (ready==nodef) /* we found the matching '(' */
-	 {
-	    long newlen;
-	    const char* name;
+	       obj->parens[nest].open=at;
+	       obj->parens[nest].name=word;
+	       obj->parens[nest].nameend=end;
+	       obj->parens[nest++].nameok=bad<=word;
 
-	    upper--;
+	       if (proto->firstopen==len)
+	       {
+		  if (at>=start)
+		     proto->firstopen=at;
+	       }
+	       else
+		  depth++;
+	       break;
 
-	    while (upper>=obj->line && (*upper==' ' || *upper=='\t'))
-	       upper--;
+	    case ')':
+	       brk=at+1;
+	       closed=1;
+	       if ((matched=nest>0))
+		  last=obj->parens[--nest];
 
-	    lower=StrNRBrk(obj->line, " \t*)", upper);
+	       if (proto->firstopen==len || (depth && depth--))
+		  break;
+	       /* one at the top ends the last argument */
+	       /* fall through */
 
-	    if (!lower)
-	       lower=obj->line;
-	    else
-	       lower++;
+	    case ',':
+	       if (proto->firstopen==len || depth)
+		  break;
 
-	    for (name=lower; name<=upper; name++)
-	       if (!isalnum(*name) && *name!='_')
+	       if (proto->numargs==proto->maxargs)
 	       {
-		  fF_SetError(obj, nodef);
-		  return NULL;
-	       }
-
-	    newlen=upper-lower+1;
-	    buf=malloc(newlen+1);
+		  size_t max=proto->maxargs ? 2*proto->maxargs : 16;
+		  size_t *args=realloc(proto->args, max*sizeof(size_t));
 
-	    if (buf)
-	    {
-	       strncpy(buf, lower, newlen);
-	       buf[newlen]='\0';
-	    }
-	    else
-	       fprintf(stderr, "No mem for fF_FuncName");
+		  if (!args)
+		  {
+		     fprintf(obj->errfile, "No mem for fF_Proto\n");
+		     return 0;
+		  }
+		  proto->args=args;
+		  proto->maxargs=max;
+	       }
+	       proto->args[proto->numargs++]=at;
+	       break;
 	 }
+	 bad=at+1;
       }
+
+      word=brk;
+      end=at+1;
    }
-   else
-      illparams("fF_FuncName");
-   return buf;
+
+   if (!closed)
+      return 0;
+   if (!matched)
+   {
+      fprintf(obj->errfile, "'(' or ')' expected in line %lu.\n",
+	 fF_LineNo(obj));
+      return 0;
+   }
+   if (!last.nameok || last.nameend==last.name) /* (*fn)(...) */
+      return 0;
+
+   proto->name=last.name;
+   proto->namelen=last.nameend-last.name;
+   proto->open=last.open;
+   return 1;
 }
 
 static INLINE fdflags
@@ -632,582 +800,1682 @@ fF_GetFlags(const fdFile* obj)
 {
    if (obj)
       return obj->flags;
-   illparams("fF_GetFlags");
+   illparams(NULL, "fF_GetFlags");
    return 0;
 }
 
-/*********************
- *    CLASS fdDef    *
- *********************/
+/******************************************************************************
+ *    CLASS fdArena
+ *
+ * hands out memory from big chunks and takes it all back at once. The
+ * definitions of a conversion and all their strings live in the converter's
+ * arena, so forgetting them is a matter of resetting it. A reset keeps the
+ * first chunk, so a converter that is used again does not go back to malloc.
+ ******************************************************************************/
+
+#define fA_CHUNKSIZE 65536
+
+typedef union { long l; double d; void* p; } fdAlign;
+
+typedef struct fdChunk
+{
+   struct fdChunk* next;
+   size_t	   size;      /* usable bytes in data		  */
+   size_t	   used;
+   fdAlign	   data[1];
+} fdChunk;
 
 typedef struct
 {
-   char* name;
-   char* type;
-   long	 offset;
-   regs	 reg[REGS];
-   char* param[REGS];
-   char* proto[REGS];
-   regs	 funcpar; /* number of argument that has type "pointer to function" */
-   int   private;
-   int   base;
-   int   cfunction;
-} fdDef;
+   fdChunk* chunks;	      /* the current one first		  */
+} fdArena;
 
-fdDef*
-fD_ctor		  (void);
-void
-fD_dtor		  (fdDef* obj);
-static void
-fD_NewName	  (fdDef* obj, const char* newname);
-void
-fD_NewParam	  (fdDef* obj, shortcard at, const char* newstr);
-int
-fD_NewProto	  (fdDef* obj, shortcard at, char* newstr);
-static void
-fD_NewReg	  (fdDef* obj, shortcard at, regs reg);
-static void
-fD_NewType	  (fdDef* obj, const char* newstr);
-static void
-fD_SetOffset	  (fdDef* obj, long off);
-static void
-fD_SetBase	  (fdDef* obj, int base);
+static void*
+fA_Alloc       (fdArena* obj, size_t size);
 static void
-fD_SetCFunction	  (fdDef* obj, int cfunc);
+fA_Reset       (fdArena* obj);
+
+static void*
+fA_Alloc(fdArena* obj, size_t size)
+{
+   fdChunk *chunk=obj->chunks;
+   void *result;
+
+   size=(size+sizeof(fdAlign)-1)/sizeof(fdAlign)*sizeof(fdAlign);
+
+   if (!chunk || chunk->size-chunk->used<size)
+   {
+      size_t chunksize=size>fA_CHUNKSIZE/4 ? size : fA_CHUNKSIZE;
+
+      if (!(chunk=malloc(offsetof(fdChunk, data)+chunksize)))
+	 return NULL;
+      chunk->size=chunksize;
+      chunk->used=0;
+
+      if (chunksize!=fA_CHUNKSIZE && obj->chunks)
+      {
+	 /* a big one; keep filling the current chunk afterwards */
+	 chunk->next=obj->chunks->next;
+	 obj->chunks->next=chunk;
+      }
+      else
+      {
+	 chunk->next=obj->chunks;
+	 obj->chunks=chunk;
+      }
+   }
+
+   result=(char*) chunk->data+chunk->used;
+   chunk->used+=size;
+   return result;
+}
+
+/* free everything but the last chunk, which is kept for next time */
+
 static void
-fD_SetPrivate	  (fdDef* obj, int priv);
-Error
-fD_parsefd	  (fdDef* obj, char** comment_ptr, fdFile* infile);
-Error
-fD_parsepr	  (fdDef* obj, fdFile* infile);
-static const char*
-fD_GetName	  (const fdDef* obj);
-static long
-fD_GetOffset	  (const fdDef* obj);
-static const char*
-fD_GetParam	  (const fdDef* obj, shortcard at);
-static int
-fD_GetPrivate	  (const fdDef* obj);
-static regs
-fD_GetReg	  (const fdDef* obj, shortcard at);
-static const char*
-fD_GetRegStr	  (const fdDef* obj, shortcard at);
-static const char*
-fD_GetType	  (const fdDef* obj);
-static shortcard
-fD_ParamNum	  (const fdDef* obj);
-static shortcard
-fD_ProtoNum	  (const fdDef* obj);
-static shortcard
-fD_RegNum	  (const fdDef* obj);
-int
-fD_cmpName	  (const void* big, const void* small);
-void
-fD_write	  (FILE* outfile, const fdDef* obj, int alias);
-static shortcard
-fD_GetFuncParNum  (const fdDef* obj);
-static void
-fD_SetFuncParNum  (fdDef* obj, shortcard at);
+fA_Reset(fdArena* obj)
+{
+   fdChunk *chunk=obj->chunks, *next;
+
+   if (!chunk)
+      return;
+   while (chunk->next)
+      chunk=chunk->next;
+   for (next=obj->chunks; next!=chunk; next=obj->chunks)
+   {
+      obj->chunks=next->next;
+      free(next);
+   }
+   chunk->used=0;
+}
 
-static fdDef **defs;
-static fdDef **arrdefs;
-static char  **arrcmts;
-static long fds;
+/******************************************************************************
+ *    CLASS fdOut
+ *
+ * collects the SFD file in a big buffer and writes it out in big pieces, so
+ * that writing a definition is a matter of copying strings whose length is
+ * known anyway. Pieces that don't fit into the buffer go straight to the
+ * file.
+ ******************************************************************************/
 
-static char *fD_nostring="";
+#define fO_BUFSIZE 65536
 
-fdDef*
-fD_ctor(void)
+typedef struct
 {
-   fdDef *result;
-   regs count;
+   FILE*  file;
+   char*  buf;	      /* fO_BUFSIZE bytes, or NULL to write directly */
+   size_t len;
+} fdOut;
+
+static void
+fO_Flush       (fdOut* obj);
+static void
+fO_Write       (fdOut* obj, const char* str, size_t len);
+static void
+fO_Puts	       (fdOut* obj, const char* str);
+static void
+fO_PutNum      (fdOut* obj, long num);
 
-   result=calloc(1,sizeof(fdDef));
+/* for string literals, whose length the compiler knows */
+#define fO_Lit(obj, str) fO_Write(obj, str, sizeof(str)-1)
 
-   if (result)
-   {
-      result->name=fD_nostring;
-      result->type=fD_nostring;
-      result->funcpar=illegal;
-      result->private=0;
+static void
+fO_Flush(fdOut* obj)
+{
+   if (obj->len)
+      fwrite(obj->buf, 1, obj->len, obj->file);
+   obj->len=0;
+}
 
-      for (count=d0; count<illegal; count++ )
+static INLINE void
+fO_Write(fdOut* obj, const char* str, size_t len)
+{
+   if (!len)
+      return;
+   if (obj->len+len>fO_BUFSIZE || !obj->buf)
+   {
+      fO_Flush(obj);
+      if (len>fO_BUFSIZE/2 || !obj->buf)
       {
-	 result->reg[count]=illegal;
-	 result->param[count]=fD_nostring; /* if (!strlen) dont't free() */
-	 result->proto[count]=fD_nostring;
+	 fwrite(str, 1, len, obj->file);
+	 return;
       }
    }
-   return result;
+   memcpy(obj->buf+obj->len, str, len);
+   obj->len+=len;
 }
 
-/* free all resources and make the object as illegal as possible */
-
-void
-fD_dtor(fdDef* obj)
+static INLINE void
+fO_Puts(fdOut* obj, const char* str)
 {
-   regs count;
+   fO_Write(obj, str, strlen(str));
+}
 
-   if (obj)
-   {
-      if (!obj->name)
-	 fprintf(stderr, "fD_dtor: null name");
-      else
-	 if (obj->name!=fD_nostring)
-	    free(obj->name);
+static void
+fO_PutNum(fdOut* obj, long num)
+{
+   char digits[24], *ptr=digits+sizeof digits;
+   unsigned long val=num<0 ? -(unsigned long) num : (unsigned long) num;
+
+   do
+      *--ptr='0'+val%10;
+   while (val/=10);
+   if (num<0)
+      *--ptr='-';
+   fO_Write(obj, ptr, digits+sizeof digits-ptr);
+}
 
-      if (!obj->type)
-	 fprintf(stderr, "fD_dtor: null type");
-      else
-	 if (obj->type!=fD_nostring)
-	    free(obj->type);
+/******************************************************************************
+ *    CLASS fdFilter
+ *
+ * decides which functions get written, from any number of globs given with
+ * --only and --exclude: '*' stands for any string, '?' for any char, and '\'
+ * takes the next char as it is. A name is written if it matches one of the
+ * --only globs, or there are none, and none of the --exclude globs.
+ *
+ * fG_Compile() turns all globs into a single automaton, so matching a name
+ * takes one table lookup per char no matter how many globs there are. A
+ * state of the automaton stands for the set of places the globs can be at
+ * after the chars seen so far. Chars that appear in none of the globs lead
+ * to the same states and share one column of the table. Once a glob has
+ * nothing but '*' left, it matches whatever follows; the state just notes
+ * that and forgets the glob's places, which keeps the states few.
+ *
+ * Globs like "*A*B*" can still make the number of states grow exponentially
+ * with the number of globs. If the automaton gets bigger than fG_MAXSTATES,
+ * fG_Compile() gives up on it and keeps the places instead, and fG_Match()
+ * follows the set of places through the name itself: slower, but the same
+ * answer, for any number of globs.
+ ******************************************************************************/
 
-      obj->name=obj->type=NULL;
+#define fG_ONLY	     1	/* an --only glob, or a state in which one matched */
+#define fG_EXCLUDE   2	/* ... the same for --exclude			   */
+#define fG_MAXSTATES 4096
+#define fG_BITS	     (8*sizeof(unsigned long))
 
-      for (count=d0; count<illegal; count++)
-      {
-	 obj->reg[count]=illegal;
+enum { fG_CHAR, fG_ANY, fG_STAR, fG_END, fG_NEVER };
 
-	 if (!obj->param[count])
-	    fprintf(stderr, "fD_dtor: null param");
-	 else
-	    if (obj->param[count]!=fD_nostring)
-	       free(obj->param[count]);
+typedef struct
+{
+   unsigned char kind;		/* fG_CHAR ...				*/
+   unsigned char ch;		/* for fG_CHAR				*/
+   unsigned char tail;		/* a '*' with only '*' after it		*/
+   unsigned long glob;		/* the glob it belongs to		*/
+} fgPlace;
 
-	 if (!obj->proto[count])
-	    fprintf(stderr, "fD_dtor: null proto");
-	 else
-	    if (obj->proto[count]!=fD_nostring)
-	       free(obj->proto[count]);
+typedef struct fgBuild fgBuild;
 
-	 obj->param[count]=obj->proto[count]=NULL;
-      }
+struct fdFilter
+{
+   char**	  globs;
+   unsigned char* flags;	/* fG_ONLY or fG_EXCLUDE for each glob	*/
+   unsigned long  numglobs;
+   unsigned long  maxglobs;
+   int		  only;		/* there are --only globs		*/
+   unsigned char  column[256];	/* the table column for each char	*/
+   unsigned int	  numcolumns;
+   unsigned long* next;		/* numcolumns entries for each state,	*/
+   unsigned char* emit;		/* ... and whether a name ending there	*/
+				/* is written; NULL until compiled	*/
+   fgBuild*	  places;	/* instead of them, if there'd be too	*/
+};				/* many states				*/
+
+/* what fG_Compile() works with; a state is a bit for each place, followed
+   by a word of flags */
+
+struct fgBuild
+{
+   fgPlace*	  place;
+   unsigned long* first;	/* glob g has places first[g]..first[g+1]-1,
+				   the last of them an fG_END */
+   unsigned long  numplaces;
+   unsigned long  words;	/* per state, including the flags	*/
+   unsigned long* sets;
+   unsigned long  numstates;
+   unsigned long  maxstates;
+   unsigned long* hash;		/* state numbers, or ~0UL		*/
+   unsigned long  hashsize;	/* a power of two			*/
+};
 
-      free(obj);
+static void
+fG_Uncompile(fdFilter* obj)
+{
+   free(obj->next);
+   free(obj->emit);
+   obj->next=NULL;
+   obj->emit=NULL;
+   if (obj->places)
+   {
+      free(obj->places->place);
+      free(obj->places->first);
+      free(obj->places);
+      obj->places=NULL;
    }
-   else
-      fprintf(stderr, "fd_dtor(NULL)\n");
 }
 
-static INLINE void
-fD_NewName(fdDef* obj, const char* newname)
+fdFilter*
+fG_ctor(void)
+{
+   return calloc(1, sizeof(fdFilter));
+}
+
+void
+fG_dtor(fdFilter* obj)
 {
-   if (obj && newname)
+   unsigned long count;
+
+   if (obj)
    {
-      if (obj->name && obj->name!=fD_nostring)
-	 free(obj->name);
-      if (!NewString(&obj->name, newname))
-	 obj->name=fD_nostring;
+      for (count=0; count<obj->numglobs; count++)
+	 free(obj->globs[count]);
+      free(obj->globs);
+      free(obj->flags);
+      fG_Uncompile(obj);
+      free(obj);
    }
    else
-      illparams("fD_NewName");
+      illparams(NULL, "fG_dtor");
 }
 
-void
-fD_NewParam(fdDef* obj, shortcard at, const char* newstr)
+int
+fG_Add(fdFilter* obj, const char* glob, int exclude)
 {
-   char *pa;
+   char *copy;
 
-   if (newstr && obj && at<illegal)
+   if (!obj || !glob)
+   {
+      illparams(NULL, "fG_Add");
+      return 1;
+   }
+
+   if (obj->numglobs==obj->maxglobs)
    {
-      pa=obj->param[at];
+      unsigned long max=obj->maxglobs ? 2*obj->maxglobs : 16;
+      char **globs=realloc(obj->globs, max*sizeof(char*));
+      unsigned char *flags;
+
+      if (globs)
+	 obj->globs=globs;
+      if (!globs || !(flags=realloc(obj->flags, max)))
+	 return 1;
+      obj->flags=flags;
+      obj->maxglobs=max;
+   }
+   if (!(copy=malloc(strlen(glob)+1)))
+      return 1;
+   strcpy(copy, glob);
+
+   obj->globs[obj->numglobs]=copy;
+   obj->flags[obj->numglobs++]=exclude ? fG_EXCLUDE : fG_ONLY;
+   if (!exclude)
+      obj->only=1;
+
+   /* the automaton has to be built again */
+   fG_Uncompile(obj);
+   return 0;
+}
 
-      if (pa && pa!=fD_nostring)
-	 free(pa);
+/* the first place in set from place on, or numplaces; the states are
+   small sets of many places, so whole words are skipped */
 
-      while (*newstr==' ' || *newstr=='\t')
-	 newstr++;
+static unsigned long
+fG_Next(const fgBuild* b, const unsigned long* set, unsigned long place)
+{
+   while (place<b->numplaces)
+   {
+      unsigned long bits=set[place/fG_BITS]>>place%fG_BITS;
 
-      if (NewString(&pa, newstr))
+      if (bits)
       {
-	 obj->param[at]=pa;
+	 for (; !(bits & 1); bits>>=1)
+	    place++;
+	 return place;
       }
-      else
-	 obj->param[at]=fD_nostring;
+      place=(place/fG_BITS+1)*fG_BITS;
    }
-   else
-      illparams("fD_NewParam");
+   return b->numplaces;
 }
 
-/* get first free *reg or illegal */
+#define fG_FOREACH(b, set, place) \
+   for (place=fG_Next(b, set, 0); place<(b)->numplaces; \
+	place=fG_Next(b, set, place+1))
 
-static INLINE shortcard
-fD_RegNum(const fdDef* obj)
+/* a '*' may match nothing, so being at one means being after it, too */
+
+static void
+fG_Close(const fdFilter* obj, const fgBuild* b, unsigned long* set)
 {
-   shortcard count;
+   unsigned long *flags=set+b->words-1, place, at;
 
-   if (obj)
+   fG_FOREACH(b, set, place)
+      if (b->place[place].kind==fG_STAR)
+	 set[(place+1)/fG_BITS]|=1UL<<(place+1)%fG_BITS;
+
+   fG_FOREACH(b, set, place)
+      if (b->place[place].tail)
+      {
+	 unsigned long glob=b->place[place].glob;
+
+	 *flags|=obj->flags[glob];
+	 for (at=b->first[glob]; at<b->first[glob+1]; at++)
+	    set[at/fG_BITS]&=~(1UL<<at%fG_BITS);
+      }
+
+   /* nothing can change what happens now: all these states are one */
+
+   if (*flags & fG_EXCLUDE)
    {
-      for (count=d0; count<illegal && obj->reg[count]!=illegal; count++);
-      return count;
+      memset(set, 0, (b->words-1)*sizeof(unsigned long));
+      *flags=fG_EXCLUDE;
    }
-   else
+   else if (*flags & fG_ONLY)
+      fG_FOREACH(b, set, place)
+	 if (obj->flags[b->place[place].glob]==fG_ONLY)
+	    set[place/fG_BITS]&=~(1UL<<place%fG_BITS);
+}
+
+/* the places after reading ch at the places of from */
+
+static void
+fG_Step(const fgBuild* b, const unsigned long* from, unsigned char ch,
+	unsigned long* to)
+{
+   unsigned long place;
+
+   memset(to, 0, (b->words-1)*sizeof(unsigned long));
+   to[b->words-1]=from[b->words-1];
+
+   fG_FOREACH(b, from, place)
    {
-      illparams("fD_RegNum");
-      return illegal;
+      const fgPlace *at=b->place+place;
+
+      if (at->kind==fG_STAR)
+	 to[place/fG_BITS]|=1UL<<place%fG_BITS;
+      else if (at->kind==fG_ANY || (at->kind==fG_CHAR && at->ch==ch))
+	 to[(place+1)/fG_BITS]|=1UL<<(place+1)%fG_BITS;
    }
 }
 
-static INLINE void
-fD_NewReg(fdDef* obj, shortcard at, regs reg)
+/* the places before the first char of a name */
+
+static void
+fG_Start(const fdFilter* obj, const fgBuild* b, unsigned long* set)
 {
-   if (obj && at<illegal && (int)reg>=(int)d0 && reg<=illegal)
-      obj->reg[at]=reg;
-   else
-      illparams("fD_NewReg");
+   unsigned long g;
+
+   memset(set, 0, b->words*sizeof(unsigned long));
+   for (g=0; g<obj->numglobs; g++)
+      set[b->first[g]/fG_BITS]|=1UL<<b->first[g]%fG_BITS;
+   fG_Close(obj, b, set);
 }
 
-static INLINE regs
-fD_GetReg(const fdDef* obj, shortcard at)
+/* whether a name ending at the places of set is written: it also matches
+   the globs whose end it reached */
+
+static int
+fG_Emit(const fdFilter* obj, const fgBuild* b, const unsigned long* set)
 {
-   if (obj && at<illegal)
-      return obj->reg[at];
-   else
-   {
-      illparams("fD_GetReg");
-      return illegal;
-   }
+   unsigned long flags=set[b->words-1], place;
+
+   fG_FOREACH(b, set, place)
+      if (b->place[place].kind==fG_END)
+	 flags|=obj->flags[b->place[place].glob];
+   return !(flags & fG_EXCLUDE) && (!obj->only || flags & fG_ONLY);
 }
 
-static INLINE shortcard
-fD_GetFuncParNum(const fdDef* obj)
+static unsigned long
+fG_HashSet(const fgBuild* b, const unsigned long* set)
 {
-   if (obj)
-      return (shortcard)obj->funcpar;
-   else
-   {
-      illparams("fD_GetFuncParNum");
-      return illegal;
-   }
+   unsigned long hash=2166136261UL, word;
+
+   for (word=0; word<b->words; word++)
+      hash=(hash ^ set[word])*16777619UL;
+   return hash ^ hash>>16;
 }
 
-static INLINE void
-fD_SetFuncParNum(fdDef* obj, shortcard at)
+/* the number of the state for set, which is added if it's new; ~0UL if
+   there's no room for it */
+
+static unsigned long
+fG_State(fdFilter* obj, fgBuild* b, const unsigned long* set)
 {
-   if (obj && at<illegal)
-      obj->funcpar=at;
-   else
-      illparams("fD_SetFuncParNum");
+   unsigned long mask=b->hashsize-1, slot, state;
+   unsigned long *sets;
+
+   for (slot=fG_HashSet(b, set) & mask; b->hash[slot]!=~0UL;
+	slot=(slot+1) & mask)
+      if (memcmp(b->sets+b->hash[slot]*b->words, set,
+		 b->words*sizeof(unsigned long))==0)
+	 return b->hash[slot];
+
+   if (b->numstates==fG_MAXSTATES)
+      return ~0UL;
+
+   if (b->numstates==b->maxstates)
+   {
+      unsigned long max=2*b->maxstates, *next;
+      unsigned char *emit;
+
+      if (!(sets=realloc(b->sets, max*b->words*sizeof(unsigned long))))
+	 return ~0UL;
+      b->sets=sets;
+      if (!(next=realloc(obj->next,
+			 max*obj->numcolumns*sizeof(unsigned long))))
+	 return ~0UL;
+      obj->next=next;
+      if (!(emit=realloc(obj->emit, max)))
+	 return ~0UL;
+      obj->emit=emit;
+      b->maxstates=max;
+   }
+
+   if (2*(b->numstates+1)>b->hashsize)
+   {
+      unsigned long *hash=malloc(2*b->hashsize*sizeof(unsigned long));
+
+      if (!hash)
+	 return ~0UL;
+      free(b->hash);
+      b->hash=hash;
+      b->hashsize*=2;
+      mask=b->hashsize-1;
+      memset(hash, 0xff, b->hashsize*sizeof(unsigned long));
+      for (state=0; state<b->numstates; state++)
+      {
+	 for (slot=fG_HashSet(b, b->sets+state*b->words) & mask;
+	      hash[slot]!=~0UL; slot=(slot+1) & mask);
+	 hash[slot]=state;
+      }
+      for (slot=fG_HashSet(b, set) & mask; hash[slot]!=~0UL;
+	   slot=(slot+1) & mask);
+   }
+
+   state=b->numstates++;
+   b->hash[slot]=state;
+   sets=b->sets+state*b->words;
+   memcpy(sets, set, b->words*sizeof(unsigned long));
+   obj->emit[state]=fG_Emit(obj, b, set);
+   return state;
 }
 
 int
-fD_NewProto(fdDef* obj, shortcard at, char* newstr)
+fG_Compile(fdFilter* obj)
 {
-   char *pr;
+   fgBuild b;
+   unsigned char rep[256];	/* a char of each column */
+   unsigned long *set, g, place, state, size=0;
+   unsigned int col;
+   int result=1, big=0;
 
-   if (newstr && obj && at<illegal)
+   if (!obj)
    {
-      char *t, arr[200]; /* I hope 200 will be enough... */
-      int numwords=1;
-      pr=obj->proto[at];
+      illparams(NULL, "fG_Compile");
+      return 1;
+   }
 
-      if (pr && pr!=fD_nostring)
-	 free(pr);
+   fG_Uncompile(obj);
+   if (!obj->numglobs)
+      return 0;
 
-      while (*newstr==' ' || *newstr=='\t')
-	 newstr++; /* Skip leading spaces */
+   for (g=0; g<obj->numglobs; g++)
+      size+=strlen(obj->globs[g])+1;
 
-      t=arr;
-      while ((*t++=*newstr)!=0)
-      {
-	 /* Copy the rest, counting number of words */
-	 if ((*newstr==' ' || *newstr=='\t') && newstr[1] && newstr[1]!=' ' &&
-	 newstr[1]!='\t')
-	    numwords++;
-	 newstr++;
-      }
+   memset(&b, 0, sizeof b);
+   b.place=malloc(size*sizeof(fgPlace));
+   b.first=malloc((obj->numglobs+1)*sizeof(unsigned long));
+   if (!b.place || !b.first)
+      goto done;
+
+   /* the places of all globs, one after the other; column 0 is for the
+      chars no glob names, such as NUL */
 
-      t=arr+strlen(arr)-1;
-      while (*t==' ' || *t=='\t')
-	 t--;
-      t[1]='\0'; /* Get rid of tailing spaces */
+   memset(obj->column, 0, sizeof obj->column);
+   rep[0]='\0';
+   obj->numcolumns=1;
+
+   for (g=0; g<obj->numglobs; g++)
+   {
+      const char *str;
 
-      if (at!=fD_GetFuncParNum(obj))
+      b.first[g]=b.numplaces;
+      for (str=obj->globs[g]; *str; str++)
       {
-	 if (numwords>1) /* One word - must be type */
-	    if (*t!='*')
+	 fgPlace *at=b.place+b.numplaces;
+
+	 at->glob=g;
+	 if (*str=='*')
+	 {
+	    if (b.numplaces>b.first[g] && at[-1].kind==fG_STAR)
+	       continue;
+	    at->kind=fG_STAR;
+	 }
+	 else if (*str=='?')
+	    at->kind=fG_ANY;
+	 else if (*str=='\\' && !str[1])
+	 {
+	    at->kind=fG_NEVER;	/* nothing is left to match it */
+	    b.numplaces++;
+	    break;
+	 }
+	 else
+	 {
+	    unsigned char ch=*str=='\\' ? *++str : *str;
+
+	    at->kind=fG_CHAR;
+	    at->ch=ch;
+	    if (!obj->column[ch])
 	    {
-	       /* '*' on the end - no parameter name used */
-	       while (*t!=' ' && *t!='\t' && *t!='*')
-		  t--;
-	       t++;
-	       if (strcmp(t, "char") && strcmp(t, "short") && strcmp(t, "int")
-	       && strcmp(t, "long") && strcmp(t, "APTR"))
-	       {
-		  /* Not one of applicable keywords - must be parameter name.
-		     Get rid of it. */
-		  t--;
-		  while (*t==' ' || *t=='\t')
-		     t--;
-		  t[1]='\0';
-	       }
+	       rep[obj->numcolumns]=ch;
+	       obj->column[ch]=obj->numcolumns++;
 	    }
+	 }
+	 b.numplaces++;
       }
-      else
-      {
-	 /* Parameter of type "pointer to function". */
-	 char *end;
-	 t=strchr(arr, '(');
-	 t++;
-	 while (*t==' ' || *t=='\t')
-	    t++;
-	 if (*t!='*')
-	    return 1;
-	 t++;
-	 end=strchr(t, ')');
-	 memmove(t+2, end, strlen(end)+1);
-	 *t='%';
-	 t[1]='s';
-      }
+      b.place[b.numplaces].kind=fG_END;
+      b.place[b.numplaces].glob=g;
+      b.place[b.numplaces++].tail=0;
 
-      if (NewString(&pr, arr))
+      for (place=b.numplaces-1; place-->b.first[g];)
+	 b.place[place].tail=b.place[place].kind==fG_STAR &&
+	    (b.place[place+1].kind==fG_END || b.place[place+1].tail);
+   }
+   b.first[g]=b.numplaces;
+
+   b.words=(b.numplaces+fG_BITS-1)/fG_BITS+1;
+   b.maxstates=16;
+   b.hashsize=32;
+   b.sets=malloc(b.maxstates*b.words*sizeof(unsigned long));
+   b.hash=malloc(b.hashsize*sizeof(unsigned long));
+   obj->next=malloc(b.maxstates*obj->numcolumns*sizeof(unsigned long));
+   obj->emit=malloc(b.maxstates);
+   set=malloc(b.words*sizeof(unsigned long));
+   if (!b.sets || !b.hash || !obj->next || !obj->emit || !set)
+      goto fail;
+   memset(b.hash, 0xff, b.hashsize*sizeof(unsigned long));
+
+   /* start at the beginning of every glob, then follow every column from
+      every state found until no new ones turn up */
+
+   fG_Start(obj, &b, set);
+   if (fG_State(obj, &b, set)==~0UL)
+      goto fail;
+
+   for (state=0; state<b.numstates; state++)
+      for (col=0; col<obj->numcolumns; col++)
       {
-	 obj->proto[at]=pr;
-	 while (*pr==' ' || *pr=='\t')
-	    pr++;
-	 if (!strcasecmp(pr, "double"))
-	 {
-	    /* "double" needs two data registers */
-	    int count, regs=fD_RegNum(obj);
-	    for (count=at+1; count<regs; count++)
-	       fD_NewReg(obj, count, fD_GetReg(obj, count+1));
-	 }
+	 unsigned long to;
+
+	 fG_Step(&b, b.sets+state*b.words, rep[col], set);
+	 fG_Close(obj, &b, set);
+	 if ((to=fG_State(obj, &b, set))==~0UL)
+	    goto fail;
+	 obj->next[state*obj->numcolumns+col]=to;
       }
-      else
-	 obj->proto[at]=fD_nostring;
+   result=0;
+
+fail:
+   big=result && b.numstates==fG_MAXSTATES;
+   free(set);
+   if (result)
+   {
+      free(obj->next);
+      free(obj->emit);
+      obj->next=NULL;
+      obj->emit=NULL;
    }
-   else
-      illparams("fD_NewProto");
+   free(b.sets);
+   free(b.hash);
 
-   return 0;
+   /* too many states: keep the places to match with */
+
+   if (big && (obj->places=malloc(sizeof(fgBuild))))
+   {
+      *obj->places=b;
+      obj->places->sets=obj->places->hash=NULL;
+      return 0;
+   }
+done:
+   free(b.place);
+   free(b.first);
+   return result;
 }
 
-static INLINE void
-fD_NewType(fdDef* obj, const char* newtype)
+/* fG_Match() without an automaton: the places after each char of name */
+
+static int
+fG_MatchPlaces(const fdFilter* obj, const char* name)
 {
-   if (obj && newtype)
+   const fgBuild *b=obj->places;
+   unsigned long buf[64], *mem=buf, *set, *to, *swap;
+   int result;
+
+   if (2*b->words>sizeof buf/sizeof buf[0] &&
+       !(mem=malloc(2*b->words*sizeof(unsigned long))))
+      return 1; /* can't tell; better too many functions than too few */
+   set=mem;
+   to=mem+b->words;
+
+   fG_Start(obj, b, set);
+   while (*name)
    {
-      if (obj->type && obj->type!=fD_nostring)
-	 free(obj->type);
-      if (!NewString(&obj->type, newtype))
-	 obj->type=fD_nostring;
+      fG_Step(b, set, (unsigned char) *name++, to);
+      fG_Close(obj, b, to);
+      swap=set;
+      set=to;
+      to=swap;
    }
-   else
-      illparams("fD_NewType");
+   result=fG_Emit(obj, b, set);
+
+   if (mem!=buf)
+      free(mem);
+   return result;
 }
 
-static INLINE void
-fD_SetOffset(fdDef* obj, long off)
+int
+fG_Match(const fdFilter* obj, const char* name)
 {
-   if (obj)
-      obj->offset=off;
-   else
-      illparams("fD_SetOffset");
+   const unsigned long *next;
+   unsigned long state=0;
+   unsigned int numcolumns;
+
+   if (obj && obj->places)
+      return fG_MatchPlaces(obj, name);
+   if (!obj || !obj->next)
+      return 1;
+
+   next=obj->next;
+   numcolumns=obj->numcolumns;
+   while (*name)
+      state=next[state*numcolumns+obj->column[(unsigned char) *name++]];
+   return obj->emit[state];
 }
 
-static INLINE void
-fD_SetBase(fdDef* obj, int base)
+/******************************************************************************
+ *    CLASS fdMacros
+ *
+ * the macros #if and #ifdef in a clib file are decided by: those given with
+ * -D and -U, which a batch builds once and all converters share, and those
+ * the clib file #defines and #undefs itself, which each converter keeps for
+ * the file it reads. A macro that was #undef'd (or given with -U) is kept
+ * as well, so that it is known not to be defined. Names are hashed into an
+ * open addressing table.
+ ******************************************************************************/
+
+typedef struct
 {
-   if (obj)
-      obj->base=base;
-   else
-      illparams("fD_SetPrivate");
+   char*	 name;	      /* "name\0value", one allocation		  */
+   const char*	 value;	      /* NULL if undefined			  */
+   int		 function;    /* takes arguments, can't be evaluated	  */
+} fdMacro;
+
+struct fdMacros
+{
+   fdMacro*	 macros;
+   long		 num, max;
+   long*	 index;	      /* macros hashed by name, or -1		  */
+   unsigned long indexsize;   /* a power of two				  */
+};
+
+fdMacros*
+fM_ctor(void)
+{
+   return calloc(1, sizeof(fdMacros));
 }
 
-static INLINE void
-fD_SetCFunction(fdDef* obj, int cfunc)
+/* forget all macros, but keep the tables */
+
+static void
+fM_Clear(fdMacros* obj)
 {
-   if (obj)
-      obj->cfunction=cfunc;
-   else
-      illparams("fD_SetPrivate");
+   unsigned long slot;
+   long count;
+
+   for (count=0; count<obj->num; count++)
+      free(obj->macros[count].name);
+   obj->num=0;
+   for (slot=0; slot<obj->indexsize; slot++)
+      obj->index[slot]=-1;
 }
 
-static INLINE void
-fD_SetPrivate(fdDef* obj, int priv)
+void
+fM_dtor(fdMacros* obj)
 {
    if (obj)
-      obj->private=priv;
+   {
+      fM_Clear(obj);
+      free(obj->macros);
+      free(obj->index);
+      free(obj);
+   }
    else
-      illparams("fD_SetPrivate");
+      illparams(NULL, "fM_dtor");
 }
 
-static INLINE const char*
-fD_GetName(const fdDef* obj)
+static long*
+fM_Slot(const fdMacros* obj, const char* name, size_t len)
 {
-   if (obj && obj->name)
-      return obj->name;
-   else
+   unsigned long mask=obj->indexsize-1, slot;
+
+   for (slot=fT_Hash(name, len, 0) & mask; obj->index[slot]>=0;
+	slot=(slot+1) & mask)
    {
-      illparams("fD_GetName");
-      return fD_nostring;
+      const char *key=obj->macros[obj->index[slot]].name;
+
+      if (strncmp(key, name, len)==0 && key[len]=='\0')
+	 break;
    }
+   return obj->index+slot;
 }
 
-static INLINE long
-fD_GetOffset(const fdDef* obj)
+static const fdMacro*
+fM_Find(const fdMacros* obj, const char* name, size_t len)
 {
-   if (obj)
-      return obj->offset;
-   else
+   long at;
+
+   if (!obj || !obj->num || (at=*fM_Slot(obj, name, len))<0)
+      return NULL;
+   return obj->macros+at;
+}
+
+/* (re)defines name; undefines it if value is NULL */
+
+static int
+fM_Set(fdMacros* obj, const char* name, size_t len, const char* value,
+       size_t valuelen, int function)
+{
+   fdMacro *macro;
+   char *text;
+   long *slot;
+
+   if (!(text=malloc(len+valuelen+2)))
+      return 1;
+   memcpy(text, name, len);
+   text[len]='\0';
+   if (value)
+      memcpy(text+len+1, value, valuelen);
+   text[len+1+valuelen]='\0';
+
+   if (2*(unsigned long) (obj->num+1)>obj->indexsize)
    {
-      illparams("fD_GetOffset");
-      return 0;
+      unsigned long size=obj->indexsize ? 2*obj->indexsize : 16;
+      long *index=malloc(size*sizeof(long)), count;
+
+      if (!index)
+      {
+	 free(text);
+	 return 1;
+      }
+      free(obj->index);
+      obj->index=index;
+      obj->indexsize=size;
+      for (size=0; size<obj->indexsize; size++)
+	 index[size]=-1;
+      for (count=0; count<obj->num; count++)
+	 *fM_Slot(obj, obj->macros[count].name,
+		  strlen(obj->macros[count].name))=count;
+   }
+
+   if (*(slot=fM_Slot(obj, name, len))<0)
+   {
+      if (obj->num==obj->max)
+      {
+	 long max=obj->max ? 2*obj->max : 16;
+	 fdMacro *macros=realloc(obj->macros, max*sizeof(fdMacro));
+
+	 if (!macros)
+	 {
+	    free(text);
+	    return 1;
+	 }
+	 obj->macros=macros;
+	 obj->max=max;
+      }
+      *slot=obj->num++;
    }
+   else
+      free(obj->macros[*slot].name);
+
+   macro=obj->macros+*slot;
+   macro->name=text;
+   macro->value=value ? text+len+1 : NULL;
+   macro->function=function;
+   return 0;
 }
 
-static INLINE int
-fD_GetPrivate(const fdDef* obj)
+/* name or name=value, as cc -D takes it; the value of a plain name is 1 */
+
+int
+fM_Define(fdMacros* obj, const char* definition)
 {
-   if (obj)
-      return obj->private;
-   else
+   const char *value;
+
+   if (!obj || !definition)
    {
-      illparams("fD_GetPrivate");
-      return 0;
+      illparams(NULL, "fM_Define");
+      return 1;
    }
+
+   if ((value=strchr(definition, '=')))
+      return fM_Set(obj, definition, value-definition, value+1,
+		    strlen(value+1), 0);
+   return fM_Set(obj, definition, strlen(definition), "1", 1, 0);
 }
 
-static INLINE const char*
-fD_GetProto(const fdDef* obj, shortcard at)
+int
+fM_Undef(fdMacros* obj, const char* name)
 {
-   if (obj && at<illegal && obj->proto[at])
-      return obj->proto[at];
-   else
+   if (!obj || !name)
    {
-      illparams("fD_GetProto");
-      return fD_nostring;
+      illparams(NULL, "fM_Undef");
+      return 1;
    }
+   return fM_Set(obj, name, strlen(name), NULL, 0, 0);
 }
 
-static INLINE const char*
-fD_GetParam(const fdDef* obj, shortcard at)
+/*********************
+ *    CLASS fdDef    *
+ *********************/
+
+/* Definitions are kept small: the arguments live in an array of their own,
+   just as long as the fd line needs, and the registers take a nibble each.
+   The counts are kept up to date by the setters rather than counted. */
+
+typedef struct
 {
-   if (obj && at<illegal && obj->param[at])
-      return obj->param[at];
-   else
+   fdArena* arena;   /* where the definition and its strings live */
+   char* name;
+   char* type;
+   char** param;     /* maxargs parameters ...			  */
+   char** proto;     /* ... and as many prototypes, or fD_nostring */
+   long	 offset;
+   unsigned short regmask;	/* which reg[] and proto[] are set */
+   unsigned short protomask;
+   unsigned char  reg[REGS/2];	/* two register numbers a byte	   */
+   shortcard maxargs;
+   shortcard numparams;
+   shortcard numregs;	/* the first unset register and prototype */
+   shortcard numprotos;
+   unsigned char private;
+   unsigned char base;
+   unsigned char cfunction;
+   unsigned char filtered;	/* left out by the converter's filter */
+} fdDef;
+
+static void
+fD_Init		  (fdDef* obj, fdArena* arena);
+void
+fD_NewParam	  (fdDef* obj, shortcard at, char* newstr);
+int
+fD_NewProto	  (fdDef* obj, shortcard at, char* newstr, FILE* errfile);
+static void
+fD_NewReg	  (fdDef* obj, shortcard at, regs reg);
+static void
+fD_SetOffset	  (fdDef* obj, long off);
+static void
+fD_SetBase	  (fdDef* obj, int base);
+static void
+fD_SetCFunction	  (fdDef* obj, int cfunc);
+static void
+fD_SetPrivate	  (fdDef* obj, int priv);
+Error
+fD_parsefd	  (fdDef* obj, char** comment_ptr, fdFile* infile);
+Error
+fD_parsepr	  (fdDef* obj, fdFile* infile);
+static const char*
+fD_GetName	  (const fdDef* obj);
+static long
+fD_GetOffset	  (const fdDef* obj);
+static const char*
+fD_GetParam	  (const fdDef* obj, shortcard at);
+static int
+fD_GetPrivate	  (const fdDef* obj);
+static regs
+fD_GetReg	  (const fdDef* obj, shortcard at);
+static const char*
+fD_GetRegStr	  (const fdDef* obj, shortcard at);
+static const char*
+fD_GetType	  (const fdDef* obj);
+static shortcard
+fD_ParamNum	  (const fdDef* obj);
+static shortcard
+fD_ProtoNum	  (const fdDef* obj);
+static shortcard
+fD_RegNum	  (const fdDef* obj);
+void
+fD_write	  (fdConverter* conv, fdOut* out, const fdDef* obj,
+		   int alias);
+
+static char *fD_nostring="";
+static char *fD_ulong="ULONG";
+
+/* an #if group open in the clib file */
+
+enum { fC_ACTIVE, fC_OPEN, fC_WAITING, fC_TAKEN, fC_SKIPPED };
+
+typedef struct
+{
+   unsigned long lineno;	 /* of the #if				   */
+   unsigned char state;		 /* compiled; read all through, since the  */
+				 /* condition is unknown; not compiled	   */
+				 /* yet; not any more; none of it	   */
+} fdGroup;
+
+/* a prototype in the clib file, kept for fC_WriteStream() */
+
+typedef struct
+{
+   size_t	 text, len;	 /* the statement, in the converter's pool */
+   size_t	 name, namelen;	 /* the function's name in it		   */
+   unsigned long lineno;
+   long		 next;		 /* the next one of the same name, or -1   */
+   unsigned char used;		 /* a definition has taken it		   */
+   unsigned char partner;	 /* the fd has the function it's the	   */
+				 /* varargs form of			   */
+} fdSpan;
+
+/******************************************************************************
+ *    CLASS fdConverter
+ *
+ * everything one conversion of an FD/clib pair needs, so that a process can
+ * convert as many pairs as it likes. The definition tables grow as needed
+ * and survive fC_Reset().
+ ******************************************************************************/
+
+struct fdConverter
+{
+   int	   quiet;	    /* don't display warnings		     */
+   FILE*   errfile;	    /* where diagnostics go		     */
+   const fdScan* scan;	    /* the kernels to read with, see fS_Get() */
+   char*   fdfilename;	    /* the files we convert		     */
+   char*   clibfilename;
+   char	   BaseName[64],    /* from ##base, and derived names	     */
+	   BaseNamU[64],
+	   BaseNamL[64],
+	   BaseNamC[64];
+   const char* StdLib;	    /* the lib-name for ==basetype	     */
+   const char* type;	    /* "library", "device", ...		     */
+   char*   outbuf;	    /* for the fdOut of fC_Write()	     */
+   char*   tagbuf;	    /* for fD_write()'s varargs names	     */
+   size_t  tagbufsize;
+   fdDef** defs;	    /* the definitions in bias order	     */
+   char**  arrcmts;	    /* the comments preceding each definition */
+   fdDef** index;	    /* defs hashed by name, see fC_FindDef() */
+   unsigned long indexsize; /* a power of two			     */
+   long	   fds;		    /* number of definitions		     */
+   long	   maxfds;	    /* ... there is room for		     */
+   fdArena arena;	    /* holds the definitions		     */
+   char*   header;	    /* ==include and ==typedef lines	     */
+   size_t  headerlen;
+   size_t  headersize;
+   int	   got_exec_types;  /* the clib includes <exec/types.h>	     */
+   int	   got_utility_tagitem; /* ... and <utility/tagitem.h>	     */
+   int	   bias;	    /* the last ==bias written		     */
+   int	   priv;	    /* the last ==private/==public written   */
+   const fdFilter* filter;  /* which functions to write, or NULL     */
+   fdFile* fdfile;	    /* fC_OpenStream()'s files		     */
+   fdFile* clibfile;
+   fdSpan* spans;	    /* the clib's prototypes, in clib order  */
+   long	   numspans, maxspans;
+   long*   spanindex;	    /* the first span of each name, hashed   */
+   unsigned long spanindexsize; /* a power of two		     */
+   char*   pool;	    /* the text of the spans		     */
+   size_t  poollen, poolsize;
+   const fdMacros* macros;  /* from -D and -U, or NULL		     */
+   fdMacros* defined;	    /* ... and from the clib file, or NULL   */
+   fdGroup* groups;	    /* the #if groups open, innermost last   */
+   long	   numgroups, maxgroups;
+   char*   directive;	    /* a directive going on over lines	     */
+   size_t  directivelen, directivesize;
+   int	   continued;	    /* ... and on to the next one	     */
+   int	   incomment;	    /* the clib line before ended in one     */
+   int	   timing;	    /* time the phases into stats	     */
+   fdStats stats;	    /* since fC_ctor(), see fC_GetStats()    */
+};
+
+static int
+fC_Index	  (fdConverter* obj);
+static fdDef*
+fC_FindDef	  (const fdConverter* obj, const char* name, size_t len,
+		   const char* suffix);
+
+static void
+fD_Init(fdDef* obj, fdArena* arena)
+{
+   memset(obj, 0, sizeof(fdDef));
+   obj->arena=arena;
+   obj->name=fD_nostring;
+   obj->type=fD_nostring;
+   obj->private=0;
+}
+
+/******************************************************************************
+ * fD_Reserve
+ *
+ * makes room for num parameters and prototypes. The parser calls it with an
+ * estimate taken from the fd line before it adds any.
+ ******************************************************************************/
+
+static int
+fD_Reserve(fdDef* obj, shortcard num)
+{
+   char **args;
+   shortcard count;
+
+   if (num>REGS)
+      num=REGS;
+   if (num<=obj->maxargs)
+      return 0;
+
+   if (!(args=fA_Alloc(obj->arena, 2*num*sizeof(char*))))
+      return 1;
+   for (count=0; count<num; count++)
    {
-      illparams("fD_GetParam");
-      return fD_nostring;
+      args[count]=count<obj->maxargs ? obj->param[count] : fD_nostring;
+      args[num+count]=count<obj->maxargs ? obj->proto[count] : fD_nostring;
    }
+   obj->param=args;
+   obj->proto=args+num;
+   obj->maxargs=num;
+   return 0;
 }
 
-static INLINE const char*
-fD_GetRegStr(const fdDef* obj, shortcard at)
+/* the number of the bits set in mask before the first one that is not */
+
+static shortcard
+fD_CountSet(unsigned int mask)
 {
-   if (obj && at<illegal)
-      return RegStr(obj->reg[at]);
-   else
+   shortcard count;
+
+   for (count=0; mask & 1u<<count; count++);
+   return count;
+}
+
+/******************************************************************************
+ * fD_NewText
+ *
+ * copies len bytes of str to the definition's arena and returns the copy, or
+ * NULL. The parsers copy a whole line at a time and then cut it up in place,
+ * so that a definition needs one copy per line it came from rather than one
+ * per name, parameter and prototype. Strings replaced later stay around
+ * until the arena is reset. Running out of memory is reported to errfile.
+ ******************************************************************************/
+
+static char*
+fD_NewText(fdDef* obj, const char* str, size_t len, FILE* errfile)
+{
+   char *text=fA_Alloc(obj->arena, len+1);
+
+   if (!text)
    {
-      illparams("fD_GetReg");
-      return RegStr(illegal);
+      fprintf(errfile, "No mem for string\n");
+      return NULL;
    }
+   memcpy(text, str, len);
+   text[len]='\0';
+   return text;
 }
 
-static INLINE const char*
-fD_GetType(const fdDef* obj)
+/* newstr must be a text of obj; it is trimmed in place */
+
+void
+fD_NewParam(fdDef* obj, shortcard at, char* newstr)
 {
-   if (obj && obj->type)
-      return obj->type;
+   if (newstr && obj && at==obj->numparams && at<obj->maxargs)
+      obj->param[obj->numparams++]=TrimString(newstr);
    else
-   {
-      illparams("fD_GetType");
-      return fD_nostring;
-   }
+      illparams(NULL, "fD_NewParam");
 }
 
-/* get first free param or illegal */
+/* get first free *reg or illegal */
 
 static INLINE shortcard
-fD_ParamNum(const fdDef* obj)
+fD_RegNum(const fdDef* obj)
 {
-   shortcard count;
-
    if (obj)
-   {
-      for (count=d0; count<illegal && obj->param[count]!=fD_nostring;
-      count++);
-      return count;
-   }
+      return obj->numregs;
    else
    {
-      illparams("fD_ParamNum");
+      illparams(NULL, "fD_RegNum");
       return illegal;
    }
 }
 
-static INLINE shortcard
-fD_ProtoNum(const fdDef* obj)
-{
-   shortcard count;
+/* reg may be illegal to unset a register; later ones are kept */
 
-   if (obj)
+static INLINE void
+fD_NewReg(fdDef* obj, shortcard at, regs reg)
+{
+   if (obj && at<illegal && (int)reg>=(int)d0 && reg<=illegal)
    {
-      for (count=d0; count<illegal && obj->proto[count]!=fD_nostring;
-      count++);
-      return count;
+      if (reg==illegal)
+	 obj->regmask&=~(1u<<at);
+      else
+      {
+	 obj->reg[at/2]=at&1 ? (obj->reg[at/2]&0x0f) | reg<<4
+			     : (obj->reg[at/2]&0xf0) | reg;
+	 obj->regmask|=1u<<at;
+      }
+      obj->numregs=fD_CountSet(obj->regmask);
    }
+   else
+      illparams(NULL, "fD_NewReg");
+}
+
+static INLINE regs
+fD_GetReg(const fdDef* obj, shortcard at)
+{
+   if (obj && at<illegal)
+      return obj->regmask & 1u<<at ? (regs) (obj->reg[at/2]>>(at&1)*4 & 0x0f)
+				   : illegal;
    else
    {
-      illparams("fD_ProtoNum");
+      illparams(NULL, "fD_GetReg");
       return illegal;
    }
 }
 
+/* proto may be fD_nostring to unset a prototype */
+
+static INLINE void
+fD_SetProto(fdDef* obj, shortcard at, char* proto)
+{
+   if (obj && at<illegal && (at<obj->maxargs || proto==fD_nostring))
+   {
+      if (at>=obj->maxargs)
+	 return; /* never was set */
+      obj->proto[at]=proto;
+      if (proto==fD_nostring)
+	 obj->protomask&=~(1u<<at);
+      else
+	 obj->protomask|=1u<<at;
+      obj->numprotos=fD_CountSet(obj->protomask);
+   }
+   else
+      illparams(NULL, "fD_SetProto");
+}
+
 /******************************************************************************
- *    fD_parsefd
+ * the declarator parser of fD_NewProto
  *
- *  parse the current line. Needs to copy input, in order to insert \0's
- *  RETURN
- *    fF_GetError(infile):
- * false = read a definition.
- * nodef = not a definition on line (so try again)
- * error = real error
+ * reads an argument the way a compiler would: specifiers, which are a run of
+ * words, then a declarator made of '*'s, the name or '(' declarator ')', and
+ * any number of [...] and (...). Without the typedefs of the headers at
+ * hand, a word that's no keyword is the name if it's the last of its run and
+ * a type comes before it: "ULONG x" is a ULONG named x, "ULONG" and "struct
+ * Foo" have no name. Words starting with "__" are qualifiers, or attributes
+ * if (...) follows. The result is where the name is, or where it would go.
  ******************************************************************************/
 
-Error
-fD_parsefd(fdDef* obj, char** comment_ptr, fdFile* infile)
+typedef struct
 {
-   enum parse_info { name, params, regs, ready } parsing;
-   char *buf, *bpoint, *bnext;
-   unsigned long index;
+   const char* text;
+   size_t at;		   /* the next char to look at		  */
+   size_t name, nameend;   /* the name, or the empty place for it */
+   int	  placed;	   /* name and nameend are set		  */
+   int	  bad;		   /* text is no declaration		  */
+} fdDecl;
+
+static size_t
+DeclBlanks(fdDecl* obj)
+{
+   while (obj->text[obj->at]==' ' || obj->text[obj->at]=='\t')
+      obj->at++;
+   return obj->at;
+}
 
-   if (obj && infile && fF_GetError(infile)==false)
-   {
-      parsing=name;
+static size_t
+DeclWordEnd(const char* text, size_t at)
+{
+   if (isalpha((unsigned char) text[at]) || text[at]=='_')
+      while (isalnum((unsigned char) text[at]) || text[at]=='_')
+	 at++;
+   return at;
+}
+
+/* what text[at..end-1] is: "type", "qual", "tag", or NULL for no keyword */
+
+static const char*
+DeclKind(const char* text, size_t at, size_t end)
+{
+   if (end-at>2 && text[at]=='_' && text[at+1]=='_')
+      return "qual";
+   return fT_Lookup(&DeclKeywords, text+at, end-at);
+}
 
-      if (!NewString(&buf, infile->line))
+/* skips the (...) or [...] at obj->at */
+
+static void
+DeclSkip(fdDecl* obj)
+{
+   size_t depth=0;
+
+   do
+   {
+      switch (obj->text[obj->at++])
       {
-	 fprintf(stderr, "No mem for line %lu\n", infile->lineno);
-	 fF_SetError(infile, real_error);
+	 case '(': case '[':
+	    depth++;
+	    break;
+	 case ')': case ']':
+	    depth--;
+	    break;
+	 case '\0':
+	    obj->at--;
+	    obj->bad=1;
+	    return;
       }
-      bpoint=buf; /* so -Wall keeps quiet */
+   }
+   while (depth);
+}
 
-      /* try to parse the line until there's an error or we are done */
+static void
+DeclPlace(fdDecl* obj, size_t name, size_t nameend)
+{
+   if (obj->placed)
+      obj->bad=1;
+   obj->name=name;
+   obj->nameend=nameend;
+   obj->placed=1;
+}
 
-      while (parsing!=ready && fF_GetError(infile)==false)
+/* a run of words; typed says if a type came before it */
+
+static void
+DeclWords(fdDecl* obj, int typed)
+{
+   size_t at, end, last=0, lastend=0;
+
+   for (;;)
+   {
+      const char *kind;
+
+      at=DeclBlanks(obj);
+      if ((end=DeclWordEnd(obj->text, at))==at)
+	 break;
+      kind=DeclKind(obj->text, at, end);
+
+      obj->at=end;
+      if (!kind)
       {
-	 switch (parsing)
-	 {
+	 if (lastend)
+	    typed=1;	/* the word before this one was a type */
+	 last=at;
+	 lastend=end;
+	 continue;
+      }
+
+      /* a word before a keyword is the name, or the type if there's none */
+
+      if (lastend && typed)
+	 DeclPlace(obj, last, lastend);
+      else if (lastend)
+	 typed=1;
+      lastend=0;
+
+      if (!strcmp(kind, "tag"))
+      {
+	 obj->at=DeclWordEnd(obj->text, DeclBlanks(obj));
+	 typed=1;
+      }
+      else if (!strcmp(kind, "type"))
+	 typed=1;
+      else if (obj->text[at]=='_' && obj->text[DeclBlanks(obj)]=='(')
+	 DeclSkip(obj);
+   }
+
+   if (lastend && typed)
+      DeclPlace(obj, last, lastend);
+}
+
+static void
+DeclDeclarator(fdDecl* obj)
+{
+   while (!obj->bad)
+   {
+      size_t at=DeclBlanks(obj), next;
+
+      switch (obj->text[at])
+      {
+	 case '*':
+	    if (obj->placed)
+	       obj->bad=1;
+	    obj->at++;
+	    break;
+
+	 case '(':
+	    obj->at++;
+	    next=DeclBlanks(obj);
+	    if (!obj->placed &&
+		(obj->text[next]=='*' || obj->text[next]=='('))
+	    {
+	       DeclDeclarator(obj);
+	       if (obj->text[DeclBlanks(obj)]==')')
+		  obj->at++;
+	       else
+		  obj->bad=1;
+	       break;
+	    }
+	    obj->at=at;
+	    /* fall through */
+
+	 case '[':
+	    if (!obj->placed)
+	       DeclPlace(obj, at, at);
+	    DeclSkip(obj);
+	    break;
+
+	 default:
+	    if (DeclWordEnd(obj->text, at)>at)
+	       DeclWords(obj, 1);
+	    else
+	    {
+	       if (!obj->placed)
+		  DeclPlace(obj, at, at);
+	       return;
+	    }
+      }
+   }
+}
+
+/* 1 if text is a declaration; the name is at obj->name then */
+
+static int
+DeclParse(fdDecl* obj, const char* text)
+{
+   memset(obj, 0, sizeof(fdDecl));
+   obj->text=text;
+   DeclWords(obj, 0);
+   DeclDeclarator(obj);
+   return !obj->bad && obj->text[DeclBlanks(obj)]=='\0';
+}
+
+/******************************************************************************
+ * fD_NewProto
+ *
+ * newstr must be a text of obj. It is trimmed and the parameter name, if
+ * any, is cut off in place when it comes last. If anything follows the
+ * name, as in "char name[10]" or "void (*name)(int)", the name becomes %s
+ * in a new text, which fD_PrintArg() fills in. Returns 1 if the prototype
+ * could not be understood; problems are reported to errfile.
+ ******************************************************************************/
+
+int
+fD_NewProto(fdDef* obj, shortcard at, char* newstr, FILE* errfile)
+{
+   if (newstr && obj && at<illegal)
+   {
+      fdDecl decl;
+      char *pr=TrimString(newstr);
+
+      if (strcmp(pr, "...")==0)
+	 ;
+      else if (!DeclParse(&decl, pr))
+      {
+	 fD_SetProto(obj, at, fD_nostring);
+	 return 1;
+      }
+      else
+      {
+	 size_t start=decl.name, end=decl.nameend;
+
+	 while (start && (pr[start-1]==' ' || pr[start-1]=='\t'))
+	    start--;
+	 while (pr[end]==' ' || pr[end]=='\t')
+	    end++;
+
+	 if (pr[end]=='\0')
+	    pr[start]='\0';
+	 else
+	 {
+	    /* "char %s[10]", "void (*%s)(int)"; words keep a blank */
+
+	    int before=start && (isalnum((unsigned char) pr[start-1]) ||
+				 pr[start-1]=='_'),
+		after=isalnum((unsigned char) pr[end]) || pr[end]=='_';
+	    char *fpr=fA_Alloc(obj->arena,
+			       start+before+after+3+strlen(pr+end)), *t;
+
+	    if (!fpr)
+	    {
+	       fprintf(errfile, "No mem for string\n");
+	       fD_SetProto(obj, at, fD_nostring);
+	       return 0;
+	    }
+	    memcpy(fpr, pr, start);
+	    t=fpr+start;
+	    if (before)
+	       *t++=' ';
+	    *t++='%';
+	    *t++='s';
+	    if (after)
+	       *t++=' ';
+	    strcpy(t, pr+end);
+	    pr=fpr;
+	 }
+      }
+
+      fD_SetProto(obj, at, pr);
+      if (!strcasecmp(pr, "double"))
+      {
+	 /* "double" needs two data registers */
+	 int count, regs=fD_RegNum(obj);
+	 for (count=at+1; count<regs; count++)
+	    fD_NewReg(obj, count, fD_GetReg(obj, count+1));
+      }
+   }
+   else
+      illparams(errfile, "fD_NewProto");
+
+   return 0;
+}
+
+static INLINE void
+fD_SetOffset(fdDef* obj, long off)
+{
+   if (obj)
+      obj->offset=off;
+   else
+      illparams(NULL, "fD_SetOffset");
+}
+
+static INLINE void
+fD_SetBase(fdDef* obj, int base)
+{
+   if (obj)
+      obj->base=base;
+   else
+      illparams(NULL, "fD_SetPrivate");
+}
+
+static INLINE void
+fD_SetCFunction(fdDef* obj, int cfunc)
+{
+   if (obj)
+      obj->cfunction=cfunc;
+   else
+      illparams(NULL, "fD_SetPrivate");
+}
+
+static INLINE void
+fD_SetPrivate(fdDef* obj, int priv)
+{
+   if (obj)
+      obj->private=priv;
+   else
+      illparams(NULL, "fD_SetPrivate");
+}
+
+static INLINE const char*
+fD_GetName(const fdDef* obj)
+{
+   if (obj && obj->name)
+      return obj->name;
+   else
+   {
+      illparams(NULL, "fD_GetName");
+      return fD_nostring;
+   }
+}
+
+static INLINE long
+fD_GetOffset(const fdDef* obj)
+{
+   if (obj)
+      return obj->offset;
+   else
+   {
+      illparams(NULL, "fD_GetOffset");
+      return 0;
+   }
+}
+
+static INLINE int
+fD_GetPrivate(const fdDef* obj)
+{
+   if (obj)
+      return obj->private;
+   else
+   {
+      illparams(NULL, "fD_GetPrivate");
+      return 0;
+   }
+}
+
+static INLINE const char*
+fD_GetProto(const fdDef* obj, shortcard at)
+{
+   if (obj && at<illegal)
+      return at<obj->maxargs ? obj->proto[at] : fD_nostring;
+   else
+   {
+      illparams(NULL, "fD_GetProto");
+      return fD_nostring;
+   }
+}
+
+static INLINE const char*
+fD_GetParam(const fdDef* obj, shortcard at)
+{
+   if (obj && at<illegal)
+      return at<obj->numparams ? obj->param[at] : fD_nostring;
+   else
+   {
+      illparams(NULL, "fD_GetParam");
+      return fD_nostring;
+   }
+}
+
+static INLINE const char*
+fD_GetRegStr(const fdDef* obj, shortcard at)
+{
+   if (obj && at<illegal)
+      return RegStr(fD_GetReg(obj, at));
+   else
+   {
+      illparams(NULL, "fD_GetReg");
+      return RegStr(illegal);
+   }
+}
+
+static INLINE const char*
+fD_GetType(const fdDef* obj)
+{
+   if (obj && obj->type)
+      return obj->type;
+   else
+   {
+      illparams(NULL, "fD_GetType");
+      return fD_nostring;
+   }
+}
+
+/* get first free param or illegal */
+
+static INLINE shortcard
+fD_ParamNum(const fdDef* obj)
+{
+   if (obj)
+      return obj->numparams;
+   else
+   {
+      illparams(NULL, "fD_ParamNum");
+      return illegal;
+   }
+}
+
+static INLINE shortcard
+fD_ProtoNum(const fdDef* obj)
+{
+   if (obj)
+      return obj->numprotos;
+   else
+   {
+      illparams(NULL, "fD_ProtoNum");
+      return illegal;
+   }
+}
+
+/******************************************************************************
+ *    fD_parsefd
+ *
+ *  parse the current line. Only a definition is copied, to a text of obj, to
+ *  be cut into name and parameters in place.
+ *  RETURN
+ *    fF_GetError(infile):
+ * false = read a definition.
+ * nodef = not a definition on line (so try again)
+ * error = real error
+ ******************************************************************************/
+
+Error
+fD_parsefd(fdDef* obj, char** comment_ptr, fdFile* infile)
+{
+   enum parse_info { name, params, regs, ready } parsing;
+   const char *line;
+   char *buf, *bpoint, *bnext;
+   size_t len, index;
+
+   if (obj && infile && fF_GetError(infile)==false)
+   {
+      parsing=name;
+
+      len=infile->linelen;
+      line=TrimView(infile->line, &len);
+      buf=bpoint=NULL; /* so -Wall keeps quiet */
+
+      /* try to parse the line until there's an error or we are done */
+
+      while (parsing!=ready && fF_GetError(infile)==false)
+      {
+	 switch (parsing)
+	 {
 	    case name:
-	       switch (buf[0])
+	       switch (len ? line[0] : '\0')
 	       {
 		  case '#':
-		     if (strncmp("##base", buf, 6)==0)
+		     if (strncmp("##base", line, 6)==0)
 		     {
-			bnext=buf+6;
-			while (*bnext==' ' || *bnext=='\t' || *bnext=='_')
-			   bnext++;
-			strcpy(BaseName, bnext);
-			BaseName[strlen(BaseName)-1]='\0';
+			const char *base=line+6;
+
+			while (*base==' ' || *base=='\t' || *base=='_')
+			   base++;
+			/* without the line feed */
+			index=len-(base-line);
+			if (index)
+			   index--;
+			if (index>=sizeof infile->basename)
+			   index=sizeof infile->basename-1;
+			memcpy(infile->basename, base, index);
+			infile->basename[index]='\0';
 		     }
 		     else
-			if (strncmp("##bias", buf, 6)==0)
+			if (strncmp("##bias", line, 6)==0)
 			{
-			   if (!sscanf(buf+6, "%ld", &infile->offset))
+			   if (!sscanf(line+6, "%ld", &infile->offset))
 			   {
-			      fprintf(stderr, "Illegal ##bias in line %lu: %s\n",
-				 infile->lineno, infile->line);
+			      fprintf(infile->errfile,
+				 "Illegal ##bias in line %lu: %s\n",
+				 fF_LineNo(infile), infile->line);
 			      fF_SetError(infile, real_error);
 			      break; /* avoid nodef */
 			   }
@@ -1221,10 +2489,10 @@ fD_parsefd(fdDef* obj, char** comment_ptr, fdFile* infile)
 			}
 			else
 			{
-			   if (strncmp("##private", buf, 9)==0)
+			   if (strncmp("##private", line, 9)==0)
 			      fF_SetFlags(infile, fF_GetFlags(infile) |
 				 FD_PRIVATE);
-			   else if (strncmp("##public", buf, 8)==0)
+			   else if (strncmp("##public", line, 8)==0)
 			      fF_SetFlags(infile, fF_GetFlags(infile) &
 				 ~FD_PRIVATE);
 			}
@@ -1235,15 +2503,12 @@ fD_parsefd(fdDef* obj, char** comment_ptr, fdFile* infile)
 		  case '*':
 		  {
 		    size_t olen = *comment_ptr ? strlen(*comment_ptr) : 0;
-		    size_t clen = strlen(buf) + 1 + olen;
+		    size_t clen = len + 1 + olen;
 		    
 		    *comment_ptr = realloc(*comment_ptr, clen);
 
-		    if (olen ==0) {
-		      **comment_ptr = 0;
-		    }
-
-		    strcat(*comment_ptr, buf);
+		    memcpy(*comment_ptr + olen, line, len);
+		    (*comment_ptr)[olen + len] = 0;
 		    DBP(fprintf(stderr, "Comments: %s", *comment_ptr));
 
 		    /* try again somewhere else */
@@ -1256,20 +2521,43 @@ fD_parsefd(fdDef* obj, char** comment_ptr, fdFile* infile)
 		     fD_SetPrivate( obj,
 				    (fF_GetFlags(infile) & FD_PRIVATE) != 0);
 		     parsing=name; /* switch (parsing) */
-		     for (index=0; buf[index] && buf[index]!='('; index++);
+		     for (index=0; index<len && line[index]!='('; index++);
 
-		     if (!buf[index])
+		     if (index==len)
 		     {
 			/* oops, no fd ? */
-			fprintf(stderr, "Not an fd, line %lu: %s\n",
-			   infile->lineno, buf /* infile->line */);
+			fprintf(infile->errfile, "Not an fd, line %lu: %.*s\n",
+			   fF_LineNo(infile), (int) len, line);
 			fF_SetError(infile, nodef);
 		     } /* maybe next time */
+		     else if (!(buf=fD_NewText(obj, line, len,
+					       infile->errfile)))
+		     {
+			fprintf(infile->errfile, "No mem for line %lu\n",
+			   fF_LineNo(infile));
+			fF_SetError(infile, real_error);
+		     }
 		     else
 		     {
+			/* room for as many arguments as there are
+			   parameters or registers, whichever is more */
+			shortcard fields=1;
+
+			for (bnext=buf+index; *bnext && fields<REGS; bnext++)
+			   if (*bnext==',' || *bnext=='/')
+			      fields++;
+			if (fD_Reserve(obj, (obj->numparams>obj->numregs ?
+				       obj->numparams : obj->numregs)+fields))
+			{
+			   fprintf(infile->errfile, "No mem for line %lu\n",
+			      fF_LineNo(infile));
+			   fF_SetError(infile, real_error);
+			   break;
+			}
+
 			buf[index]=0;
 
-			fD_NewName(obj, buf);
+			obj->name=TrimString(buf);
 			fD_SetOffset(obj, fF_GetOffset(infile));
 
 			bpoint=buf+index+1;
@@ -1295,8 +2583,9 @@ fD_parsefd(fdDef* obj, char** comment_ptr, fdFile* infile)
 		  {
 		     if (bnext[1] != '(')
 		     {
-			fprintf(stderr, "Registers expected in line %lu: %s\n",
-			   infile->lineno, infile->line);
+			fprintf(infile->errfile,
+			   "Registers expected in line %lu: %s\n",
+			   fF_LineNo(infile), infile->line);
 			fF_SetError(infile, nodef);
 		     }
 		     else
@@ -1317,8 +2606,8 @@ fD_parsefd(fdDef* obj, char** comment_ptr, fdFile* infile)
 	       else
 	       {
 		  fF_SetError(infile, nodef);
-		  fprintf(stderr, "Param expected in line %lu: %s\n",
-		     infile->lineno, infile->line);
+		  fprintf(infile->errfile, "Param expected in line %lu: %s\n",
+		     fF_LineNo(infile), infile->line);
 	       }
 	       break;  /* switch parsing */
 	    }
@@ -1359,8 +2648,9 @@ fD_parsefd(fdDef* obj, char** comment_ptr, fdFile* infile)
 		        else
 			{
 			   /* it is when our function is void */
-			   fprintf(stderr, "Illegal register %s in line %ld\n",
-				   bpoint, infile->lineno);
+			   fprintf(infile->errfile,
+				   "Illegal register %s in line %ld\n",
+				   bpoint, fF_LineNo(infile));
 			   fF_SetError(infile, nodef);
 			}
 		     }
@@ -1369,225 +2659,153 @@ fD_parsefd(fdDef* obj, char** comment_ptr, fdFile* infile)
 	       else
 	       {
 		  fF_SetError(infile, nodef);
-		  fprintf(stderr, "Reg expected in line %lu\n",
-		     infile->lineno);
+		  fprintf(infile->errfile, "Reg expected in line %lu\n",
+		     fF_LineNo(infile));
 	       }
 	       break; /* switch parsing */
 
 	    case ready:
-	       fprintf(stderr, "Internal error, use another compiler.\n");
+	       fprintf(infile->errfile,
+		  "Internal error, use another compiler.\n");
 	       break;
 	 }
       }
 
-      free(buf);
       return fF_GetError(infile);
    }
    else
    {
-      illparams("fD_parsefd");
+      illparams(infile ? infile->errfile : NULL, "fD_parsefd");
       return real_error;
    }
 }
 
+/******************************************************************************
+ *    fD_parsepr
+ *
+ * takes the return type and the argument types from the prototype fF_Proto()
+ * found in infile's line. The arguments are the ones after the first '(' of
+ * the line. That is normally the one after the name; if it isn't, the type
+ * ends where the name last appears before it, or the line is no use.
+ ******************************************************************************/
 
 Error
 fD_parsepr(fdDef* obj, fdFile* infile)
 {
-   char	 *buf;	  /* a copy of infile->line		       */
-   char	 *bpoint, /* cursor in buf			       */
-	 *bnext,  /* looking for the end		       */
-	 *lowarg; /* beginning of this argument		       */
-   long	 obraces; /* count of open braces		       */
-   regs	 count,	  /* count parameter number		       */
-	 args;	  /* the number of arguments for this function */
+   const fdProto *proto;
+   char	 *buf;	  /* a copy of the line from proto->start, owned by obj */
+   size_t name,	  /* where the name is				*/
+	  typeend,
+	  lowarg, /* beginning of this argument			*/
+	  arg;	  /* the proto->args entry ending it		*/
+   regs	 count,	  /* count parameter number			*/
+	 args;	  /* the number of arguments for this function	*/
 
    if (!(obj && infile && fF_GetError(infile)==false))
    {
-      illparams("fD_parsepr");
+      illparams(infile ? infile->errfile : NULL, "fD_parsepr");
       fF_SetError(infile, real_error);
       return real_error;
    }
-   if (!NewString(&buf, SkipWSAndComments(infile->line))) //lcs
+   proto=&infile->proto;
+   if (!(buf=fD_NewText(obj, infile->line+proto->start,
+			infile->linelen-proto->start, infile->errfile)))
    {
-      fprintf(stderr, "No mem for fD_parsepr\n");
+      fprintf(infile->errfile, "No mem for fD_parsepr\n");
       fF_SetError(infile, real_error);
       return real_error;
    }
    fF_SetError(infile, false);
-   bpoint=strchr(buf, '(');
-   while (--bpoint>=buf && strstr(bpoint, fD_GetName(obj))!=bpoint);
-   if (bpoint>=buf)
-   {
-      while (--bpoint >= buf && (*bpoint==' ' || *bpoint=='\t'));
-      *++bpoint='\0';
 
-      fD_NewType(obj, buf);
+   name=proto->name;
+   if (proto->open!=proto->firstopen)
+      for (name=proto->firstopen; name>proto->start &&
+	   strncmp(infile->line+name-1, infile->line+proto->name,
+		   proto->namelen); name--);
 
-      while (bpoint && *bpoint++!='('); /* one beyond '(' */
+   if (name>proto->start || proto->open==proto->firstopen)
+   {
+      if (proto->open!=proto->firstopen)
+	 name--;
+      typeend=name-proto->start;
+      while (typeend && (buf[typeend-1]==' ' || buf[typeend-1]=='\t'))
+	 typeend--;
+      buf[typeend]='\0';
+      obj->type=buf;
 
-      lowarg=bpoint;
-      obraces=0;
+      lowarg=proto->firstopen+1-proto->start;
 
-      for (count=0, args=fD_ParamNum(obj); count<args; bpoint=bnext+1)
+      for (count=0, arg=0, args=fD_ParamNum(obj); count<args; arg++)
       {
-	 while (*bpoint && (*bpoint==' ' || *bpoint=='\t')) /* ignore spaces */
-	    bpoint++;
+	 size_t end;
 
-	 bnext=strpbrk(bpoint, "(),");
-
-	 if (bnext)
+	 if (arg==proto->numargs)
 	 {
-	    switch (*bnext)
-	    {
-	       case '(':
-		  if (!obraces)
-		  {
-		     fD_SetFuncParNum(obj, count);
-		  }
-		  obraces++;
-		  DBP(fprintf(stderr, "< (%ld%s >", obraces, bnext));
-		  break;
-
-	       case ')':
-		  if (obraces)
-		  {
-		     DBP(fprintf(stderr, "< )%ld%s >", obraces, bnext));
-		     obraces--;
-		  }
-		  else
-		  {
-		     *bnext='\0';
-		     DBP(fprintf(stderr, "< )0> [LAST PROTO=%s]", lowarg));
-		     if (fD_NewProto(obj, count, lowarg))
-			fprintf(stderr, "Parser confused in line %ld\n",
-			      infile->lineno);
-		     lowarg=bnext+1;
-
-		     if (count!=args-1)
-		     {
-			DBP(fprintf(stderr, "%s needs %u arguments and got %u.\n",
-			   fD_GetName(obj), args, count+1));
-			fF_SetError(infile, nodef);
-		     }
-		     count++;
-		  }
-		  break;
+	    DBP(fprintf(stderr, "Faulty argument %u in line %lu.\n", count+1,
+	       fF_LineNo(infile)));
+	    fF_SetError(infile, nodef);
+	    break;
+	 }
 
-	       case ',':
-		  if (!obraces)
-		  {
-		     *bnext='\0';
-		     DBP(fprintf(stderr, " [PROTO=%s] ", lowarg));
-		     if (fD_NewProto(obj, count, lowarg))
-			fprintf(stderr, "Parser confused in line %ld\n",
-			      infile->lineno);
-		     lowarg=bnext+1;
-		     count++;
-		  }
-		  break;
+	 end=proto->args[arg];
+	 buf[end-proto->start]='\0';
+	 DBP(fprintf(stderr, " [PROTO=%s] ", buf+lowarg));
+	 if (fD_NewProto(obj, count, buf+lowarg, infile->errfile))
+	    fprintf(infile->errfile, "Parser confused in line %ld\n",
+		  fF_LineNo(infile));
+	 lowarg=end+1-proto->start;
 
-	       default:
-		  fprintf(stderr, "Faulty strpbrk in line %lu.\n",
-		     infile->lineno);
-	    }
-	 }
-	 else
+	 if (infile->line[end]==')' && count!=args-1)
 	 {
-	    DBP(fprintf(stderr, "Faulty argument %u in line %lu.\n", count+1,
-	       infile->lineno));
-	    count=args; /* this will effectively quit the for loop */
+	    DBP(fprintf(stderr, "%s needs %u arguments and got %u.\n",
+	       fD_GetName(obj), args, count+1));
 	    fF_SetError(infile, nodef);
 	 }
+	 count++;
       }
       if (fD_ProtoNum(obj)!=fD_ParamNum(obj))
 	 fF_SetError(infile, nodef);
    }
    else
    {
-      fprintf(stderr, "fD_parsepr was fooled in line %lu\n", infile->lineno);
-      fprintf(stderr, "function , definition %s.\n",
+      fprintf(infile->errfile, "fD_parsepr was fooled in line %lu\n",
+	 fF_LineNo(infile));
+      fprintf(infile->errfile, "function , definition %s.\n",
 	 /* fD_GetName(obj),*/ infile->line);
       fF_SetError(infile, nodef);
    }
 
-   free(buf);
-
    return fF_GetError(infile);
 }
 
-int
-fD_cmpName(const void* big, const void* small) /* for qsort and bsearch */
-{
-   return strcmp(fD_GetName(*(fdDef**)big), fD_GetName(*(fdDef**)small));
-}
-
-static const char *TagExcTable[]=
-{
-   "BuildEasyRequestArgs", "BuildEasyRequest",
-   "DoDTMethodA",	   "DoDTMethod",
-   "DoGadgetMethodA",	   "DoGadgetMethod",
-   "EasyRequestArgs",	   "EasyRequest",
-   "MUI_MakeObjectA",	   "MUI_MakeObject",
-   "MUI_RequestA",	   "MUI_Request",
-   "PrintDTObjectA",	   "PrintDTObject",
-   "RefreshDTObjectA",     "RefreshDTObjects",
-   "UMSVLog",		   "UMSLog",
-   "VFWritef",		   "FWritef",
-   "VFPrintf",		   "FPrintf",
-   "VPrintf",		   "Printf",
-};
-
 const char*
 getvarargsfunction(const fdDef * obj)
 {
-   unsigned int count;
    const char *name = fD_GetName(obj);
-    
-   for (count=0; count<sizeof TagExcTable/sizeof TagExcTable[0]; count+=2)
-   {
-      if (strcmp(name, TagExcTable[count])==0)
-      {
-	 return TagExcTable[count+1];
-      }
-   }
-   return(NULL);
+
+   return fT_Lookup(&TagExcTable, name, strlen(name));
 }
 
+/* newname must hold strlen(name)+5 chars and receives the name of the tag
+   function */
+
 const char*
-taggedfunction(const fdDef* obj)
+taggedfunction(const fdDef* obj, char* newname)
 {
    shortcard numargs=fD_ParamNum(obj);
-   unsigned int count;
    int aos_tagitem;
    const char *name=fD_GetName(obj);
-   static char newname[200];  /* Hope will be enough... static because used
-				 out of the function. */
    const char *lastarg;
-   static const char *TagExcTable2[]=
-   {
-      "ApplyTagChanges",
-      "CloneTagItems",
-      "FindTagItem",
-      "FreeTagItems",
-      "GetTagData",
-      "PackBoolTags",
-      "PackStructureTags",
-      "RefreshTagItemClones",
-      "UnpackStructureTags",
-   };
 
    if (!numargs)
       return NULL;
 
-   for (count=0; count<sizeof TagExcTable/sizeof TagExcTable[0]; count+=2)
-      if (strcmp(name, TagExcTable[count])==0)
-	 return NULL;
-// lcs	 return TagExcTable[count+1];
+   if (fT_Lookup(&TagExcTable, name, strlen(name)))
+      return NULL;
+// lcs	 return getvarargsfunction(obj);
 
-   for (count=0; count<sizeof TagExcTable2/sizeof TagExcTable2[0]; count++)
-      if (strcmp(name, TagExcTable2[count])==0)
-	 return NULL;
+   if (fT_Lookup(&TagExcTable2, name, strlen(name)))
+      return NULL;
 
    lastarg=fD_GetProto(obj, numargs-1);
    if (strncmp(lastarg, "const", 5)==0 || strncmp(lastarg, "CONST", 5)==0)
@@ -1619,801 +2837,2202 @@ taggedfunction(const fdDef* obj)
    return newname;
 }
 
-const char*
-aliasfunction(const char* name)
+const char*
+aliasfunction(const char* name)
+{
+   size_t len=strlen(name);
+   const char *alias=fT_Lookup(&AliasTable, name, len);
+
+   return alias ? alias : fT_Lookup(&AliasInverse, name, len);
+}
+
+static INLINE void
+fD_PrintRegs(fdOut* out, const fdDef* obj)
+{
+   int count;
+   int numregs=fD_RegNum(obj);
+
+   if (obj->cfunction)
+   {
+      if (obj->base)
+      {
+	 fO_Lit(out, "base,");
+      }
+      fO_Lit(out, "sysv");
+   }
+   if (numregs>0)
+   {
+      for (count=d0; count<numregs-1; count++)
+      {
+	 fO_Puts(out, fD_GetRegStr(obj, count));
+	 fO_Lit(out, ",");
+      }
+      fO_Puts(out, fD_GetRegStr(obj, count));
+   }
+}
+
+/* writes argument at as "proto param", or the proto with its %s replaced by
+   param where the name goes inside it, as for arrays and function pointers */
+
+static void
+fD_PrintArg(fdOut* out, const fdDef* obj, shortcard at)
+{
+   const char *proto=fD_GetProto(obj, at), *param=fD_GetParam(obj, at);
+   const char *pct;
+
+   if (!(pct=strchr(proto, '%')))
+   {
+      fO_Puts(out, proto);
+      fO_Lit(out, " ");
+      fO_Puts(out, param);
+      return;
+   }
+
+   do
+   {
+      fO_Write(out, proto, pct-proto);
+      if (pct[1]=='s')
+	 fO_Puts(out, param);
+      else if (pct[1]=='%')
+	 fO_Lit(out, "%");
+      proto=pct[1] ? pct+2 : pct+1;
+   }
+   while ((pct=strchr(proto, '%')));
+   fO_Puts(out, proto);
+}
+
+void
+fD_write(fdConverter* conv, fdOut* out, const fdDef* obj,int alias)
+{
+   shortcard count, numargs;
+   const char *tagname, *varname, *name, *rettype;
+   char *newname;
+   int vd=0, a45=0, d7=0;
+
+   DBP(fprintf(stderr, "func %s\n", fD_GetName(obj)));
+
+   numargs=fD_RegNum(obj);
+
+   if (!numargs)
+     numargs=fD_ParamNum(obj);
+   else if (fD_ParamNum(obj) != numargs && !conv->quiet)
+     fprintf(conv->errfile, "Warning: %s gets %d params and %d regs!\n",
+	     fD_GetName(obj), fD_ParamNum(obj), numargs);
+     
+
+   if ((rettype=fD_GetType(obj))==fD_nostring)
+   {
+      if (!conv->quiet && !fD_GetPrivate(obj))
+	 fprintf(conv->errfile, "Warning: %s has no prototype.\n",
+		 fD_GetName(obj));
+      rettype = "ULONG";
+   }
+   if (!strcasecmp(rettype, "void"))
+      vd = 1; /* set flag */
+   for (count=d0; count<numargs; count++)
+   {
+      const char *reg=fD_GetRegStr(obj, count);
+      if (strcmp(reg, "a4")==0 || strcmp(reg, "a5")==0)
+      {
+	 if (!a45)
+	    a45=(strcmp(reg, "a4") ? 5 : 4); /* set flag */
+	 else /* Security check */
+	    if (!conv->quiet)
+	       fprintf(conv->errfile, "Warning: both a4 and a5 are used. "
+		       "This is not supported!\n");
+      }
+      if (strcmp(reg, "d7")==0) /* Used only when a45!=0 */
+	 d7=1;
+   }
+   
+   if (a45 && d7) /* Security check */
+      if (!conv->quiet)
+	 fprintf(conv->errfile, "Warning: d7 and a4 or a5 are used. This is not "
+		 "supported!\n");
+
+   name=fD_GetName(obj);
+
+   if (fD_ProtoNum(obj)!=numargs)
+   {
+      if (!conv->quiet)
+	 fprintf(conv->errfile, "%s gets %d fd args and %d proto%s.\n", name, numargs,
+		 fD_ProtoNum(obj), fD_ProtoNum(obj)!= 1 ? "s" : "");
+      for (count=d0; count<numargs; count++)
+      {
+	 if (fD_GetReg(obj, count) != illegal &&
+	     fD_GetProto(obj, count) == fD_nostring)
+	 {
+	    fD_SetProto((fdDef*)obj, count, fD_ulong);
+	 }
+      }
+
+//      return;
+   }
+
+   if (conv->bias != fD_GetOffset(obj))
+   {
+      conv->bias = fD_GetOffset(obj);
+      fO_Lit(out, "==bias ");
+      fO_PutNum(out, -conv->bias);
+      fO_Lit(out, "\n");
+   }
+
+   if (conv->priv != fD_GetPrivate(obj))
+   {
+      conv->priv = fD_GetPrivate(obj);
+      fO_Puts(out, conv->priv ? "==private\n" : "==public\n");
+   }
+   
+   fO_Puts(out, rettype);
+   fO_Lit(out, " ");
+   fO_Puts(out, name);
+   fO_Lit(out, "(");
+   
+   if (numargs>0)
+   {
+      for (count=d0; count<numargs; count++)
+      {
+	 // Workaround varargs in FD file (sysv)
+	 if (strcmp(fD_GetParam(obj, count), "...")==0)
+	    fO_Lit(out, "...");
+	 else
+	    fD_PrintArg(out, obj, count);
+	 
+	 if (count<numargs-1)
+	    fO_Lit(out, ", ");
+      }
+   }
+
+   fO_Lit(out, ") (");
+
+   fD_PrintRegs(out, obj);
+
+   fO_Lit(out, ")\n");
+
+   if (alias)
+   {
+      return;
+   }
+   
+   if ((tagname=aliasfunction(fD_GetName(obj)))!=0)
+   {
+      fdDef *objnc=(fdDef*)obj;
+      objnc->name=(char*)tagname;
+
+      fO_Lit(out, "==alias\n");
+      fD_write(conv, out, objnc, 1);
+
+      objnc->name=(char*)name;
+   }
+
+   /* The buffer is kept, so writing again doesn't take more memory */
+
+   if (strlen(name)+5>conv->tagbufsize)
+   {
+      if ((newname=realloc(conv->tagbuf, strlen(name)+5)))
+      {
+	 conv->tagbuf=newname;
+	 conv->tagbufsize=strlen(name)+5;
+      }
+   }
+   if (strlen(name)+5<=conv->tagbufsize &&
+       (tagname=taggedfunction(obj, conv->tagbuf))!=0)
+   {
+      fO_Lit(out, "==varargs\n");
+
+      fO_Puts(out, rettype);
+      fO_Lit(out, " ");
+      fO_Puts(out, tagname);
+      fO_Lit(out, "(");
+   
+      if (numargs>0)
+      {
+	 for (count=d0; count<numargs; count++)
+	 {
+	    if (count<numargs-1)
+	    {
+	       fD_PrintArg(out, obj, count);
+	       fO_Lit(out, ", ");
+	    }
+	    else
+	    {
+	       fO_Lit(out, "Tag ");
+	       fO_Puts(out, fD_GetParam(obj, count));
+	       fO_Lit(out, ", ...");
+	    }
+	 }
+      }
+
+      fO_Lit(out, ") (");
+
+      fD_PrintRegs(out, obj);
+
+      fO_Lit(out, ")\n");
+   }
+
+   if ((varname = getvarargsfunction(obj)) != 0)
+   {
+      fO_Lit(out, "==varargs\n");
+
+      fO_Puts(out, rettype);
+      fO_Lit(out, " ");
+      fO_Puts(out, varname);
+      fO_Lit(out, "(");
+   
+      if (numargs>0)
+      {
+	 for (count=d0; count<numargs; count++)
+	 {
+	    if (count<numargs-1)
+	    {
+	       fD_PrintArg(out, obj, count);
+	       fO_Lit(out, ", ");
+	    }
+	    else
+	       fO_Lit(out, "...");
+	 }
+      }
+
+      fO_Lit(out, ") (");
+
+      fD_PrintRegs(out, obj);
+
+      fO_Lit(out, ")\n");
+   }
+
+   if (strcmp(name, "DoPkt")==0)
+   {
+      fdDef *objnc=(fdDef*)obj;
+      char newname[7]="DoPkt0";
+      objnc->name=newname;
+      for (count=2; count<7; count++)
+      {
+	 regs reg=fD_GetReg(objnc, count);
+	 char *proto=(char*) fD_GetProto(objnc, count);
+	 fD_NewReg(objnc, count, illegal);
+	 fD_SetProto(objnc, count, fD_nostring);
+	 fO_Lit(out, "==alias\n");
+	 fD_write(conv, out, objnc, 1);
+	 fD_NewReg(objnc, count, reg);
+	 fD_SetProto(objnc, count, proto);
+	 newname[5]++;
+      }
+      objnc->name=(char*)name;
+   }
+
+   conv->bias -= FUNCTION_GAP;
+}
+
+/* the prototype ends in "...);" */
+
+static int
+isvarargs(const char* proto)
+{
+   const char *end=proto+strlen(proto)-1;
+   while (isspace(*end))
+      end--;
+   if (*end--==';')
+   {
+      while (isspace(*end))
+	 end--;
+      if (*end--==')')
+      {
+	 while (isspace(*end))
+	    end--;
+	 return !strncmp(end-2, "...", 3);
+      }
+   }
+   return 0;
+}
+
+int
+varargsfunction(fdConverter* conv, const char* proto, const char* funcname)
+{
+   if (isvarargs(proto))
+   {
+      /* Seems to be a varargs function. Check if it will be recognized
+	 as "tagged". */
+      size_t len=strlen(funcname);
+
+      if (fT_Lookup(&TagExcNames, funcname, len))
+	 return 1;
+
+      if (len>4 && !strcmp(funcname+len-4, "Tags"))
+      {
+	 /* Might be either nothing or "TagList". */
+	 if (fC_FindDef(conv, funcname, len-4, "") ||
+	     fC_FindDef(conv, funcname, len-4, "TagList"))
+	    return 1;
+      }
+      else
+      {
+	 if (fC_FindDef(conv, funcname, len, "A"))
+	    return 1;
+      }
+   }
+   return 0;
+}
+
+/* the names of functions that are written along with others */
+
+static int
+specialfunction(const char* funcname)
+{
+   /* It might be a dos.library "alias" name. */
+   if (aliasfunction(funcname))
+      return 1;
+
+   /* It might be one from dos.library/DoPkt() family. */
+   if (strlen(funcname)==6 && !strncmp(funcname, "DoPkt", 5) &&
+   funcname[5]>='0' && funcname[6]<='4')
+      return 1;
+
+   /* Finally, it can be intuition.library/ReportMouse1(). */
+   return !strcmp(funcname, "ReportMouse1");
+}
+
+int
+ishandleddifferently(fdConverter* conv, const char* proto,
+		     const char* funcname)
+{
+   /* First check if this is a vararg call? */
+   return varargsfunction(conv, proto, funcname) ||
+	  specialfunction(funcname);
+}
+
+/******************************************************************************
+ *    fdConverter methods
+ ******************************************************************************/
+
+static char*
+fC_CopyName(const char* name)
+{
+   char *result=malloc(strlen(name)+1);
+
+   if (result)
+      strcpy(result, name);
+   return result;
+}
+
+/******************************************************************************
+ * fC_Index, fC_FindDef
+ *
+ * The definitions are hashed by name into an open-addressing table twice
+ * as big as needed, built once the fd file has been read. fC_FindDef looks
+ * up the name made of the first len chars of name followed by suffix, so
+ * callers can look up a piece of a line, or a name with something added to
+ * it, without making a copy first. Of several definitions with the same
+ * name, the first one in the fd file is found.
+ ******************************************************************************/
+
+static unsigned long
+fC_Hash(unsigned long hash, const char* str, size_t len)
+{
+   while (len--)
+      hash=(hash ^ (unsigned char) *str++)*16777619UL;
+   return hash;
+}
+
+static int
+fC_Index(fdConverter* obj)
+{
+   unsigned long size, mask, slot;
+   long count;
+
+   for (size=16; size<2*(unsigned long) obj->fds; size*=2);
+
+   if (size>obj->indexsize)
+   {
+      fdDef **index=realloc(obj->index, size*sizeof(fdDef*));
+
+      if (!index)
+      {
+	 fprintf(obj->errfile, "No mem for FDs\n");
+	 return 1;
+      }
+      obj->index=index;
+      obj->indexsize=size;
+   }
+   memset(obj->index, 0, obj->indexsize*sizeof(fdDef*));
+   mask=obj->indexsize-1;
+
+   for (count=0; count<obj->fds; count++)
+   {
+      const char *name=fD_GetName(obj->defs[count]);
+      int dup=0;
+
+      for (slot=fC_Hash(2166136261UL, name, strlen(name)) & mask;
+	   obj->index[slot]; slot=(slot+1) & mask)
+	 if (strcmp(fD_GetName(obj->index[slot]), name)==0)
+	 {
+	    dup=1;
+	    break;
+	 }
+      if (!dup)
+	 obj->index[slot]=obj->defs[count];
+   }
+   return 0;
+}
+
+static fdDef*
+fC_FindDef(const fdConverter* obj, const char* name, size_t len,
+	   const char* suffix)
+{
+   size_t suffixlen=strlen(suffix);
+   unsigned long mask=obj->indexsize-1, slot;
+
+   if (!obj->fds)
+      return NULL;
+
+   for (slot=fC_Hash(fC_Hash(2166136261UL, name, len), suffix, suffixlen)
+	& mask; obj->index[slot]; slot=(slot+1) & mask)
+   {
+      const char *defname=fD_GetName(obj->index[slot]);
+
+      if (strncmp(defname, name, len)==0 &&
+	  strcmp(defname+len, suffix)==0)
+	 return obj->index[slot];
+   }
+   return NULL;
+}
+
+fdConverter*
+fC_ctor(void)
+{
+   fdConverter *result;
+
+   result=calloc(1,sizeof(fdConverter));
+
+   if (result)
+   {
+      result->errfile=stderr;
+      result->scan=fS_Get();
+      fC_Reset(result);
+   }
+   else
+      fprintf(stderr, "No mem for FDs\n");
+   return result;
+}
+
+void
+fC_dtor(fdConverter* obj)
+{
+   if (obj)
+   {
+      fC_Reset(obj);
+      if (obj->arena.chunks)
+	 free(obj->arena.chunks);
+      free(obj->defs);
+      free(obj->index);
+      free(obj->header);
+      free(obj->outbuf);
+      free(obj->tagbuf);
+      free(obj->arrcmts);
+      free(obj->spans);
+      free(obj->spanindex);
+      free(obj->pool);
+      if (obj->defined)
+	 fM_dtor(obj->defined);
+      free(obj->groups);
+      free(obj->directive);
+      free(obj);
+   }
+   else
+      illparams(NULL, "fC_dtor");
+}
+
+/* free all definitions of the last pair, but keep the tables */
+
+void
+fC_Reset(fdConverter* obj)
+{
+   long count;
+
+   if (!obj)
+   {
+      illparams(NULL, "fC_Reset");
+      return;
+   }
+
+   for (count=0; count<obj->fds; count++)
+   {
+      free(obj->arrcmts[count]); /* not every definition has a comment */
+      obj->arrcmts[count]=NULL;
+      obj->defs[count]=NULL;
+   }
+   fA_Reset(&obj->arena);
+
+   if (obj->fdfile)	  /* a stream that was opened but not written */
+      fF_dtor(obj->fdfile);
+   if (obj->clibfile)
+      fF_dtor(obj->clibfile);
+   obj->fdfile=obj->clibfile=NULL;
+   obj->numspans=0;
+   obj->poollen=0;
+   if (obj->defined)
+      fM_Clear(obj->defined);
+   obj->numgroups=0;
+   obj->continued=obj->incomment=0;
+
+   free(obj->fdfilename);
+   free(obj->clibfilename);
+   obj->fdfilename=obj->clibfilename=NULL;
+
+   obj->BaseName[0]=obj->BaseNamU[0]=obj->BaseNamL[0]=obj->BaseNamC[0]='\0';
+   obj->StdLib=NULL;
+   obj->type="library";
+   obj->fds=0;
+   obj->headerlen=0;
+   obj->got_exec_types=obj->got_utility_tagitem=0;
+   obj->bias=-1;
+   obj->priv=-1;
+}
+
+void
+fC_SetQuiet(fdConverter* obj, int quiet)
+{
+   if (obj)
+      obj->quiet=quiet;
+   else
+      illparams(NULL, "fC_SetQuiet");
+}
+
+void
+fC_SetFilter(fdConverter* obj, const fdFilter* filter)
+{
+   if (obj)
+      obj->filter=filter;
+   else
+      illparams(NULL, "fC_SetFilter");
+}
+
+void
+fC_SetMacros(fdConverter* obj, const fdMacros* macros)
+{
+   if (obj)
+      obj->macros=macros;
+   else
+      illparams(NULL, "fC_SetMacros");
+}
+
+void
+fC_SetErrorFile(fdConverter* obj, FILE* errfile)
+{
+   if (obj && errfile)
+      obj->errfile=errfile;
+   else
+      illparams(obj ? obj->errfile : NULL, "fC_SetErrorFile");
+}
+
+void
+fC_SetTiming(fdConverter* obj, int timing)
+{
+   if (obj)
+      obj->timing=timing;
+   else
+      illparams(NULL, "fC_SetTiming");
+}
+
+void
+fC_GetStats(const fdConverter* obj, fdStats* stats)
+{
+   if (obj && stats)
+      *stats=obj->stats;
+   else
+      illparams(obj ? obj->errfile : NULL, "fC_GetStats");
+}
+
+/* the wall clock and the CPU time of this thread, in seconds */
+
+static void
+fC_Clock(double* now)
+{
+#if defined(CLOCK_MONOTONIC) || defined(CLOCK_THREAD_CPUTIME_ID)
+   struct timespec ts;
+#endif
+
+#ifdef CLOCK_MONOTONIC
+   if (clock_gettime(CLOCK_MONOTONIC, &ts)==0)
+      now[0]=ts.tv_sec+ts.tv_nsec/1e9;
+   else
+#endif
+   {
+      struct timeval tv;
+
+      gettimeofday(&tv, NULL);
+      now[0]=tv.tv_sec+tv.tv_usec/1e6;
+   }
+
+#ifdef CLOCK_THREAD_CPUTIME_ID
+   if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts)==0)
+      now[1]=ts.tv_sec+ts.tv_nsec/1e9;
+   else
+#endif
+      now[1]=clock()/(double) CLOCKS_PER_SEC;
+}
+
+/* a phase starts and stops at start[0..1]; both do nothing without
+   fC_SetTiming() */
+
+static void
+fC_Start(const fdConverter* obj, double* start)
+{
+   if (obj->timing)
+      fC_Clock(start);
+}
+
+static void
+fC_Stop(fdConverter* obj, int phase, double* start)
+{
+   double now[2];
+
+   if (obj->timing)
+   {
+      fC_Clock(now);
+      obj->stats.wall[phase]+=now[0]-start[0];
+      obj->stats.cpu[phase]+=now[1]-start[1];
+      start[0]=now[0];
+      start[1]=now[1];
+   }
+}
+
+/* adds what file read to the fd or clib counts */
+
+static void
+fC_Count(fdConverter* obj, const fdFile* file, int clib)
+{
+   if (clib)
+   {
+      obj->stats.cliblines+=file->lines;
+      obj->stats.clibbytes+=file->bytes;
+   }
+   else
+   {
+      obj->stats.fdlines+=file->lines;
+      obj->stats.fdbytes+=file->bytes;
+   }
+}
+
+/******************************************************************************
+ *    fC_ReadFD
+ *
+ * reads all definitions from the fd file and works out the names the SFD
+ * header needs.
+ ******************************************************************************/
+
+/* make room for num definitions; returns 0 on success */
+
+static int
+fC_Grow(fdConverter* obj, long num)
+{
+   fdDef **defs;
+   char **arrcmts;
+
+   if (num<FDS)
+      num=FDS;
+   if (num<=obj->maxfds)
+      return 0;
+
+   defs=realloc(obj->defs, num*sizeof(fdDef*));
+   if (defs)
+      obj->defs=defs;
+   arrcmts=realloc(obj->arrcmts, num*sizeof(char*));
+   if (arrcmts)
+      obj->arrcmts=arrcmts;
+
+   if (!defs || !arrcmts)
+   {
+      fprintf(obj->errfile, "No mem for FDs\n");
+      return 1;
+   }
+   obj->maxfds=num;
+   return 0;
+}
+
+/* works out the names and the type the SFD header needs from the fd file's
+   name and its ##base */
+
+static void
+fC_Names(fdConverter* obj, const char* basename)
+{
+   const char *fdfilename=obj->fdfilename;
+
+   strcpy(obj->BaseName, basename);
+
+   if (obj->BaseName[0])
+   {
+      obj->StdLib=fT_Lookup(&LibExcTable, obj->BaseName,
+	 strlen(obj->BaseName));
+      if (!obj->StdLib)
+	 obj->StdLib="Library";
+   }
+
+   if (strlen(fdfilename)>7 &&
+   !strcmp(fdfilename+strlen(fdfilename)-7, "_lib.fd"))
+   {
+      const char *str=fdfilename+strlen(fdfilename)-8;
+      size_t len;
+
+      while (str!=fdfilename && str[-1]!='/' && str[-1]!=':')
+	 str--;
+      /* cut off like ##base, however long the file name is */
+      len=strlen(str)-7;
+      if (len>=sizeof obj->BaseNamU)
+	 len=sizeof obj->BaseNamU-1;
+      memcpy(obj->BaseNamU, str, len);
+      obj->BaseNamU[len]='\0';
+      strcpy(obj->BaseNamL, obj->BaseNamU);
+      strcpy(obj->BaseNamC, obj->BaseNamU);
+   }
+   else
+   {
+      strcpy(obj->BaseNamU, obj->BaseName);
+      if (strlen(obj->BaseNamU)>4 &&
+	  strcmp(obj->BaseNamU+strlen(obj->BaseNamU)-4, "Base")==0)
+	 obj->BaseNamU[strlen(obj->BaseNamU)-4]='\0';
+      strcpy(obj->BaseNamL, obj->BaseNamU);
+      strcpy(obj->BaseNamC, obj->BaseNamU);
+   }
+   StrUpr(obj->BaseNamU);
+   obj->BaseNamC[0]=toupper(obj->BaseNamC[0]);
+
+   if (obj->BaseName[0])
+   {
+      if (strlen(fdfilename)>6 &&
+	  !strcmp(fdfilename+strlen(fdfilename)-6, "_gc.fd"))
+	 obj->type = GADGET;
+      else if (strlen(fdfilename)>6 &&
+	       !strcmp(fdfilename+strlen(fdfilename)-6, "_ic.fd"))
+	 obj->type = IMAGE;
+      else if (strlen(fdfilename)>6 &&
+	       !strcmp(fdfilename+strlen(fdfilename)-6, "_cl.fd"))
+	 obj->type = CLASS;
+      else
+      {
+	 const char *type=fT_Lookup(&TypeTable, obj->BaseName,
+	    strlen(obj->BaseName));
+
+	 if (type)
+	    obj->type=type;
+      }
+   }
+}
+
+int
+fC_ReadFD(fdConverter* obj, const char* fdfilename)
+{
+   fdFile *myfile;
+   fdDef def;	   /* the definition being parsed */
+   char *comment;  /* ... and the comments before it */
+   long count;
+   double start[2];
+   Error lerror;
+
+   if (!obj || !fdfilename)
+   {
+      illparams(obj ? obj->errfile : NULL, "fC_ReadFD");
+      return 1;
+   }
+   fC_Start(obj, start);
+
+   if (!(obj->fdfilename=fC_CopyName(fdfilename)))
+   {
+      fprintf(obj->errfile, "No mem for FDs\n");
+      return 1;
+   }
+
+   if (!(myfile=fF_ctor(fdfilename, obj->scan, obj->errfile)))
+   {
+      fprintf(obj->errfile, "Couldn't open file '%s'.\n", fdfilename);
+      return 1;
+   }
+
+   /* a mapped file tells us roughly how many definitions to expect */
+
+   if (fC_Grow(obj, myfile->mapsize/FD_LINE))
+   {
+      fF_dtor(myfile);
+      return 1;
+   }
+
+   fD_Init(&def, &obj->arena);
+   comment=NULL;
+
+   for (count=0;; count++)
+   {
+      do
+      {
+	 if ((lerror=fF_readln(myfile))==false)
+	 {
+	    fF_SetError(myfile, false);
+	    lerror=fD_parsefd(&def, &comment, myfile);
+	 }
+      }
+      while (lerror==nodef);
+
+      if (lerror!=false)
+	 break;
+
+      /* only now that it parsed does the definition need a place of its
+	 own */
+
+      if ((count==obj->maxfds && fC_Grow(obj, 2*obj->maxfds)) ||
+	  !(obj->defs[count]=fA_Alloc(&obj->arena, sizeof(fdDef))))
+      {
+	 fprintf(obj->errfile, "No mem for FDs\n");
+	 obj->fds=count;
+	 free(comment);
+	 fF_dtor(myfile);
+	 return 1;
+      }
+      def.filtered=!fG_Match(obj->filter, fD_GetName(&def));
+      *obj->defs[count]=def;
+      obj->arrcmts[count]=comment;
+      fD_Init(&def, &obj->arena);
+      comment=NULL;
+   }
+   free(comment);
+   obj->fds=count;
+
+   fC_Names(obj, myfile->basename);
+   fC_Count(obj, myfile, 0);
+   obj->stats.defs+=count;
+   fF_dtor(myfile);
+   fC_Stop(obj, fdPHASE_FD, start);
+
+   /* defs stays in bias order; the clib pass finds them through the index */
+
+   if (fC_Index(obj))
+      return 1;
+   fC_Stop(obj, fdPHASE_INDEX, start);
+
+   return 0;
+}
+
+/******************************************************************************
+ *    fC_ReadClib
+ *
+ * looks up the prototype of every definition in the clib file.
+ ******************************************************************************/
+
+/* add len chars of str to the SFD header; a failure shows in headerlen */
+
+static void
+fC_AddHeader(fdConverter* obj, const char* str, size_t len)
+{
+   if (obj->headerlen+len>obj->headersize)
+   {
+      size_t size=obj->headersize ? 2*obj->headersize : 1024;
+      char *header;
+
+      while (size<obj->headerlen+len)
+	 size*=2;
+      if (!(header=realloc(obj->header, size)))
+      {
+	 fprintf(obj->errfile, "No mem for header\n");
+	 return;
+      }
+      obj->header=header;
+      obj->headersize=size;
+   }
+   memcpy(obj->header+obj->headerlen, str, len);
+   obj->headerlen+=len;
+}
+
+/******************************************************************************
+ * fC_Cond
+ *
+ * evaluates the expression of an #if or #elif: integers, character
+ * constants, macros, defined and C's operators. The value is unknown if it
+ * depends on a macro neither the clib file nor -D and -U say anything
+ * about, since it may come from a header that isn't read, or on a macro
+ * that takes arguments. A group whose condition is unknown is read all
+ * through, as if the #if wasn't there.
+ ******************************************************************************/
+
+typedef struct
+{
+   long value;
+   int	known;
+} fdValue;
+
+typedef struct
 {
-   static const char *AliasTable[]=
-   {
-      "AllocDosObject", "AllocDosObjectTagList",
-      "CreateNewProc",	"CreateNewProcTagList",
-      "NewLoadSeg",	"NewLoadSegTagList",
-      "System",		"SystemTagList",
-   };
-   unsigned int count;
-   for (count=0; count<sizeof AliasTable/sizeof AliasTable[0]; count++)
-      if (strcmp(name, AliasTable[count])==0)
-	 return AliasTable[count+(count%2 ? -1 : 1)];
-   return NULL;
-}
+   const fdConverter* conv;
+   const char* at;
+   const char* end;
+   int	       bad;	/* not an expression */
+   int	       depth;	/* macros being expanded */
+} fdCond;
 
-static INLINE void
-fD_PrintRegs(FILE* outfile, const fdDef* obj)
+static const fdValue CondUnknown={0, 0};
+
+static const fdMacro*
+fC_Macro(const fdConverter* obj, const char* name, size_t len)
 {
-   int count;
-   int numregs=fD_RegNum(obj);
+   const fdMacro *macro=fM_Find(obj->defined, name, len);
 
-   if (obj->cfunction)
+   return macro ? macro : fM_Find(obj->macros, name, len);
+}
+
+static void
+CondBlanks(fdCond* obj)
+{
+   while (obj->at<obj->end)
    {
-      if (obj->base)
+      if (isspace((unsigned char) *obj->at) || *obj->at=='\\')
+	 obj->at++;
+      else if (*obj->at=='/' && obj->at+1<obj->end && obj->at[1]=='*')
       {
-	 fprintf(outfile, "base,");
+	 for (obj->at+=2; obj->at+1<obj->end &&
+	      (obj->at[0]!='*' || obj->at[1]!='/'); obj->at++);
+	 obj->at=obj->at+1<obj->end ? obj->at+2 : obj->end;
       }
-      fprintf(outfile, "sysv");
-   }
-   if (numregs>0)
-   {
-      for (count=d0; count<numregs-1; count++)
-	 fprintf(outfile, "%s,", fD_GetRegStr(obj, count));
-      fprintf(outfile, "%s", fD_GetRegStr(obj, count));
+      else if (*obj->at=='/' && obj->at+1<obj->end && obj->at[1]=='/')
+	 obj->at=obj->end;
+      else
+	 break;
    }
 }
 
-void
-fD_write(FILE* outfile, const fdDef* obj,int alias)
+static size_t
+CondWord(const fdCond* obj)
 {
-   static int bias = -1;
-   static int priv = -1;
-   shortcard count, numargs;
-   const char *tagname, *varname, *name, *rettype;
-   int vd=0, a45=0, d7=0;
+   const char *at=obj->at;
 
-   DBP(fprintf(stderr, "func %s\n", fD_GetName(obj)));
+   if (at<obj->end && (isalpha((unsigned char) *at) || *at=='_'))
+      while (++at<obj->end && (isalnum((unsigned char) *at) || *at=='_'));
+   return at-obj->at;
+}
 
-   numargs=fD_RegNum(obj);
+static fdValue
+CondTernary(fdCond* obj);
 
-   if (!numargs)
-     numargs=fD_ParamNum(obj);
-   else if (fD_ParamNum(obj) != numargs && !Quiet)
-     fprintf(stderr, "Warning: %s gets %d params and %d regs!\n",
-	     fD_GetName(obj), fD_ParamNum(obj), numargs);
-     
+/* a macro's value, if it is an expression of its own */
 
-   if ((rettype=fD_GetType(obj))==fD_nostring)
+static fdValue
+CondMacro(fdCond* obj, const char* name, size_t len)
+{
+   const fdMacro *macro=fC_Macro(obj->conv, name, len);
+   fdCond value;
+   fdValue result;
+
+   if (!macro || macro->function || obj->depth>=16)
+      return CondUnknown;
+   if (!macro->value)
    {
-      if (!Quiet && !fD_GetPrivate(obj))
-	 fprintf(stderr, "Warning: %s has no prototype.\n", fD_GetName(obj));
-      rettype = "ULONG";
+      result.value=0; /* #undef'd, so it's known to be 0 */
+      result.known=1;
+      return result;
    }
-   if (!strcasecmp(rettype, "void"))
-      vd = 1; /* set flag */
-   for (count=d0; count<numargs; count++)
+
+   value.conv=obj->conv;
+   value.at=macro->value;
+   value.end=macro->value+strlen(macro->value);
+   value.bad=0;
+   value.depth=obj->depth+1;
+   result=CondTernary(&value);
+   CondBlanks(&value);
+   return value.bad || value.at<value.end ? CondUnknown : result;
+}
+
+static fdValue
+CondPrimary(fdCond* obj)
+{
+   fdValue result={0, 1};
+   size_t len;
+
+   CondBlanks(obj);
+   if (obj->at>=obj->end)
    {
-      const char *reg=fD_GetRegStr(obj, count);
-      if (strcmp(reg, "a4")==0 || strcmp(reg, "a5")==0)
+      obj->bad=1;
+      return CondUnknown;
+   }
+
+   switch (*obj->at)
+   {
+      case '(':
+	 obj->at++;
+	 result=CondTernary(obj);
+	 CondBlanks(obj);
+	 if (obj->at<obj->end && *obj->at==')')
+	    obj->at++;
+	 else
+	    obj->bad=1;
+	 return result;
+
+      case '!': case '-': case '+': case '~':
       {
-	 if (!a45)
-	    a45=(strcmp(reg, "a4") ? 5 : 4); /* set flag */
-	 else /* Security check */
-	    if (!Quiet)
-	       fprintf(stderr, "Warning: both a4 and a5 are used. "
-		       "This is not supported!\n");
+	 char op=*obj->at++;
+
+	 result=CondPrimary(obj);
+	 if (op=='!')
+	    result.value=!result.value;
+	 else if (op=='-')
+	    result.value=(long) -(unsigned long) result.value;
+	 else if (op=='~')
+	    result.value=~result.value;
+	 return result;
       }
-      if (strcmp(reg, "d7")==0) /* Used only when a45!=0 */
-	 d7=1;
-   }
-   
-   if (a45 && d7) /* Security check */
-      if (!Quiet)
-	 fprintf(stderr, "Warning: d7 and a4 or a5 are used. This is not "
-		 "supported!\n");
 
-   name=fD_GetName(obj);
+      case '\'':
+	 if (obj->at+2<obj->end && obj->at[1]=='\\')
+	 {
+	    char ch=obj->at[2];
 
-   if (fD_ProtoNum(obj)!=numargs)
+	    result.value=ch=='n' ? '\n' : ch=='t' ? '\t' : ch=='r' ? '\r' :
+			 ch=='0' ? '\0' : (unsigned char) ch;
+	    obj->at+=3;
+	 }
+	 else if (obj->at+1<obj->end)
+	 {
+	    result.value=(unsigned char) obj->at[1];
+	    obj->at+=2;
+	 }
+	 if (obj->at<obj->end && *obj->at=='\'')
+	    obj->at++;
+	 else
+	    obj->bad=1;
+	 return result;
+   }
+
+   if (isdigit((unsigned char) *obj->at))
    {
-      if (!Quiet)
-	 fprintf(stderr, "%s gets %d fd args and %d proto%s.\n", name, numargs,
-		 fD_ProtoNum(obj), fD_ProtoNum(obj)!= 1 ? "s" : "");
-      for (count=d0; count<numargs; count++)
+      unsigned long value=0, base=10, digit;
+
+      if (*obj->at=='0')
       {
-	 if (fD_GetReg(obj, count) != illegal &&
-	     fD_GetProto(obj, count) == fD_nostring)
+	 base=8;
+	 if (++obj->at<obj->end && (*obj->at=='x' || *obj->at=='X'))
 	 {
-	    fD_NewProto((fdDef*)obj, count, "ULONG");
+	    base=16;
+	    obj->at++;
 	 }
       }
-
-//      return;
+      for (; obj->at<obj->end && isxdigit((unsigned char) *obj->at) &&
+	   (digit=isdigit((unsigned char) *obj->at) ? *obj->at-'0' :
+	    tolower((unsigned char) *obj->at)-'a'+10)<base; obj->at++)
+	 value=value*base+digit;
+      while (obj->at<obj->end && strchr("uUlL", *obj->at))
+	 obj->at++;
+      result.value=(long) value;
+      return result;
    }
 
-   if (bias != fD_GetOffset(obj))
+   if (!(len=CondWord(obj)))
    {
-      bias = fD_GetOffset(obj);
-      fprintf(outfile, "==bias %d\n", -bias);
+      obj->bad=1;
+      return CondUnknown;
    }
 
-   if (priv != fD_GetPrivate(obj))
+   if (len==7 && strncmp(obj->at, "defined", 7)==0)
    {
-      priv = fD_GetPrivate(obj);
-      fprintf(outfile, "==%s\n", priv ? "private" : "public");
-   }
-   
-   fprintf(outfile, "%s %s(", rettype, name);
-   
-   if (numargs>0)
-   {
-      for (count=d0; count<numargs; count++)
-      {
-	 if (strchr(fD_GetProto(obj, count),'%'))
-	    sprintf(Buffer, fD_GetProto(obj, count), fD_GetParam(obj, count));
-	 else
-	    sprintf(Buffer, "%s %s",
-		    fD_GetProto(obj, count), fD_GetParam(obj, count));
+      const fdMacro *macro;
+      int paren;
 
-	 // Workaround varargs in FD file (sysv)
-	 if (strcmp(fD_GetParam(obj, count), "...")==0)
-	   sprintf(Buffer, "...");
-	 
-	 if (count<numargs-1)
-	    fprintf(outfile, "%s, ", Buffer);
+      obj->at+=7;
+      CondBlanks(obj);
+      if ((paren=obj->at<obj->end && *obj->at=='('))
+      {
+	 obj->at++;
+	 CondBlanks(obj);
+      }
+      if (!(len=CondWord(obj)))
+      {
+	 obj->bad=1;
+	 return CondUnknown;
+      }
+      if ((macro=fC_Macro(obj->conv, obj->at, len)))
+	 result.value=macro->value!=NULL;
+      else
+	 result=CondUnknown; /* may come from a header that isn't read */
+      obj->at+=len;
+      CondBlanks(obj);
+      if (paren)
+      {
+	 if (obj->at<obj->end && *obj->at==')')
+	    obj->at++;
 	 else
-	    fprintf(outfile, "%s", Buffer);
+	    obj->bad=1;
       }
+      return result;
    }
 
-   fprintf(outfile, ") (");
+   result=CondMacro(obj, obj->at, len);
+   obj->at+=len;
+   CondBlanks(obj);
+   if (obj->at<obj->end && *obj->at=='(') /* a macro call */
+   {
+      int depth=0;
 
-   fD_PrintRegs(outfile, obj);
+      do
+	 depth+=*obj->at=='(' ? 1 : *obj->at==')' ? -1 : 0;
+      while (++obj->at<obj->end && depth);
+      if (depth)
+	 obj->bad=1;
+      return CondUnknown;
+   }
+   return result;
+}
 
-   fprintf(outfile, ")\n");
+/* the binary operator at obj->at and its precedence, 0 if there's none */
 
-   if (alias)
+static int
+CondOperator(const fdCond* obj, char* op, size_t* len)
+{
+   static const char *const ops[]=
    {
-      return;
-   }
-   
-   if ((tagname=aliasfunction(fD_GetName(obj)))!=0)
+      "||", "&&", "|", "^", "&", "==", "!=", "<=", ">=", "<<", ">>",
+      "<", ">", "+", "-", "*", "/", "%"
+   };
+   static const int prec[]=
    {
-      fdDef *objnc=(fdDef*)obj;
-      objnc->name=(char*)tagname;
+      1, 2, 3, 4, 5, 6, 6, 7, 7, 8, 8, 7, 7, 9, 9, 10, 10, 10
+   };
+   size_t count, left=obj->end-obj->at;
 
-      fprintf(outfile, "==alias\n");
-      fD_write(outfile, objnc, 1);
+   for (count=0; count<sizeof ops/sizeof ops[0]; count++)
+   {
+      size_t oplen=strlen(ops[count]);
 
-      objnc->name=(char*)name;
+      if (oplen<=left && strncmp(obj->at, ops[count], oplen)==0)
+      {
+	 op[0]=ops[count][0];
+	 op[1]=ops[count][1];
+	 *len=oplen;
+	 return prec[count];
+      }
    }
+   return 0;
+}
 
-   if ((tagname=taggedfunction(obj))!=0)
+static fdValue
+CondApply(const char* op, fdValue a, fdValue b)
+{
+   fdValue result={0, 1};
+   unsigned long x=a.value, y=b.value;
+
+   if (op[0]=='&' && op[1]=='&')
+   {
+      if ((a.known && !a.value) || (b.known && !b.value))
+	 return result;
+      result.value=1;
+      return a.known && b.known ? result : CondUnknown;
+   }
+   if (op[0]=='|' && op[1]=='|')
    {
-      fprintf(outfile, "==varargs\n");
+      result.value=1;
+      if ((a.known && a.value) || (b.known && b.value))
+	 return result;
+      result.value=0;
+      return a.known && b.known ? result : CondUnknown;
+   }
+   if (!a.known || !b.known)
+      return CondUnknown;
 
-      fprintf(outfile, "%s %s(", rettype, tagname);
-   
-      if (numargs>0)
-      {
-	 for (count=d0; count<numargs; count++)
+   switch (op[0])
+   {
+      case '|': result.value=x|y; break;
+      case '^': result.value=x^y; break;
+      case '&': result.value=x&y; break;
+      case '=': result.value=a.value==b.value; break;
+      case '!': result.value=a.value!=b.value; break;
+      case '+': result.value=(long) (x+y); break;
+      case '-': result.value=(long) (x-y); break;
+      case '*': result.value=(long) (x*y); break;
+      case '<':
+      case '>':
+	 if (op[1]==op[0])
 	 {
-	    if (strchr(fD_GetProto(obj, count),'%'))
-	       sprintf(Buffer, fD_GetProto(obj, count),
-		       fD_GetParam(obj, count));
-	    else
-	       sprintf(Buffer, "%s %s",
-		       fD_GetProto(obj, count), fD_GetParam(obj, count));
-	    if (count<numargs-1)
-	       fprintf(outfile, "%s, ", Buffer);
-	    else
-	       fprintf(outfile, "Tag %s, ...", fD_GetParam(obj, count));
+	    if (y>=8*sizeof(long))
+	       return CondUnknown;
+	    result.value=op[0]=='<' ? (long) (x<<y) : a.value>>y;
 	 }
-      }
-
-      fprintf(outfile, ") (");
+	 else if (op[1]=='=')
+	    result.value=op[0]=='<' ? a.value<=b.value : a.value>=b.value;
+	 else
+	    result.value=op[0]=='<' ? a.value<b.value : a.value>b.value;
+	 break;
+      default: /* '/' and '%' */
+	 if (b.value==0 || (b.value==-1 && a.value==-LONG_MAX-1))
+	    return CondUnknown;
+	 result.value=op[0]=='/' ? a.value/b.value : a.value%b.value;
+	 break;
+   }
+   return result;
+}
 
-      fD_PrintRegs(outfile, obj);
+static fdValue
+CondBinary(fdCond* obj, int minprec)
+{
+   fdValue result=CondPrimary(obj);
+   char op[2];
+   size_t len;
+   int prec;
 
-      fprintf(outfile, ")\n");
+   for (;;)
+   {
+      CondBlanks(obj);
+      if (!(prec=CondOperator(obj, op, &len)) || prec<minprec)
+	 return result;
+      obj->at+=len;
+      result=CondApply(op, result, CondBinary(obj, prec+1));
    }
+}
 
-   if ((varname = getvarargsfunction(obj)) != 0)
-   {
-      fprintf(outfile, "==varargs\n");
+static fdValue
+CondTernary(fdCond* obj)
+{
+   fdValue cond=CondBinary(obj, 1), yes, no;
+
+   CondBlanks(obj);
+   if (obj->at>=obj->end || *obj->at!='?')
+      return cond;
+   obj->at++;
+   yes=CondTernary(obj);
+   CondBlanks(obj);
+   if (obj->at<obj->end && *obj->at==':')
+      obj->at++;
+   else
+      obj->bad=1;
+   no=CondTernary(obj);
 
-      fprintf(outfile, "%s %s(", rettype, varname);
-   
-      if (numargs>0)
-      {
-	 for (count=d0; count<numargs; count++)
-	 {
-	    if (strchr(fD_GetProto(obj, count),'%'))
-	       sprintf(Buffer, fD_GetProto(obj, count),
-		       fD_GetParam(obj, count));
-	    else
-	       sprintf(Buffer, "%s %s",
-		       fD_GetProto(obj, count), fD_GetParam(obj, count));
-	    if (count<numargs-1)
-	       fprintf(outfile, "%s, ", Buffer);
-	    else
-	       fprintf(outfile, "...");
-	 }
-      }
+   if (cond.known)
+      return cond.value ? yes : no;
+   return yes.known && no.known && yes.value==no.value ? yes : CondUnknown;
+}
+
+/* 1 if the expression is true, 0 if false, -1 if unknown, -2 if bad */
 
-      fprintf(outfile, ") (");
+static int
+fC_Cond(const fdConverter* obj, const char* str, size_t len)
+{
+   fdCond cond;
+   fdValue result;
+
+   cond.conv=obj;
+   cond.at=str;
+   cond.end=str+len;
+   cond.bad=0;
+   cond.depth=0;
+   result=CondTernary(&cond);
+   CondBlanks(&cond);
+   if (cond.bad || cond.at<cond.end)
+      return -2;
+   return result.known ? result.value!=0 : -1;
+}
 
-      fD_PrintRegs(outfile, obj);
+/******************************************************************************
+ * fC_ClibLine
+ *
+ * sees every line of the clib file as it is read, and tells fF_gets() which
+ * to leave out: preprocessor directives, which also end the statement read
+ * so far, and the lines of #if groups that aren't compiled, which are only
+ * looked at for directives and comments. The #includes and typedefs of the
+ * lines that are compiled are kept for the ==include and ==typedef lines
+ * of the header.
+ ******************************************************************************/
 
-      fprintf(outfile, ")\n");
-   }
+static int
+fC_Active(const fdConverter* obj)
+{
+   return !obj->numgroups || obj->groups[obj->numgroups-1].state<=fC_OPEN;
+}
 
-   if (strcmp(name, "DoPkt")==0)
+static void
+fC_Push(fdConverter* obj, unsigned char state, unsigned long lineno)
+{
+   if (obj->numgroups==obj->maxgroups)
    {
-      fdDef *objnc=(fdDef*)obj;
-      char newname[7]="DoPkt0";
-      objnc->name=newname;
-      for (count=2; count<7; count++)
+      long max=obj->maxgroups ? 2*obj->maxgroups : 16;
+      fdGroup *groups=realloc(obj->groups, max*sizeof(fdGroup));
+
+      if (!groups)
       {
-	 regs reg=objnc->reg[count];
-	 char *proto=objnc->proto[count];
-	 objnc->reg[count]=illegal;
-	 objnc->proto[count]=fD_nostring;
-	 fprintf(outfile,"==alias\n");
-	 fD_write(outfile, objnc, 1);
-	 objnc->reg[count]=reg;
-	 objnc->proto[count]=proto;
-	 newname[5]++;
+	 fprintf(obj->errfile, "No mem for #if\n");
+	 return;
       }
-      objnc->name=(char*)name;
+      obj->groups=groups;
+      obj->maxgroups=max;
    }
-
-   bias -= FUNCTION_GAP;
+   obj->groups[obj->numgroups].state=state;
+   obj->groups[obj->numgroups].lineno=lineno;
+   obj->numgroups++;
 }
 
-int
-varargsfunction(const char* proto, const char* funcname)
+/* notes whether str[0..len-1] ends within a comment */
+
+static void
+fC_Comments(fdConverter* obj, const fdScan* scan, const char* str, size_t len)
 {
-   const char *end=proto+strlen(proto)-1;
-   while (isspace(*end))
-      end--;
-   if (*end--==';')
+   const char *end=str+len, *slash;
+   size_t at;
+
+   while ((slash=memchr(str, '/', end-str)) && slash+1<end)
    {
-      while (isspace(*end))
-	 end--;
-      if (*end--==')')
+      str=slash+1;
+      if (*str=='/')
+	 return;
+      if (*str=='*')
       {
-	 while (isspace(*end))
-	    end--;
-	 if (!strncmp(end-2, "...", 3))
+	 str++;
+	 if ((at=scan->commentend(str, end-str))==(size_t) (end-str))
 	 {
-	    /* Seems to be a varargs function. Check if it will be recognized
-	       as "tagged". */
-	    unsigned int count;
-	    char fixedname[200]; /* Hope will be enough... */
-	    fdDef *tmpdef;
-
-	    for (count=0; count<sizeof TagExcTable/sizeof TagExcTable[0];
-	    count+=2)
-	       if (strcmp(funcname, TagExcTable[count+1])==0)
-		  return 1;
-
-	    if (!(tmpdef=fD_ctor()))
-	    {
-	       fprintf(stderr, "No mem for FDs\n");
-	       exit(EXIT_FAILURE);
-	    }
-
-	    strcpy(fixedname, funcname);
-	    if (strlen(funcname)>4 &&
-	    !strcmp(funcname+strlen(funcname)-4, "Tags"))
-	    {
-	       /* Might be either nothing or "TagList". */
-	       fixedname[strlen(fixedname)-4]='\0';
-	       fD_NewName(tmpdef, fixedname);
-	       if (bsearch(&tmpdef, arrdefs, fds, sizeof arrdefs[0],
-	       fD_cmpName))
-		  return 1;
-
-	       strcat(fixedname, "TagList");
-	       fD_NewName(tmpdef, fixedname);
-	       if (bsearch(&tmpdef, arrdefs, fds, sizeof arrdefs[0],
-	       fD_cmpName))
-		  return 1;
-	    }
-	    else
-	    {
-	       strcat(fixedname, "A");
-	       fD_NewName(tmpdef, fixedname);
-	       if (bsearch(&tmpdef, arrdefs, fds, sizeof arrdefs[0],
-	       fD_cmpName))
-		  return 1;
-	    }
+	    obj->incomment=1;
+	    return;
 	 }
+	 str+=at+2;
       }
    }
-   return 0;
 }
 
-int
-ishandleddifferently(const char* proto, const char* funcname)
+/* the length of line without its newline; 1 if it ends in '\' */
+
+static int
+fC_Continues(const char* line, size_t len, size_t* end)
 {
-   /* First check if this is a vararg call? */
-   if (varargsfunction(proto, funcname))
+   while (len && (line[len-1]=='\n' || line[len-1]=='\r'))
+      len--;
+   *end=len;
+   if (len && line[len-1]=='\\')
+   {
+      *end=len-1;
       return 1;
+   }
+   return 0;
+}
 
-   /* It might be a dos.library "alias" name. */
-   if (aliasfunction(funcname))
-      return 1;
+static void
+fC_AddDirective(fdConverter* obj, const char* str, size_t len)
+{
+   if (obj->directivelen+len>obj->directivesize)
+   {
+      size_t size=obj->directivesize ? 2*obj->directivesize : 256;
+      char *directive;
 
-   /* It might be one from dos.library/DoPkt() family. */
-   if (strlen(funcname)==6 && !strncmp(funcname, "DoPkt", 5) &&
-   funcname[5]>='0' && funcname[6]<='4')
-      return 1;
+      while (size<obj->directivelen+len)
+	 size*=2;
+      if (!(directive=realloc(obj->directive, size)))
+      {
+	 fprintf(obj->errfile, "No mem for #define\n");
+	 return;
+      }
+      obj->directive=directive;
+      obj->directivesize=size;
+   }
+   memcpy(obj->directive+obj->directivelen, str, len);
+   obj->directivelen+=len;
+}
 
-   /* Finally, it can be intuition.library/ReportMouse1(). */
-   return !strcmp(funcname, "ReportMouse1");
+/* 1 if the macro an #ifdef (or #ifndef) names is defined (or not), -1 if
+   nothing says */
+
+static int
+fC_Defined(const fdConverter* obj, const char* str, size_t len, int not)
+{
+   const fdMacro *macro;
+   size_t namelen;
+
+   for (namelen=0; namelen<len && (isalnum((unsigned char) str[namelen]) ||
+				   str[namelen]=='_'); namelen++);
+   if (!namelen)
+      return -2;
+   if (!(macro=fC_Macro(obj, str, namelen)))
+      return -1;
+   return (macro->value!=NULL)!=not;
 }
 
-void
-printusage(const char* exename)
+static void
+fC_Define(fdConverter* obj, const char* str, size_t len, int undef)
 {
-   fprintf(stderr,
-      "Usage: %s [options] fd-file clib-file [[-o] output-file]\n"
-      "Options:\n"
+   size_t namelen, at;
+   int function;
 
-      "--quiet\t\t\tDon't display warnings\n"
-      "--version\t\tPrint version number and exit\n\n"
-	   , exename);
+   for (namelen=0; namelen<len && (isalnum((unsigned char) str[namelen]) ||
+				   str[namelen]=='_'); namelen++);
+   if (!namelen)
+      return;
+
+   /* the value follows the parameters of a macro taking arguments */
+
+   at=namelen;
+   if ((function=at<len && str[at]=='('))
+      while (at<len && str[at++]!=')');
+   while (at<len && isspace((unsigned char) str[at]))
+      at++;
+   while (len>at && isspace((unsigned char) str[len-1]))
+      len--;
+
+   if ((!obj->defined && !(obj->defined=fM_ctor())) ||
+       fM_Set(obj->defined, str, namelen, undef ? NULL : str+at, len-at,
+	      function))
+      fprintf(obj->errfile, "No mem for #define\n");
 }
 
-void output_proto(FILE* outfile)
+static void
+fC_Include(fdConverter* obj, const char* line, size_t len)
 {
-   fprintf(outfile,
-      "/* Automatically generated header! Do not edit! */\n\n"
-      "#ifndef PROTO_%s_H\n"
-      "#define PROTO_%s_H\n\n"
-      "#include <clib/%s_protos.h>\n\n"
-      "#ifndef _NO_INLINE\n"
-      "#ifdef __GNUC__\n"
-      "#include <inline/%s.h>\n"
-      "#endif /* __GNUC__ */\n"
-      "#endif /* !_NO_INLINE */\n\n",
-      BaseNamU, BaseNamU, BaseNamL, BaseNamL);
+   static const char *NoInclude[]=
+   {
+      "proto/",
+      "pragma/",
+      "ppcinline/",
+      "ppcpragma/",
+      "ppcproto/",
+      "inline/",
+      "stormprotos/"
+   };
+   unsigned int count;
+   char start=0;
+   char end=0;
+   const char* inc;
+   size_t inclen, i=0;
 
-   if (BaseName[0])
-      fprintf(outfile,
-	 "#ifndef __NOLIBBASE__\n"
-	 "extern struct %s *\n"
-	 "#ifdef __CONSTLIBBASEDECL__\n"
-	 "__CONSTLIBBASEDECL__\n"
-	 "#endif /* __CONSTLIBBASEDECL__ */\n"
-	 "%s;\n"
-	 "#endif /* !__NOLIBBASE__ */\n\n",
-	 StdLib, BaseName);
+   start=i<len ? line[i] : 0;
 
-   fprintf(outfile,
-      "#endif /* !PROTO_%s_H */\n", BaseNamU);
-}
+   if (start=='"')
+      end='"';
+   else if (start=='<')
+      end='>';
+   else
+   {
+      fprintf(obj->errfile, "Bad #include line\n");
+   }
 
-/******************************************************************************/
+   if (i<len)
+      ++i;
 
-int
-main(int argc, char** argv)
-{
-   fdDef *tmpdef,	/* a dummy to contain the name to look for */
-	 *founddef;	/* the fdDef for which we found a prototype */
-   fdFile *myfile;
-   char *tmpstr;
-   FILE *clib;
-   FILE *outfile;
-   int   closeoutfile=0;
-   int   rc = EXIT_FAILURE;
-   char *fdfilename=0, *clibfilename=0, *outfilename=0;
-   const char* type = "library";
+   inc=line+i;
+   for (inclen=0; i+inclen<len && inc[inclen]!=end && inc[inclen];
+	++inclen);
 
-   int count;
-   Error lerror;
+   for (count=0; count<sizeof NoInclude/sizeof NoInclude[0]; count++)
+      if (inclen>=strlen(NoInclude[count]) &&
+	  strncmp(inc, NoInclude[count], strlen(NoInclude[count]))==0)
+	 break;
+
+   if (count==sizeof NoInclude/sizeof NoInclude[0])
+   {
+      fC_AddHeader(obj, "==include ", 10);
+      fC_AddHeader(obj, &start, 1);
+      fC_AddHeader(obj, inc, inclen);
+      fC_AddHeader(obj, &end, 1);
+      fC_AddHeader(obj, "\n", 1);
+   }
+
+   if (inclen==12 && !strncmp(inc, "exec/types.h", 12))
+      obj->got_exec_types=1;
+   else if (inclen==17 && !strncmp(inc, "utility/tagitem.h", 17))
+      obj->got_utility_tagitem=1;
+}
 
-   for (count=1; count<argc; count++)
-   {
-      char *option=argv[count];
-      if (*option=='-')
-      {
-	 option++;
-	 if (strcmp(option, "o")==0)
-	 {
-	    if (count==argc-1 || outfilename)
-	    {
-	       printusage(argv[0]);
-	       return EXIT_FAILURE;
-	    }
-	    if (strcmp(argv[++count], "-"))
-	       outfilename=argv[count];
-	 }
-	 else
-	 {
-	    if (*option=='-') /* Accept GNU-style '--' options */
-	       option++;
+/* line is what follows the '#' of a directive, joined if it went on over
+   several lines */
 
-	    if (strcmp(option, "quiet") == 0)
-	       Quiet = 1;
-	    else if (strcmp(option, "version")==0)
-	    {
-	       fprintf(stderr, "fd2sfd version " VERSION "\n");
-	       return EXIT_SUCCESS;
-	    }
-	    /* Unknown option */
-	    else
-	    {
-	       printusage(argv[0]);
-	       return EXIT_FAILURE;
-	    }
-	 }
-      }
-      else
+static void
+fC_Directive(fdConverter* obj, fdFile* file, const char* line, size_t len)
+{
+   fdGroup *group=obj->numgroups ? obj->groups+obj->numgroups-1 : NULL;
+   const char *word;
+   size_t wordlen, i=0;
+   int cond;
+
+   while (i<len && (line[i]==' ' || line[i]=='\t')) ++i;
+   word=line+i;
+   for (wordlen=0; i<len && isalpha((unsigned char) line[i]); ++i, ++wordlen);
+   while (i<len && (line[i]==' ' || line[i]=='\t')) ++i;
+   line+=i;
+   len-=i;
+
+   if ((wordlen==2 && !strncmp(word, "if", 2)) ||
+       (wordlen==5 && !strncmp(word, "ifdef", 5)) ||
+       (wordlen==6 && !strncmp(word, "ifndef", 6)))
+   {
+      if (!fC_Active(obj))
       {
-	 /* One of the filenames */
-	 if (!fdfilename)
-	    fdfilename=option;
-	 else if (!clibfilename)
-	    clibfilename=option;
-	 else if (!outfilename)
-	    outfilename=option;
-	 else
-	 {
-	    printusage(argv[0]);
-	    return EXIT_FAILURE;
-	 }
+	 /* not even looked at */
+	 fC_Push(obj, fC_SKIPPED, fF_LineNo(file));
+	 return;
       }
+      cond=wordlen==2 ? fC_Cond(obj, line, len)
+		      : fC_Defined(obj, line, len, wordlen==6);
+      fC_Push(obj, cond==1 ? fC_ACTIVE : cond==0 ? fC_WAITING : fC_OPEN,
+	      fF_LineNo(file));
    }
-
-   if (!fdfilename || !clibfilename)
+   else if ((wordlen==4 && !strncmp(word, "elif", 4)) ||
+	    (wordlen==4 && !strncmp(word, "else", 4)))
    {
-      printusage(argv[0]);
-      return EXIT_FAILURE;
+      if (!group)
+      {
+	 if (!obj->quiet)
+	    fprintf(obj->errfile, "#%.*s without #if in line %lu.\n",
+		    (int) wordlen, word, fF_LineNo(file));
+	 return;
+      }
+      cond=0;
+      if (group->state==fC_ACTIVE || group->state==fC_TAKEN)
+	 group->state=fC_TAKEN;
+      else if (group->state==fC_WAITING)
+      {
+	 cond=word[2]=='i' ? fC_Cond(obj, line, len) : 1;
+	 group->state=cond==1 ? fC_ACTIVE : cond==0 ? fC_WAITING : fC_OPEN;
+      }
    }
-
-   if (!(arrdefs=calloc(FDS,sizeof(fdDef*))))
+   else if (wordlen==5 && !strncmp(word, "endif", 5))
    {
-      fprintf(stderr, "No mem for FDs\n");
-      rc = EXIT_FAILURE;
-      goto quit;
+      cond=0;
+      if (group)
+	 obj->numgroups--;
+      else if (!obj->quiet)
+	 fprintf(obj->errfile, "#endif without #if in line %lu.\n",
+		 fF_LineNo(file));
    }
-   if (!(arrcmts=calloc(FDS,sizeof(char*))))
+   else
    {
-      fprintf(stderr, "No mem for FD comments\n");
-      rc = EXIT_FAILURE;
-      goto quit;
+      if (!fC_Active(obj))
+	 return;
+      cond=0;
+      if (wordlen==6 && !strncmp(word, "define", 6))
+	 fC_Define(obj, line, len, 0);
+      else if (wordlen==5 && !strncmp(word, "undef", 5))
+	 fC_Define(obj, line, len, 1);
+      else if (wordlen==7 && !strncmp(word, "include", 7))
+	 fC_Include(obj, line, len);
    }
-   for (count=0; count<FDS; count++)
+
+   if (cond==-2 && !obj->quiet)
+      fprintf(obj->errfile, "Can't evaluate #%.*s in line %lu.\n",
+	      (int) wordlen, word, fF_LineNo(file));
+}
+
+static int
+fC_ClibLine(fdConverter* obj, fdFile* file, const char* line, size_t len)
+{
+   int active=fC_Active(obj);
+   size_t i=0, end;
+   double start[2];
+
+   if (obj->continued)
    {
-      arrdefs[count]=NULL;
-      arrcmts[count]=NULL;
+      fC_Start(obj, start);
+      obj->continued=fC_Continues(line, len, &end);
+      fC_AddDirective(obj, line, end);
+      if (!obj->continued)
+	 fC_Directive(obj, file, obj->directive, obj->directivelen);
+      fC_Stop(obj, fdPHASE_HEADER, start);
+      return 2;
    }
 
-   if (!(myfile=fF_ctor(fdfilename)))
+   if (obj->incomment)
    {
-      fprintf(stderr, "Couldn't open file '%s'.\n", fdfilename);
-      rc = EXIT_FAILURE;
-      goto quit;
+      if ((i=file->scan->commentend(line, len))==len)
+	 return !active;
+      obj->incomment=0;
+      fC_Comments(obj, file->scan, line+i+2, len-i-2);
+      return !active;
    }
 
-   lerror=false;
+   while (i<len && (line[i]==' ' || line[i]=='\t')) ++i;
 
-   for (count=0; count<FDS && lerror==false; count++)
+   if (i<len && line[i]=='#') /* Pre-processor instruction */
    {
-      if (!(arrdefs[count]=fD_ctor()))
+      ++i;
+      fC_Start(obj, start);
+      if ((obj->continued=fC_Continues(line+i, len-i, &end)))
       {
-	 fprintf(stderr, "No mem for FDs\n" );
-	 rc = EXIT_FAILURE;
-	 goto quit;
-      }
-      do
-      {
-	 if ((lerror=fF_readln(myfile))==false)
-	 {
-	    fF_SetError(myfile, false);
-	    lerror=fD_parsefd(arrdefs[count], &arrcmts[count], myfile);
-	 }
+	 obj->directivelen=0;
+	 fC_AddDirective(obj, line+i, end);
       }
-      while (lerror==nodef);
+      else
+	 fC_Directive(obj, file, line+i, end);
+      fC_Comments(obj, file->scan, line+i, len-i);
+      fC_Stop(obj, fdPHASE_HEADER, start);
+      return 2;
    }
-   if (count<FDS)
+   else if (active && len-i>=7 && !strncmp(line+i, "typedef", 7))
    {
-      count--;
-      fD_dtor(arrdefs[count]);
-      arrdefs[count]=NULL;
-      arrcmts[count]=NULL;
-   }
-   fds=count;
+      const char* td;
 
-   /* Make a copy before we sort, since we need to process the
-      definitions in bias order, not lexical order */
+      fC_Start(obj, start);
+      i+=7;
 
-   if (!(defs=calloc(fds,sizeof(fdDef*))))
-   {
-      fprintf(stderr, "No mem for FDs\n");
-      rc = EXIT_FAILURE;
-      goto quit;
-   }
+      while (i<len && (line[i]==' ' || line[i]=='\t')) ++i;
 
-   bcopy(arrdefs,defs,fds*sizeof(fdDef*));
-   
-   qsort(arrdefs, count, sizeof arrdefs[0], fD_cmpName);
+      td=line+i;
 
-   if (BaseName[0])
-   {
-      unsigned int count2;
-      StdLib="Library";
+      while (i<len && line[i]!=';') ++i;
 
-      for (count2=0; count2<sizeof LibExcTable/sizeof LibExcTable[0]; count2+=2)
-	 if (strcmp(BaseName, LibExcTable[count2])==0)
-	 {
-	    StdLib=LibExcTable[count2+1];
-	    break;
-	 }
+      fC_AddHeader(obj, "* Unofficial extension on next line\n", 36);
+      fC_AddHeader(obj, "==typedef ", 10);
+      fC_AddHeader(obj, td, line+i-td);
+      fC_AddHeader(obj, "\n", 1);
+      fC_Stop(obj, fdPHASE_HEADER, start);
+      return 0;
    }
 
-   fF_dtor(myfile);
+   fC_Comments(obj, file->scan, line+i, len-i);
+   return !active;
+}
+
+/* the groups left open at the end of the clib file */
+
+static void
+fC_EndClib(fdConverter* obj)
+{
+   long count;
+
+   for (count=0; count<obj->numgroups && !obj->quiet; count++)
+      fprintf(obj->errfile, "#if without #endif in line %lu.\n",
+	      obj->groups[count].lineno);
+   obj->numgroups=0;
+   obj->continued=obj->incomment=0;
+}
+
+int
+fC_ReadClib(fdConverter* obj, const char* clibfilename)
+{
+   fdDef *founddef;	/* the fdDef for which we found a prototype */
+   fdFile *myfile;
+   char *tmpstr;
+   double start[2], header[2];
+   Error lerror;
+
+   if (!obj || !clibfilename)
+   {
+      illparams(obj ? obj->errfile : NULL, "fC_ReadClib");
+      return 1;
+   }
+   fC_Start(obj, start);
+   header[0]=obj->stats.wall[fdPHASE_HEADER];
+   header[1]=obj->stats.cpu[fdPHASE_HEADER];
 
-   if (!(myfile=fF_ctor(clibfilename)))
+   if (!(obj->clibfilename=fC_CopyName(clibfilename)))
    {
-     fprintf(stderr, "Couldn't open file '%s'.\n", clibfilename);
-     rc = EXIT_FAILURE;
-     goto quit;
+      fprintf(obj->errfile, "No mem for FDs\n");
+      return 1;
    }
 
-   if (!(tmpdef=fD_ctor()))
+   if (!(myfile=fF_ctor(clibfilename, obj->scan, obj->errfile)))
    {
-     fprintf(stderr, "No mem for FDs\n");
-     rc = EXIT_FAILURE;
-     goto quit;
+     fprintf(obj->errfile, "Couldn't open file '%s'.\n", clibfilename);
+     return 1;
    }
+   myfile->clib=obj;
 
    for (lerror=false; lerror==false || lerror==nodef;)
      if ((lerror=fF_readln(myfile))==false)
      {
        fF_SetError(myfile, false); /* continue even on errors */
-       tmpstr=fF_FuncName(myfile);
 
-       if (tmpstr)
+       if (fF_Proto(myfile))
        {
-	 fdDef **res;
-	 fD_NewName(tmpdef, tmpstr);
-	 res=(fdDef**)bsearch(&tmpdef, arrdefs, fds, sizeof arrdefs[0],
-			      fD_cmpName);
+	 const fdProto *proto=&myfile->proto;
 
-	 if (res)
+	 if ((founddef=fC_FindDef(obj, myfile->line+proto->name,
+				  proto->namelen, "")))
 	 {
-	   founddef=*res;
 	   DBP(fprintf(stderr, "found (%s).\n", fD_GetName(founddef)));
+	   obj->stats.hits++;
 	   fF_SetError(myfile, false);
-	   lerror=fD_parsepr(founddef, myfile);
+	   if (!founddef->filtered) /* no need to parse what isn't written */
+	     lerror=fD_parsepr(founddef, myfile);
 	 }
 	 else
-	   if (!ishandleddifferently(myfile->line, tmpstr))
-	     if (!Quiet)
-	       fprintf(stderr, "Don't know what to do with <%s> in line %lu.\n",
-		       tmpstr, myfile->lineno);
-	 free(tmpstr);
+	 {
+	   obj->stats.misses++;
+	   if (!(tmpstr=malloc(proto->namelen+1)))
+	     fprintf(obj->errfile, "No mem for fF_Proto\n");
+	   else
+	   {
+	     memcpy(tmpstr, myfile->line+proto->name, proto->namelen);
+	     tmpstr[proto->namelen]='\0';
+	     if (!ishandleddifferently(obj, myfile->line, tmpstr))
+	       if (!obj->quiet)
+		 fprintf(obj->errfile,
+			 "Don't know what to do with <%s> in line %lu.\n",
+			 tmpstr, fF_LineNo(myfile));
+	     free(tmpstr);
+	   }
+	 }
        }
      }
+   fC_EndClib(obj);
 
-   fD_dtor(tmpdef);
-
+   fC_Count(obj, myfile, 1);
    fF_dtor(myfile);
+   fC_Stop(obj, fdPHASE_CLIB, start);
 
-   if (strlen(fdfilename)>7 &&
-   !strcmp(fdfilename+strlen(fdfilename)-7, "_lib.fd"))
+   /* the directives and typedefs were timed on their own, within */
+
+   obj->stats.wall[fdPHASE_CLIB]-=obj->stats.wall[fdPHASE_HEADER]-header[0];
+   obj->stats.cpu[fdPHASE_CLIB]-=obj->stats.cpu[fdPHASE_HEADER]-header[1];
+
+   return 0;
+}
+
+/******************************************************************************
+ *    fC_Write
+ *
+ * writes the SFD file, including the ==include and ==typedef lines of the
+ * clib file. May be called any number of times after reading a pair.
+ ******************************************************************************/
+
+/* the comment naming the files and the == lines before the functions */
+
+static void
+fC_WriteHeader(fdConverter* obj, fdOut* out)
+{
+   fO_Puts(out, "* This SFD file was automatically generated by fd2sfd from\n");
+   fO_Lit(out, "* ");
+   fO_Puts(out, obj->fdfilename);
+   fO_Lit(out, " and\n* ");
+   fO_Puts(out, obj->clibfilename);
+   fO_Lit(out, ".\n");
+	   
+   if (obj->BaseName[0])
    {
-      char *str=fdfilename+strlen(fdfilename)-8;
-      while (str!=fdfilename && str[-1]!='/' && str[-1]!=':')
-	 str--;
-//lcs      strncpy(BaseNamL, str, strlen(str)-7);
-      strncpy(BaseNamU, str, strlen(str)-7);
-      BaseNamU[strlen(str)-7]='\0';
-      strcpy(BaseNamL, BaseNamU);
-      strcpy(BaseNamC, BaseNamU);
+      fO_Lit(out, "==base _");
+      fO_Puts(out, obj->BaseName);
+      fO_Lit(out, "\n==basetype struct ");
+      fO_Puts(out, obj->StdLib);
+      fO_Lit(out, " *\n");
    }
-   else
+
+   if (obj->BaseName[0])
    {
-      strcpy(BaseNamU, BaseName);
-      if (strlen(BaseNamU)>4 && strcmp(BaseNamU+strlen(BaseNamU)-4, "Base")==0)
-	 BaseNamU[strlen(BaseNamU)-4]='\0';
-      strcpy(BaseNamL, BaseNamU);
-      strcpy(BaseNamC, BaseNamU);
+      fO_Lit(out, "==libname ");
+      fO_Puts(out, strcmp(obj->BaseNamL, "cardres") == 0 ? "card"
+		    : obj->BaseNamL);
+      fO_Lit(out, ".");
+      fO_Puts(out, obj->type);
+      fO_Lit(out, "\n");
    }
-   StrUpr(BaseNamU);
-   BaseNamC[0]=toupper(BaseNamC[0]);
 
-   if (BaseName[0])
+   fO_Write(out, obj->header, obj->headerlen);
+
+   // We always need these (for basic types like ULONG and Tag)
+   if (!obj->got_exec_types)
+      fO_Puts(out, "==include <exec/types.h>\n");
+
+   if (!obj->got_utility_tagitem)
+      fO_Puts(out, "==include <utility/tagitem.h>\n");
+}
+
+int
+fC_Write(fdConverter* obj, FILE* outfile)
+{
+   fdOut out;
+   long count;
+   double start[2];
+
+   if (!obj || !outfile || !obj->fdfilename || !obj->clibfilename)
    {
-      unsigned int count2;
+      illparams(obj ? obj->errfile : NULL, "fC_Write");
+      return 1;
+   }
+   fC_Start(obj, start);
 
-      if (strlen(fdfilename)>6 &&
-	  !strcmp(fdfilename+strlen(fdfilename)-6, "_gc.fd"))
-	 type = GADGET;
-      else if (strlen(fdfilename)>6 &&
-	       !strcmp(fdfilename+strlen(fdfilename)-6, "_ic.fd"))
-	 type = IMAGE;
-      else if (strlen(fdfilename)>6 &&
-	       !strcmp(fdfilename+strlen(fdfilename)-6, "_cl.fd"))
-	 type = CLASS;
-      else
+   obj->bias=-1;
+   obj->priv=-1;
+
+   /* without a buffer, everything goes to outfile directly */
+   if (!obj->outbuf)
+      obj->outbuf=malloc(fO_BUFSIZE);
+   out.file=outfile;
+   out.buf=obj->outbuf;
+   out.len=0;
+
+   fC_WriteHeader(obj, &out);
+
+   for (count=0; count<obj->fds && obj->defs[count]; count++)
+   {
+      fdDef *def=obj->defs[count];
+      unsigned int protomask=def->protomask;
+      regs reg;
+
+      if (def->filtered)
+	 continue;
+
+      DBP(fprintf(stderr, "outputting %ld...\n", count));
+      if (obj->arrcmts[count])
       {
-	 for (count2=0; count2<sizeof TypeTable/sizeof TypeTable[0]; count2+=2)
-	 {
-	    if (strcmp(BaseName, TypeTable[count2])==0)
-	    {
-	       type=TypeTable[count2+1];
-	       break;
-	    }
-	 }
+	fO_Puts(&out, obj->arrcmts[count]);
       }
+
+      /* fD_write fills in missing prototypes; take them out again so the
+	 next fC_Write() sees (and reports) the same definitions */
+
+      fD_write(obj, &out, def, 0);
+
+      for (reg=d0; reg<illegal; reg++)
+	 if (!(protomask & 1u<<reg) && def->protomask & 1u<<reg)
+	    fD_SetProto(def, reg, fD_nostring);
    }
 
-   if (outfilename)
+   fO_Lit(&out, "==end\n");
+   fO_Flush(&out);
+   fC_Stop(obj, fdPHASE_WRITE, start);
+
+   return 0;
+}
+
+/******************************************************************************
+ *    fC_OpenStream, fC_WriteStream
+ *
+ * the other way to convert a pair, for fd files too big to hold: the clib
+ * file is read first, keeping just the text of its prototypes, and then
+ * every definition of the fd file is written as soon as it has been read,
+ * so there is never more than one in memory. The SFD file is the one
+ * fC_Write() writes, as long as ##base comes before the first definition.
+ * What is said about a definition is said when it is written, and the
+ * prototypes no definition took are reported at the end. Nothing is kept
+ * to be written again.
+ ******************************************************************************/
+
+/* keep the prototype in clibfile's line as the next span */
+
+static int
+fC_AddSpan(fdConverter* obj, fdFile* clibfile)
+{
+   size_t len=clibfile->linelen+1;
+   fdSpan *span;
+
+   if (obj->numspans==obj->maxspans)
    {
-      if (!(outfile=fopen(outfilename, "w")))
-      {
-	 fprintf(stderr, "Couldn't open output file.\n");
-	 rc = EXIT_FAILURE;
-	 goto quit;
-      }
-      else
+      long max=obj->maxspans ? 2*obj->maxspans : FDS;
+      fdSpan *spans=realloc(obj->spans, max*sizeof(fdSpan));
+
+      if (!spans)
       {
-	 closeoutfile=1;
+	 fprintf(obj->errfile, "No mem for FDs\n");
+	 return 1;
       }
+      obj->spans=spans;
+      obj->maxspans=max;
    }
-   else
-      outfile=stdout;
 
-   fprintf(outfile, "* This SFD file was automatically generated by fd2sfd from\n");
-   fprintf(outfile, "* %s and\n", fdfilename);
-   fprintf(outfile, "* %s.\n", clibfilename);
-	   
-   if (BaseName[0])
+   if (obj->poollen+len>obj->poolsize)
    {
-      fprintf(outfile, "==base _%s\n", BaseName);
-      fprintf(outfile, "==basetype struct %s *\n", StdLib);
-   }
+      size_t size=obj->poolsize ? 2*obj->poolsize : fA_CHUNKSIZE;
+      char *pool;
 
-   if (BaseName[0])
-   {
-      fprintf(outfile, "==libname %s.%s\n",
-	      strcmp(BaseNamL, "cardres") == 0 ? "card" : BaseNamL, type);
+      while (size<obj->poollen+len)
+	 size*=2;
+      if (!(pool=realloc(obj->pool, size)))
+      {
+	 fprintf(obj->errfile, "No mem for FDs\n");
+	 return 1;
+      }
+      obj->pool=pool;
+      obj->poolsize=size;
    }
 
-   clib = fopen( clibfilename, "r" );
+   span=obj->spans+obj->numspans++;
+   span->text=obj->poollen;
+   span->len=clibfile->linelen;
+   span->name=clibfile->proto.name;
+   span->namelen=clibfile->proto.namelen;
+   span->lineno=fF_LineNo(clibfile);
+   span->next=-1;
+   span->used=span->partner=0;
+   memcpy(obj->pool+obj->poollen, clibfile->line, len);
+   obj->poollen+=len;
+   return 0;
+}
 
-   if (clib == NULL)
-   {
-      fprintf(stderr, "Couldn't open file '%s'.\n", clibfilename);
-   }
-   else
+/* hashes the spans by name like fC_Index() does the definitions; the
+   spans of one name are chained in clib order */
+
+static int
+fC_IndexSpans(fdConverter* obj)
+{
+   unsigned long size, mask, slot;
+   long count;
+
+   for (size=16; size<2*(unsigned long) obj->numspans; size*=2);
+
+   if (size>obj->spanindexsize)
    {
-      char* buffer = malloc(1024);
+      long *index=realloc(obj->spanindex, size*sizeof(long));
 
-      if (buffer == NULL)
+      if (!index)
       {
-	 fprintf(stderr, "No memory for line buffer.\n " );
+	 fprintf(obj->errfile, "No mem for FDs\n");
+	 return 1;
       }
-      else
+      obj->spanindex=index;
+      obj->spanindexsize=size;
+   }
+   for (slot=0; slot<obj->spanindexsize; slot++)
+      obj->spanindex[slot]=-1;
+   mask=obj->spanindexsize-1;
+
+   for (count=0; count<obj->numspans; count++)
+   {
+      const fdSpan *span=obj->spans+count;
+      const char *name=obj->pool+span->text+span->name;
+
+      for (slot=fC_Hash(2166136261UL, name, span->namelen) & mask;
+	   obj->spanindex[slot]>=0; slot=(slot+1) & mask)
       {
-	 int got_exec_types = 0;
-	 int got_utility_tagitem = 0;
-	 
-	 while (fgets(buffer, 1023, clib) != NULL)
+	 fdSpan *first=obj->spans+obj->spanindex[slot];
+
+	 if (first->namelen==span->namelen &&
+	     memcmp(obj->pool+first->text+first->name, name,
+		    span->namelen)==0)
 	 {
-	    int i = 0;
+	    while (first->next>=0)
+	       first=obj->spans+first->next;
+	    first->next=count;
+	    break;
+	 }
+      }
+      if (obj->spanindex[slot]<0)
+	 obj->spanindex[slot]=count;
+   }
+   return 0;
+}
 
-	    while (buffer[i] == ' ' || buffer[i] == '\t') ++i;
+/* the first span named name[0..len-1] followed by suffix, or -1 */
 
-	    if( buffer[ i ] == '#') /* Pre-processor instruction */ 
-	    {
-	       ++i;
+static long
+fC_FindSpan(const fdConverter* obj, const char* name, size_t len,
+	    const char* suffix)
+{
+   size_t suffixlen=strlen(suffix);
+   unsigned long mask=obj->spanindexsize-1, slot;
+   long at;
 
-	       while (buffer[i] == ' ' || buffer[i] == '\t') ++i;
+   if (!obj->numspans)
+      return -1;
 
-	       if (strncmp(buffer+i, "include",7) == 0)
-	       {
-		  char  start = 0;
-		  char  end   = 0;
-		  char* inc;
+   for (slot=fC_Hash(fC_Hash(2166136261UL, name, len), suffix, suffixlen)
+	& mask; (at=obj->spanindex[slot])>=0; slot=(slot+1) & mask)
+   {
+      const fdSpan *span=obj->spans+at;
+      const char *spanname=obj->pool+span->text+span->name;
 
-		  i += 7;
+      if (span->namelen==len+suffixlen && memcmp(spanname, name, len)==0 &&
+	  memcmp(spanname+len, suffix, suffixlen)==0)
+	 return at;
+   }
+   return -1;
+}
 
- 		  while (buffer[i] == ' ' || buffer[i] == '\t') ++i;
+static void
+fC_Partner(fdConverter* obj, const char* name, size_t len,
+	   const char* suffix)
+{
+   long at;
 
-		  start = buffer[i];
-		  
-		  if (start== '"' )
-		     end = '"';
-		  else if (start == '<')
-		     end = '>';
-		  else
-		  {
-		     fprintf(stderr, "Bad #include line\n");
-		  }
+   for (at=fC_FindSpan(obj, name, len, suffix); at>=0;
+	at=obj->spans[at].next)
+      obj->spans[at].partner=1;
+}
 
-		  ++i;
+/* parses the prototypes of def's name into it, if no definition took them
+   before, and notes the varargs prototypes def makes known */
 
-		  inc = buffer+i;
+static void
+fC_Take(fdConverter* obj, fdDef* def)
+{
+   const char *name=fD_GetName(def);
+   size_t len=strlen(name);
+   long at;
 
-		  while (buffer[i] != end && buffer[i] != 0) ++i;
-		  buffer[i] = 0;
+   /* the definitions varargsfunction() would look for */
 
-		  if (strncmp(inc, "proto/", 6) &&
-		      strncmp(inc, "pragma/", 7) &&
-		      strncmp(inc, "ppcinline/", 10) &&
-                      strncmp(inc, "ppcpragma/", 10) &&
-		      strncmp(inc, "ppcproto/", 9) &&
-		      strncmp(inc, "inline/", 7) &&
-		      strncmp(inc, "stormprotos/", 12) )
-		  {
-		    fprintf(outfile, "==include %c%s%c\n", start, inc, end );
-		  }
+   fC_Partner(obj, name, len, "Tags");
+   if (len>7 && strcmp(name+len-7, "TagList")==0)
+      fC_Partner(obj, name, len-7, "Tags");
+   if (len>1 && name[len-1]=='A' &&
+       !(len>5 && strncmp(name+len-5, "Tags", 4)==0))
+      fC_Partner(obj, name, len-1, "");
 
-		  if (!strcmp(inc,"exec/types.h"))
-		    got_exec_types = 1;
-		  else if (!strcmp(inc,"utility/tagitem.h"))
-		    got_utility_tagitem = 1;
-	       }
-	    }
-	    else if (!strncmp(buffer+i,"typedef",7))
-	    {
-	       char* td;
+   if ((at=fC_FindSpan(obj, name, len, ""))<0 || obj->spans[at].used)
+      return;
+
+   for (; at>=0; at=obj->spans[at].next)
+   {
+      const fdSpan *span=obj->spans+at;
+
+      obj->spans[at].used=1;
+      if (!def->filtered && /* no need to parse what isn't written */
+	  !fF_SetLine(obj->clibfile, obj->pool+span->text, span->len,
+		      span->lineno) &&
+	  fF_Proto(obj->clibfile))
+	 fD_parsepr(def, obj->clibfile);
+   }
+}
 
-	       i += 7;
-		 
-	       while (buffer[i] == ' ' || buffer[i] == '\t') ++i;
+int
+fC_OpenStream(fdConverter* obj, const char* fdfilename,
+	      const char* clibfilename)
+{
+   fdFile *myfile;
+   double start[2], header[2];
 
-	       td = buffer+i;
-	       
-	       while (buffer[i] != ';' && buffer[i] != 0) ++i;
-	       buffer[i] = 0;
+   if (!obj || !fdfilename || !clibfilename || obj->fdfile)
+   {
+      illparams(obj ? obj->errfile : NULL, "fC_OpenStream");
+      return 1;
+   }
+   fC_Start(obj, start);
+   header[0]=obj->stats.wall[fdPHASE_HEADER];
+   header[1]=obj->stats.cpu[fdPHASE_HEADER];
 
-	       fprintf(outfile, "* Unofficial extension on next line\n");
-	       fprintf(outfile, "==typedef %s\n", td);
-	    }
-	 }
+   if (!(obj->fdfilename=fC_CopyName(fdfilename)) ||
+       !(obj->clibfilename=fC_CopyName(clibfilename)))
+   {
+      fprintf(obj->errfile, "No mem for FDs\n");
+      return 1;
+   }
 
-	 // We always need these (for basic types like ULONG and Tag)
-	 if (!got_exec_types)
-	   fprintf(outfile, "==include <exec/types.h>\n");
+   if (!(obj->fdfile=fF_ctor(fdfilename, obj->scan, obj->errfile)))
+   {
+      fprintf(obj->errfile, "Couldn't open file '%s'.\n", fdfilename);
+      return 1;
+   }
 
-	 if (!got_utility_tagitem)
-	   fprintf(outfile, "==include <utility/tagitem.h>\n");
-	 
-	 free(buffer);
-      }
-      
-      fclose(clib);
+   if (!(myfile=fF_ctor(clibfilename, obj->scan, obj->errfile)))
+   {
+      fprintf(obj->errfile, "Couldn't open file '%s'.\n", clibfilename);
+      return 1;
    }
+   obj->clibfile=myfile;
+   myfile->clib=obj;
 
-   for (count=0; count<fds && defs[count]; count++)
+   while (fF_readln(myfile)==false)
    {
-      DBP(fprintf(stderr, "outputting %ld...\n", count));
-      if (arrcmts[count])
+      fF_SetError(myfile, false);
+      if (fF_Proto(myfile) && fC_AddSpan(obj, myfile))
+	 return 1;
+   }
+   myfile->clib=NULL;
+   fC_EndClib(obj);
+   fC_Count(obj, myfile, 1);
+   fC_Stop(obj, fdPHASE_CLIB, start);
+   obj->stats.wall[fdPHASE_CLIB]-=obj->stats.wall[fdPHASE_HEADER]-header[0];
+   obj->stats.cpu[fdPHASE_CLIB]-=obj->stats.cpu[fdPHASE_HEADER]-header[1];
+
+   if (fC_IndexSpans(obj))
+      return 1;
+   fC_Stop(obj, fdPHASE_INDEX, start);
+   return 0;
+}
+
+int
+fC_WriteStream(fdConverter* obj, FILE* outfile)
+{
+   fdOut out;
+   fdDef def;	   /* the definition being written */
+   char *comment;  /* ... and the comments before it */
+   int header=0;
+   long at;
+   double start[2];
+   Error lerror;
+
+   if (!obj || !outfile || !obj->fdfile || !obj->clibfile)
+   {
+      illparams(obj ? obj->errfile : NULL, "fC_WriteStream");
+      return 1;
+   }
+   fC_Start(obj, start);
+
+   obj->bias=-1;
+   obj->priv=-1;
+
+   if (!obj->outbuf)
+      obj->outbuf=malloc(fO_BUFSIZE);
+   out.file=outfile;
+   out.buf=obj->outbuf;
+   out.len=0;
+
+   fD_Init(&def, &obj->arena);
+   comment=NULL;
+
+   for (;;)
+   {
+      do
       {
-	fprintf(outfile, "%s", arrcmts[count]);
+	 if ((lerror=fF_readln(obj->fdfile))==false)
+	 {
+	    fF_SetError(obj->fdfile, false);
+	    lerror=fD_parsefd(&def, &comment, obj->fdfile);
+	 }
       }
-      fD_write(outfile, defs[count], 0);
-   }
+      while (lerror==nodef);
+
+      if (lerror!=false)
+	 break;
+
+      def.filtered=!fG_Match(obj->filter, fD_GetName(&def));
+      fC_Take(obj, &def);
+      obj->stats.defs++;
+
+      if (!def.filtered)
+      {
+	 if (!header)
+	 {
+	    fC_Names(obj, obj->fdfile->basename);
+	    fC_WriteHeader(obj, &out);
+	    header=1;
+	 }
+	 if (comment)
+	    fO_Puts(&out, comment);
+	 fD_write(obj, &out, &def, 0);
+      }
+
+      /* all the definition had is in the arena */
 
-   fprintf(outfile, "==end\n");
+      free(comment);
+      comment=NULL;
+      fA_Reset(&obj->arena);
+      fD_Init(&def, &obj->arena);
+   }
+   free(comment);
 
-   rc = EXIT_SUCCESS;
-  quit:
-   for (count=0; count<FDS && arrdefs[count]; count++)
-      fD_dtor(arrdefs[count]);
-   for (count=0; count<FDS && arrcmts[count]; count++)
-      free(arrcmts[count]);
+   if (!header)
+   {
+      fC_Names(obj, obj->fdfile->basename);
+      fC_WriteHeader(obj, &out);
+   }
+   fO_Lit(&out, "==end\n");
+   fO_Flush(&out);
 
-   free(defs);
-   free(arrdefs);
-   free(arrcmts);
+   for (at=0; at<obj->numspans; at++)
+      if (obj->spans[at].used)
+	 obj->stats.hits++;
+      else
+	 obj->stats.misses++;
 
-   if (closeoutfile)
+   for (at=0; at<obj->numspans && !obj->quiet; at++)
    {
-      fclose(outfile);
+      const fdSpan *span=obj->spans+at;
+      const char *text=obj->pool+span->text;
+      char *name;
+
+      if (span->used)
+	 continue;
+      if (!(name=malloc(span->namelen+1)))
+      {
+	 fprintf(obj->errfile, "No mem for fF_Proto\n");
+	 continue;
+      }
+      memcpy(name, text+span->name, span->namelen);
+      name[span->namelen]='\0';
+      if (!(isvarargs(text) && (span->partner ||
+				fT_Lookup(&TagExcNames, name, span->namelen)))
+	  && !specialfunction(name))
+	 fprintf(obj->errfile, "Don't know what to do with <%s> in line %lu.\n",
+		 name, span->lineno);
+      free(name);
    }
 
-   return rc;
+   fC_Count(obj, obj->fdfile, 0);
+   fF_dtor(obj->fdfile);
+   fF_dtor(obj->clibfile);
+   obj->fdfile=obj->clibfile=NULL;
+   fC_Stop(obj, fdPHASE_WRITE, start);
+   return 0;
 }
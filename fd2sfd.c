@@ -0,0 +1,1455 @@
+/******************************************************************************
+ *
+ * fd2sfd -- forked from fd2inline 1.38
+ *
+ * The command line front end of libfd2sfd. See fd2inline.c for the actual
+ * conversion code.
+ *
+ * fd2sfd by Martin Blom.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#include "cache.h"
+#include "fd2sfd.h"
+#include "server.h"
+
+static const char version_str[]="$VER: fd2sfd " VERSION " (" DATE ")\r\n";
+
+static int	     Quiet = 0;
+static const char*   CacheDir = NULL;	   /* --cache or $FD2SFD_CACHE	 */
+static unsigned long CacheSize = 256;	   /* --cache-size, in MiB	 */
+static int	     DepMode = 0;	   /* -MD			 */
+static int	     DepPhony = 0;	   /* -MP			 */
+static const char*   DepFile = NULL;	   /* -MF			 */
+static const char*   DepTarget = NULL;	   /* -MT			 */
+static fdFilter*     Filter = NULL;	   /* --only and --exclude	 */
+static char*	     FilterText = NULL;	   /* ... as "+glob\n-glob\n"	 */
+static size_t	     FilterLen = 0;
+static int	     Stream = 0;	   /* --stream			 */
+static fdMacros*     Macros = NULL;	   /* -D and -U			 */
+static char*	     MacroText = NULL;	   /* ... as "Dname=value\nUname\n" */
+static size_t	     MacroLen = 0;
+static int	     Stats = 0;		   /* --stats, 2 for --stats=json */
+static fdStats	     Totals;		   /* ... of all converters	 */
+static int	     AllocProfile = 0;	   /* --alloc-profile, 2 for =json */
+
+void
+printusage(const char* exename)
+{
+   fprintf(stderr,
+      "Usage: %s [options] fd-file clib-file [[-o] output-file]\n"
+      "       %s [options] --batch manifest-file\n"
+      "       %s --server socket\n"
+      "Options:\n"
+
+      "--alloc-profile\t\tReport the allocations made, and where, to\n"
+      "\t\t\tstderr when done\n"
+      "--alloc-profile=json\t... as a JSON object\n"
+      "--batch file\t\tConvert every 'fd-file clib-file output-file' line\n"
+      "\t\t\tof file ('-' for stdin) in one go; the names are\n"
+      "\t\t\tseparated by tabs only if a line has one\n"
+      "-j jobs\t\t\tUse this many threads for --batch\n"
+      "--cache dir\t\tKeep converted files in dir and reuse them\n"
+      "--cache-size mib\tLimit the size of the cache (default 256)\n"
+      "--client socket\t\tLet the fd2sfd --server on socket do the work;\n"
+      "\t\t\tnot with the cache or -MD\n"
+      "--only glob\t\tOnly write the functions matching glob; may be\n"
+      "\t\t\tgiven more than once\n"
+      "--exclude glob\t\tDon't write the functions matching glob\n"
+      "--only-from file\tRead --only globs from file, one per line\n"
+      "--exclude-from file\tRead --exclude globs from file, one per line\n"
+      "--quiet\t\t\tDon't display warnings\n"
+      "--stats\t\t\tReport times and counts to stderr when done\n"
+      "--stats=json\t\t... as a JSON object\n"
+      "--stream\t\tWrite each function as soon as it is read, for fd\n"
+      "\t\t\tfiles too big to hold; not with the cache\n"
+      "--version\t\tPrint version number and exit\n"
+      "-D name[=value]\t\tDefine name for the #ifs of the clib file\n"
+      "-U name\t\t\tTake name as not defined\n"
+      "-MD\t\t\tWrite the files the output depends on to a make\n"
+      "\t\t\tdependency file (output-file with .d instead of\n"
+      "\t\t\tits suffix, unless given with -MF file)\n"
+      "-MT target\t\tUse target instead of the output file in it\n"
+      "-MP\t\t\tAdd a phony target for each input file\n\n"
+	   , exename, exename, exename);
+}
+
+/******************************************************************************
+ *    addglob, readglobs
+ *
+ * collect the --only and --exclude globs in Filter, and in FilterText for
+ * the cache key and the server. A glob file has one glob per line; blank
+ * lines and lines starting with '#' are ignored.
+ ******************************************************************************/
+
+#define GLOB_LINESIZE 4096
+
+static int
+addglob(const char* glob, int exclude)
+{
+   size_t len=strlen(glob);
+   char *text;
+
+   if (strchr(glob, '\n'))
+   {
+      fprintf(stderr, "A glob can't contain a newline.\n");
+      return 1;
+   }
+
+   if ((!Filter && !(Filter=fG_ctor())) || fG_Add(Filter, glob, exclude) ||
+       !(text=realloc(FilterText, FilterLen+len+3)))
+   {
+      fprintf(stderr, "No mem for FDs\n");
+      return 1;
+   }
+   text[FilterLen]=exclude ? '-' : '+';
+   memcpy(text+FilterLen+1, glob, len);
+   strcpy(text+FilterLen+1+len, "\n");
+   FilterText=text;
+   FilterLen+=len+2;
+   return 0;
+}
+
+/* -D and -U, kept in Macros, and in MacroText for the cache key */
+
+static int
+addmacro(const char* macro, int undef)
+{
+   size_t len=strlen(macro);
+   char *text;
+
+   if (!*macro || strchr(macro, '\n'))
+   {
+      fprintf(stderr, "Bad macro '%s'.\n", macro);
+      return 1;
+   }
+
+   if ((!Macros && !(Macros=fM_ctor())) ||
+       (undef ? fM_Undef(Macros, macro) : fM_Define(Macros, macro)) ||
+       !(text=realloc(MacroText, MacroLen+len+3)))
+   {
+      fprintf(stderr, "No mem for FDs\n");
+      return 1;
+   }
+   text[MacroLen]=undef ? 'U' : 'D';
+   memcpy(text+MacroLen+1, macro, len);
+   strcpy(text+MacroLen+1+len, "\n");
+   MacroText=text;
+   MacroLen+=len+2;
+   return 0;
+}
+
+static int
+readglobs(const char* filename, int exclude)
+{
+   FILE *file;
+   char  line[GLOB_LINESIZE];
+   unsigned long lineno=0;
+   int   failed=0;
+
+   if (!(file=fopen(filename, "r")))
+   {
+      fprintf(stderr, "Couldn't open file '%s'.\n", filename);
+      return 1;
+   }
+
+   while (!failed && fgets(line, GLOB_LINESIZE, file))
+   {
+      char *glob=line+strspn(line, " \t"), *end=glob+strlen(glob);
+
+      lineno++;
+
+      if (!strchr(line, '\n') && !feof(file))
+      {
+	 fprintf(stderr, "Line %lu too long.\n", lineno);
+	 failed=1;
+	 break;
+      }
+
+      while (end>glob && strchr(" \t\r\n", end[-1]))
+	 *--end='\0';
+      if (*glob && *glob!='#')
+	 failed=addglob(glob, exclude);
+   }
+
+   if (!failed && ferror(file))
+   {
+      fprintf(stderr, "Couldn't read file '%s'.\n", filename);
+      failed=1;
+   }
+   fclose(file);
+   return failed;
+}
+
+/******************************************************************************
+ *    addstats, printstats, printallocs
+ *
+ * --stats adds up the fdStats of every converter in Totals and reports
+ * them at the end, with the throughput, the peak RSS and the time it all
+ * took. With -j, the phase times are summed over the threads. A pair
+ * found in the cache isn't converted, so it adds nothing.
+ *
+ * --alloc-profile reports the library's allocations, once everything has
+ * been freed, so that what is still live at the end is a leak.
+ ******************************************************************************/
+
+static const char *const phasenames[fdPHASES]=
+{
+   "fd", "index", "clib", "header", "write"
+};
+
+static void
+addstats(const fdConverter* conv)
+{
+   fdStats stats;
+   int phase;
+
+   fC_GetStats(conv, &stats);
+   for (phase=0; phase<fdPHASES; phase++)
+   {
+      Totals.wall[phase]+=stats.wall[phase];
+      Totals.cpu[phase]+=stats.cpu[phase];
+   }
+   Totals.fdlines+=stats.fdlines;
+   Totals.fdbytes+=stats.fdbytes;
+   Totals.cliblines+=stats.cliblines;
+   Totals.clibbytes+=stats.clibbytes;
+   Totals.defs+=stats.defs;
+   Totals.hits+=stats.hits;
+   Totals.misses+=stats.misses;
+}
+
+static double
+elapsed(void)
+{
+   struct timeval tv;
+
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec+tv.tv_usec/1e6;
+}
+
+static double
+persecond(unsigned long count, double seconds)
+{
+   return seconds>0 ? count/seconds : 0.0;
+}
+
+static void
+printstats(double wall)
+{
+   double cpu=0.0, fdtime, clibtime;
+   long peakrss=-1; /* KiB, or -1 if unknown */
+   int phase;
+
+#ifdef HAVE_SYS_RESOURCE_H
+   struct rusage usage;
+
+   if (getrusage(RUSAGE_SELF, &usage)==0)
+   {
+      cpu=usage.ru_utime.tv_sec+usage.ru_utime.tv_usec/1e6+
+	  usage.ru_stime.tv_sec+usage.ru_stime.tv_usec/1e6;
+#ifdef __APPLE__
+      peakrss=usage.ru_maxrss/1024; /* bytes there */
+#else
+      peakrss=usage.ru_maxrss;
+#endif
+   }
+#endif
+
+   /* a streamed fd file is read while writing */
+
+   fdtime=Totals.wall[fdPHASE_FD]+(Stream ? Totals.wall[fdPHASE_WRITE] : 0);
+   clibtime=Totals.wall[fdPHASE_CLIB]+Totals.wall[fdPHASE_HEADER];
+
+   if (Stats==2)
+   {
+      fprintf(stderr, "{\"phases\":{");
+      for (phase=0; phase<fdPHASES; phase++)
+	 fprintf(stderr, "%s\"%s\":{\"wall\":%.6f,\"cpu\":%.6f}",
+		 phase ? "," : "", phasenames[phase], Totals.wall[phase],
+		 Totals.cpu[phase]);
+      fprintf(stderr, "},\"fd\":{\"lines\":%lu,\"bytes\":%lu,"
+	      "\"lines_per_sec\":%.0f,\"bytes_per_sec\":%.0f},",
+	      Totals.fdlines, Totals.fdbytes,
+	      persecond(Totals.fdlines, fdtime),
+	      persecond(Totals.fdbytes, fdtime));
+      fprintf(stderr, "\"clib\":{\"lines\":%lu,\"bytes\":%lu,"
+	      "\"lines_per_sec\":%.0f,\"bytes_per_sec\":%.0f},",
+	      Totals.cliblines, Totals.clibbytes,
+	      persecond(Totals.cliblines, clibtime),
+	      persecond(Totals.clibbytes, clibtime));
+      fprintf(stderr, "\"defs\":%lu,\"hits\":%lu,\"misses\":%lu,"
+	      "\"wall\":%.6f,\"cpu\":%.6f,\"peak_rss_kib\":%ld}\n",
+	      Totals.defs, Totals.hits, Totals.misses, wall, cpu, peakrss);
+      return;
+   }
+
+   fprintf(stderr, "phase        wall ms     cpu ms\n");
+   for (phase=0; phase<fdPHASES; phase++)
+      fprintf(stderr, "%-8s %10.3f %10.3f\n", phasenames[phase],
+	      Totals.wall[phase]*1e3, Totals.cpu[phase]*1e3);
+   fprintf(stderr, "%-8s %10.3f %10.3f\n", "total", wall*1e3, cpu*1e3);
+   fprintf(stderr, "fd:   %lu lines, %lu bytes, %.0f lines/s, %.0f bytes/s\n",
+	   Totals.fdlines, Totals.fdbytes, persecond(Totals.fdlines, fdtime),
+	   persecond(Totals.fdbytes, fdtime));
+   fprintf(stderr, "clib: %lu lines, %lu bytes, %.0f lines/s, %.0f bytes/s\n",
+	   Totals.cliblines, Totals.clibbytes,
+	   persecond(Totals.cliblines, clibtime),
+	   persecond(Totals.clibbytes, clibtime));
+   fprintf(stderr, "%lu definitions, %lu prototypes found, %lu not\n",
+	   Totals.defs, Totals.hits, Totals.misses);
+   if (peakrss>=0)
+      fprintf(stderr, "peak RSS %ld KiB\n", peakrss);
+}
+
+static int
+cmpsitebytes(const void* a, const void* b) /* for qsort, most bytes first */
+{
+   const fdAllocSite *sa=a, *sb=b;
+
+   if (sa->bytes!=sb->bytes)
+      return sa->bytes>sb->bytes ? -1 : 1;
+   return sa->line<sb->line ? -1 : sa->line>sb->line;
+}
+
+static void
+printallocs(void)
+{
+   fdAllocStats stats;
+   fdAllocSite *sites;
+   long num, count;
+
+   fP_GetStats(&stats);
+   if (!(sites=malloc((stats.sites ? stats.sites : 1)*sizeof(fdAllocSite))))
+   {
+      fprintf(stderr, "No mem for the allocation profile\n");
+      return;
+   }
+   num=fP_GetSites(sites, stats.sites);
+   qsort(sites, num, sizeof(fdAllocSite), cmpsitebytes);
+
+   if (AllocProfile==2)
+   {
+      fprintf(stderr, "{\"allocs\":%lu,\"frees\":%lu,\"bytes\":%lu,"
+	      "\"peak\":%lu,\"live\":%lu,\"sites\":[", stats.allocs,
+	      stats.frees, stats.bytes, stats.peak, stats.live);
+      for (count=0; count<num; count++)
+	 fprintf(stderr, "%s{\"function\":\"%s\",\"line\":%d,"
+		 "\"allocs\":%lu,\"bytes\":%lu}", count ? "," : "",
+		 sites[count].function, sites[count].line,
+		 sites[count].allocs, sites[count].bytes);
+      fprintf(stderr, "]}\n");
+   }
+   else
+   {
+      fprintf(stderr, "%lu allocations, %lu bytes, %lu frees, peak %lu bytes "
+	      "live, %lu still live\n", stats.allocs, stats.bytes,
+	      stats.frees, stats.peak, stats.live);
+      fprintf(stderr, "%-30s %10s %14s\n", "site", "allocs", "bytes");
+      for (count=0; count<num; count++)
+	 fprintf(stderr, "%-24s %5d %10lu %14lu\n", sites[count].function,
+		 sites[count].line, sites[count].allocs, sites[count].bytes);
+   }
+   free(sites);
+}
+
+/******************************************************************************
+ *    convert
+ *
+ * converts one FD/clib pair into outfilename (stdoutfile if NULL or "-") and
+ * leaves conv ready for the next pair. All diagnostics go to errfile.
+ ******************************************************************************/
+
+static int
+openoutput(const char* outfilename, FILE* stdoutfile, FILE* errfile,
+	   FILE** outfile)
+{
+   if (!outfilename)
+      *outfile=stdoutfile;
+   else if (!(*outfile=fopen(outfilename, "w")))
+   {
+      fprintf(errfile, "Couldn't open output file.\n");
+      return 1;
+   }
+   return 0;
+}
+
+static int
+closeoutput(FILE* outfile, FILE* stdoutfile, FILE* errfile)
+{
+   if (outfile!=stdoutfile && fclose(outfile))
+   {
+      fprintf(errfile, "Couldn't write output file.\n");
+      return 1;
+   }
+   return 0;
+}
+
+/* the same, going through the cache; key identifies the pair */
+
+static int
+cachedconvert(fdConverter* conv, const char* fdfilename,
+	      const char* clibfilename, const char* outfilename,
+	      FILE* stdoutfile, FILE* errfile, const char* key)
+{
+   FILE  *outfile, *readerrfile, *writeerrfile, *outmem;
+   char  *readerr=NULL, *writeerr=NULL, *out=NULL;
+   size_t readerrlen=0, writeerrlen=0, outlen=0;
+   cDiag  diag;
+   int	  cachefd, rc = EXIT_FAILURE;
+
+   if ((cachefd=cachelookup(CacheDir, key, &diag))>=0)
+   {
+      fwrite(diag.text, 1, diag.readlen, errfile);
+
+      if (!openoutput(outfilename, stdoutfile, errfile, &outfile))
+      {
+	 fwrite(diag.text+diag.readlen, 1, diag.len-diag.readlen, errfile);
+	 if (cachecopy(cachefd, outfile)==0)
+	    rc = EXIT_SUCCESS;
+	 if (closeoutput(outfile, stdoutfile, errfile))
+	    rc = EXIT_FAILURE;
+      }
+
+      free(diag.text);
+      close(cachefd);
+      return rc;
+   }
+
+   /* A miss. Convert into memory, keeping the diagnostics of reading and
+      writing apart, just like the cache does. */
+
+   readerrfile=open_memstream(&readerr, &readerrlen);
+   writeerrfile=open_memstream(&writeerr, &writeerrlen);
+   outmem=open_memstream(&out, &outlen);
+
+   if (!readerrfile || !writeerrfile || !outmem)
+      fprintf(errfile, "No mem for FDs\n");
+   else
+   {
+      int readrc, writerc=1;
+
+      fC_SetErrorFile(conv, readerrfile);
+      readrc=fC_ReadFD(conv, fdfilename) || fC_ReadClib(conv, clibfilename);
+      if (!readrc)
+      {
+	 fC_SetErrorFile(conv, writeerrfile);
+	 writerc=fC_Write(conv, outmem);
+      }
+      fC_SetErrorFile(conv, errfile);
+      fC_Reset(conv);
+
+      fclose(readerrfile);
+      fclose(writeerrfile);
+      fclose(outmem);
+      readerrfile=writeerrfile=outmem=NULL;
+
+      fwrite(readerr, 1, readerrlen, errfile);
+
+      if (!readrc && !writerc)
+      {
+	 if ((diag.text=malloc(readerrlen+writeerrlen+1)))
+	 {
+	    memcpy(diag.text, readerr, readerrlen);
+	    memcpy(diag.text+readerrlen, writeerr, writeerrlen);
+	    diag.readlen=readerrlen;
+	    diag.len=readerrlen+writeerrlen;
+	    cachestore(CacheDir, key, CacheSize*1024*1024, out, outlen, &diag);
+	    free(diag.text);
+	 }
+      }
+
+      if (!readrc && !openoutput(outfilename, stdoutfile, errfile, &outfile))
+      {
+	 fwrite(writeerr, 1, writeerrlen, errfile);
+	 fwrite(out, 1, outlen, outfile);
+	 if (!writerc)
+	    rc = EXIT_SUCCESS;
+	 if (closeoutput(outfile, stdoutfile, errfile))
+	    rc = EXIT_FAILURE;
+      }
+   }
+
+   if (readerrfile)
+      fclose(readerrfile);
+   if (writeerrfile)
+      fclose(writeerrfile);
+   if (outmem)
+      fclose(outmem);
+   free(readerr);
+   free(writeerr);
+   free(out);
+
+   return rc;
+}
+
+/******************************************************************************
+ *    writedepends
+ *
+ * writes a make rule saying that target depends on the fd and the clib
+ * file, escaped the way gcc does it.
+ ******************************************************************************/
+
+static void
+writedependname(FILE* depfile, const char* name)
+{
+   const char *ptr;
+
+   for (ptr=name; *ptr; ptr++)
+   {
+      switch (*ptr)
+      {
+	 case ' ':
+	 case '\t':
+	 {
+	    const char *back;
+
+	    /* Backslashes before a blank must be doubled, too */
+	    for (back=ptr-1; back>=name && *back=='\\'; back--)
+	       fputc('\\', depfile);
+	    fputc('\\', depfile);
+	    break;
+	 }
+
+	 case '$':
+	    fputc('$', depfile);
+	    break;
+
+	 case '#':
+	    fputc('\\', depfile);
+	    break;
+      }
+      fputc(*ptr, depfile);
+   }
+}
+
+static int
+writedepends(const char* depfilename, const char* target,
+	     const char* fdfilename, const char* clibfilename,
+	     FILE* errfile)
+{
+   FILE *depfile;
+
+   if (!(depfile=fopen(depfilename, "w")))
+   {
+      fprintf(errfile, "Couldn't open dependency file '%s'.\n", depfilename);
+      return 1;
+   }
+
+   writedependname(depfile, target);
+   fputs(":", depfile);
+   fputs(" ", depfile);
+   writedependname(depfile, fdfilename);
+   fputs(" \\\n ", depfile);
+   writedependname(depfile, clibfilename);
+   fputs("\n", depfile);
+
+   if (DepPhony)
+   {
+      fputs("\n", depfile);
+      writedependname(depfile, fdfilename);
+      fputs(":\n\n", depfile);
+      writedependname(depfile, clibfilename);
+      fputs(":\n", depfile);
+   }
+
+   if (fclose(depfile))
+   {
+      fprintf(errfile, "Couldn't write dependency file '%s'.\n",
+	      depfilename);
+      return 1;
+   }
+   return 0;
+}
+
+/* like gcc: the output file with its suffix replaced by .d */
+
+static char*
+dependname(const char* outfilename)
+{
+   const char *dot=strrchr(outfilename, '.'), *slash=strrchr(outfilename, '/');
+   size_t len;
+   char *name;
+
+   if (!dot || (slash && dot<slash))
+      dot=outfilename+strlen(outfilename);
+   len=dot-outfilename;
+
+   if ((name=malloc(len+3)))
+   {
+      memcpy(name, outfilename, len);
+      strcpy(name+len, ".d");
+   }
+   return name;
+}
+
+static int
+convert(fdConverter* conv, const char* fdfilename, const char* clibfilename,
+	const char* outfilename, FILE* stdoutfile, FILE* errfile)
+{
+   FILE *outfile;
+   int   rc = EXIT_FAILURE;
+   char  key[CACHE_KEYSIZE];
+
+   if (outfilename && strcmp(outfilename, "-")==0)
+      outfilename=NULL;
+
+   if (CacheDir && !Stream && cachekey(fdfilename, clibfilename, Quiet,
+			    FilterText ? FilterText : "",
+			    MacroText ? MacroText : "", key)==0)
+   {
+      rc = cachedconvert(conv, fdfilename, clibfilename, outfilename,
+			 stdoutfile, errfile, key);
+      goto depends;
+   }
+
+   fC_SetErrorFile(conv, errfile);
+
+   if (Stream ? fC_OpenStream(conv, fdfilename, clibfilename)
+	      : fC_ReadFD(conv, fdfilename) || fC_ReadClib(conv, clibfilename))
+   {
+      rc = EXIT_FAILURE;
+      goto quit;
+   }
+
+   if (openoutput(outfilename, stdoutfile, errfile, &outfile))
+   {
+      rc = EXIT_FAILURE;
+      goto quit;
+   }
+
+   if ((Stream ? fC_WriteStream(conv, outfile) : fC_Write(conv, outfile))==0)
+      rc = EXIT_SUCCESS;
+
+   if (closeoutput(outfile, stdoutfile, errfile))
+      rc = EXIT_FAILURE;
+
+  quit:
+   fC_Reset(conv);
+
+  depends:
+   if (DepMode && rc==EXIT_SUCCESS)
+   {
+      /* main() makes sure there is an output file unless -MF and -MT are
+	 given, but batch jobs may still write to stdout */
+      char *depfilename=DepFile ? (char*) DepFile :
+	 outfilename ? dependname(outfilename) : NULL;
+
+      if (!outfilename && (!DepFile || !DepTarget))
+      {
+	 fprintf(errfile, "No dependency file for output to stdout\n");
+	 rc = EXIT_FAILURE;
+      }
+      else if (!depfilename)
+      {
+	 fprintf(errfile, "No mem for dependency file name\n");
+	 rc = EXIT_FAILURE;
+      }
+      else
+      {
+	 if (writedepends(depfilename, DepTarget ? DepTarget : outfilename,
+			  fdfilename, clibfilename, errfile))
+	    rc = EXIT_FAILURE;
+	 if (depfilename!=DepFile)
+	    free(depfilename);
+      }
+   }
+
+   return rc;
+}
+
+/******************************************************************************
+ *    CLASS bJob
+ *
+ * one line of a batch manifest. A line that could not be parsed becomes a
+ * job without files that only reports the problem, so that everything is
+ * reported in manifest order.
+ ******************************************************************************/
+
+typedef struct
+{
+   char*	 fdfilename;   /* the triple from the manifest, or NULL   */
+   char*	 clibfilename;
+   char*	 outfilename;
+   unsigned long lineno;       /* line in the manifest			  */
+   long		 size;	       /* input bytes, for scheduling		  */
+   int		 rc;	       /* EXIT_SUCCESS or EXIT_FAILURE		  */
+   char*	 errtext;      /* diagnostics, when run on a thread	  */
+   size_t	 errlen;
+   char*	 outtext;      /* output for stdout, when run on a thread */
+   size_t	 outlen;
+   int		 done;	       /* errtext/outtext may be printed	  */
+} bJob;
+
+static long
+filesize(const char* filename)
+{
+   struct stat st;
+
+   return stat(filename, &st)==0 ? (long) st.st_size : 0;
+}
+
+static char*
+copystring(const char* str)
+{
+   char *result=malloc(strlen(str)+1);
+
+   if (result)
+      strcpy(result, str);
+   return result;
+}
+
+static void
+freejobs(bJob* jobs, long numjobs)
+{
+   long count;
+
+   for (count=0; count<numjobs; count++)
+   {
+      free(jobs[count].fdfilename);
+      free(jobs[count].clibfilename);
+      free(jobs[count].outfilename);
+      free(jobs[count].errtext);
+      free(jobs[count].outtext);
+   }
+   free(jobs);
+}
+
+/******************************************************************************
+ *    readmanifest
+ *
+ * reads a manifest with one "fd-file clib-file output-file" triple per line
+ * (blank lines and lines starting with '#' are ignored) into *jobsptr and
+ * returns the number of jobs, or -1 if the manifest could not be read.
+ * The names are separated by blanks, or only by tabs on a line that has a
+ * tab, so that names with spaces can be given.
+ ******************************************************************************/
+
+#define BATCH_LINESIZE 4096
+
+static long
+readmanifest(const char* manifestname, bJob** jobsptr)
+{
+   FILE *manifest;
+   char *line;
+   bJob *jobs=NULL;
+   long  numjobs=0, maxjobs=0;
+   int   failed=0;
+   unsigned long lineno=0;
+
+   if (strcmp(manifestname, "-")==0)
+      manifest=stdin;
+   else if (!(manifest=fopen(manifestname, "r")))
+   {
+      fprintf(stderr, "Couldn't open file '%s'.\n", manifestname);
+      return -1;
+   }
+
+   if (!(line=malloc(BATCH_LINESIZE)))
+   {
+      fprintf(stderr, "No memory for line buffer.\n");
+      failed=1;
+   }
+   else
+   {
+      while (fgets(line, BATCH_LINESIZE, manifest))
+      {
+	 char *files[3], *word;
+	 const char *separators=strchr(line, '\t') ? "\t\r\n" : " \t\r\n";
+	 int   numfiles=0;
+	 bJob *job;
+
+	 lineno++;
+
+	 if (!strchr(line, '\n') && !feof(manifest))
+	 {
+	    fprintf(stderr, "Line %lu too long.\n", lineno);
+	    failed=1;
+	    break;
+	 }
+
+	 for (word=strtok(line, separators); word && numfiles<3;
+	      word=strtok(NULL, separators))
+	    files[numfiles++]=word;
+
+	 if (numfiles==0 || files[0][0]=='#')
+	    continue;
+
+	 if (numjobs==maxjobs)
+	 {
+	    bJob *newjobs;
+
+	    maxjobs=maxjobs ? maxjobs*2 : 64;
+	    if (!(newjobs=realloc(jobs, maxjobs*sizeof(bJob))))
+	    {
+	       fprintf(stderr, "No memory for jobs.\n");
+	       failed=1;
+	       break;
+	    }
+	    jobs=newjobs;
+	 }
+
+	 job=&jobs[numjobs++];
+	 memset(job, 0, sizeof(bJob));
+	 job->lineno=lineno;
+
+	 if (numfiles==3 && !word)
+	 {
+	    job->fdfilename=copystring(files[0]);
+	    job->clibfilename=copystring(files[1]);
+	    job->outfilename=copystring(files[2]);
+
+	    if (!job->fdfilename || !job->clibfilename || !job->outfilename)
+	    {
+	       fprintf(stderr, "No memory for jobs.\n");
+	       failed=1;
+	       break;
+	    }
+	    job->size=filesize(files[0])+filesize(files[1]);
+	 }
+      }
+
+      free(line);
+   }
+
+   if (manifest!=stdin)
+      fclose(manifest);
+
+   if (failed)
+   {
+      freejobs(jobs, numjobs);
+      return -1;
+   }
+
+   *jobsptr=jobs;
+   return numjobs;
+}
+
+/* runs one job; a job without files reports its bad manifest line. The
+   diagnostics of a job start with the name of its FD file, so that they
+   can be told apart */
+
+static void
+runjob(fdConverter* conv, const char* manifestname, bJob* job,
+       FILE* stdoutfile, FILE* errfile)
+{
+   if (job->fdfilename)
+   {
+      char  *diag=NULL, *line, *end;
+      size_t diaglen=0;
+      FILE  *diagfile=open_memstream(&diag, &diaglen);
+
+      job->rc=convert(conv, job->fdfilename, job->clibfilename,
+		      job->outfilename, stdoutfile,
+		      diagfile ? diagfile : errfile);
+      if (diagfile)
+      {
+	 fclose(diagfile);
+	 for (line=diag; line<diag+diaglen; line=end)
+	 {
+	    if ((end=memchr(line, '\n', diag+diaglen-line)))
+	       end++;
+	    else
+	       end=diag+diaglen;
+	    fprintf(errfile, "%s: %.*s", job->fdfilename, (int) (end-line),
+		    line);
+	 }
+	 free(diag);
+      }
+   }
+   else
+   {
+      fprintf(errfile, "%s: Bad manifest line %lu.\n", manifestname,
+	      job->lineno);
+      job->rc=EXIT_FAILURE;
+   }
+}
+
+#ifdef HAVE_PTHREAD_H
+
+/******************************************************************************
+ *    Parallel batch conversion
+ *
+ * The jobs are sorted by input size, largest first, and dealt out round
+ * robin to one queue per worker thread. A worker takes jobs from the front
+ * of its own queue; when that is empty it steals the largest job left in any
+ * other queue, so that a huge library picked up late is never left waiting
+ * behind a worker that happens to have a long queue.
+ *
+ * Each job writes its diagnostics (and its output, if it goes to stdout) to
+ * memory, and the main thread prints them in manifest order as soon as all
+ * earlier jobs are done. The result is byte for byte what a sequential run
+ * prints.
+ ******************************************************************************/
+
+typedef struct
+{
+   pthread_mutex_t lock;
+   long*	   jobs;       /* indices into the job array		  */
+   long		   head, tail; /* jobs[head..tail-1] are still to run	  */
+} bQueue;
+
+typedef struct
+{
+   bJob*	   jobs;
+   const char*	   manifestname;
+   bQueue*	   queues;
+   int		   numqueues;
+   pthread_mutex_t donelock;   /* protects bJob.done and Totals		  */
+   pthread_cond_t  donecond;
+} bPool;
+
+typedef struct
+{
+   bPool*	   pool;
+   int		   queue;      /* the worker's own queue		  */
+   pthread_t	   thread;
+} bWorker;
+
+static bJob* sortjobs;
+
+static int
+cmpjobsize(const void* a, const void* b) /* for qsort, largest first */
+{
+   const bJob *ja=&sortjobs[*(const long*)a], *jb=&sortjobs[*(const long*)b];
+
+   if (ja->size!=jb->size)
+      return ja->size>jb->size ? -1 : 1;
+   return *(const long*)a<*(const long*)b ? -1 : 1;
+}
+
+/* returns the next job for the worker owning queue own, or -1 if none */
+
+static long
+nextjob(bPool* pool, int own)
+{
+   long job=-1, best=-1;
+   int  count, victim=-1;
+
+   pthread_mutex_lock(&pool->queues[own].lock);
+   if (pool->queues[own].head<pool->queues[own].tail)
+      job=pool->queues[own].jobs[pool->queues[own].head++];
+   pthread_mutex_unlock(&pool->queues[own].lock);
+
+   if (job>=0)
+      return job;
+
+   /* Own queue empty, steal the largest job waiting anywhere else */
+
+   for (count=0; count<pool->numqueues; count++)
+   {
+      bQueue *queue=&pool->queues[count];
+
+      if (count==own)
+	 continue;
+      pthread_mutex_lock(&queue->lock);
+      if (queue->head<queue->tail &&
+	  (best<0 || pool->jobs[queue->jobs[queue->head]].size>
+		     pool->jobs[best].size))
+      {
+	 best=queue->jobs[queue->head];
+	 victim=count;
+      }
+      pthread_mutex_unlock(&queue->lock);
+   }
+
+   if (victim>=0)
+   {
+      bQueue *queue=&pool->queues[victim];
+
+      pthread_mutex_lock(&queue->lock);
+      if (queue->head<queue->tail)
+	 job=queue->jobs[queue->head++]; /* may not be best any more */
+      pthread_mutex_unlock(&queue->lock);
+
+      if (job<0)
+	 return nextjob(pool, own);
+   }
+
+   return job;
+}
+
+static void*
+worker(void* arg)
+{
+   bWorker *self=arg;
+   bPool *pool=self->pool;
+   fdConverter *conv;
+   long job;
+
+   if ((conv=fC_ctor()))
+   {
+      fC_SetQuiet(conv, Quiet);
+      fC_SetFilter(conv, Filter);
+      fC_SetMacros(conv, Macros);
+      fC_SetTiming(conv, Stats);
+   }
+
+   while ((job=nextjob(pool, self->queue))>=0)
+   {
+      bJob *bjob=&pool->jobs[job];
+      FILE *errfile, *stdoutfile;
+
+      errfile=open_memstream(&bjob->errtext, &bjob->errlen);
+      stdoutfile=open_memstream(&bjob->outtext, &bjob->outlen);
+
+      if (!conv || !errfile || !stdoutfile)
+      {
+	 if (errfile)
+	    fprintf(errfile, "No mem for FDs\n");
+	 bjob->rc=EXIT_FAILURE;
+      }
+      else
+	 runjob(conv, pool->manifestname, bjob, stdoutfile, errfile);
+
+      if (errfile)
+	 fclose(errfile);
+      if (stdoutfile)
+	 fclose(stdoutfile);
+
+      pthread_mutex_lock(&pool->donelock);
+      bjob->done=1;
+      pthread_cond_broadcast(&pool->donecond);
+      pthread_mutex_unlock(&pool->donelock);
+   }
+
+   if (conv)
+   {
+      pthread_mutex_lock(&pool->donelock);
+      addstats(conv);
+      pthread_mutex_unlock(&pool->donelock);
+      fC_dtor(conv);
+   }
+   return NULL;
+}
+
+static int
+parallelbatch(bJob* jobs, long numjobs, const char* manifestname,
+	      int numthreads)
+{
+   bPool    pool;
+   bWorker *workers;
+   long    *order, *dealt, count, pos;
+   int	    rc = EXIT_SUCCESS, started=0, queue;
+
+   if (numthreads>numjobs)
+      numthreads=numjobs;
+
+   order=malloc(numjobs*sizeof(long));
+   dealt=malloc(numjobs*sizeof(long));
+   workers=calloc(numthreads, sizeof(bWorker));
+   pool.queues=calloc(numthreads, sizeof(bQueue));
+
+   if (!order || !dealt || !workers || !pool.queues)
+   {
+      fprintf(stderr, "No memory for jobs.\n");
+      free(order);
+      free(dealt);
+      free(workers);
+      free(pool.queues);
+      return EXIT_FAILURE;
+   }
+
+   pool.jobs=jobs;
+   pool.manifestname=manifestname;
+   pool.numqueues=numthreads;
+   pthread_mutex_init(&pool.donelock, NULL);
+   pthread_cond_init(&pool.donecond, NULL);
+
+   /* Largest first, then dealt out round robin: queue n gets the jobs n,
+      n+numthreads, n+2*numthreads, ... of the size order. All queues live
+      in order[], one slice each. */
+
+   for (count=0; count<numjobs; count++)
+      dealt[count]=count;
+   sortjobs=jobs;
+   qsort(dealt, numjobs, sizeof(long), cmpjobsize);
+
+   for (queue=0, pos=0; queue<numthreads; queue++)
+   {
+      pthread_mutex_init(&pool.queues[queue].lock, NULL);
+      pool.queues[queue].jobs=order+pos;
+      pool.queues[queue].head=0;
+      for (count=queue; count<numjobs; count+=numthreads)
+	 order[pos++]=dealt[count];
+      pool.queues[queue].tail=order+pos-pool.queues[queue].jobs;
+   }
+   free(dealt);
+   dealt=NULL;
+
+   for (count=0; count<numthreads; count++)
+   {
+      workers[count].pool=&pool;
+      workers[count].queue=count;
+      if (pthread_create(&workers[count].thread, NULL, worker,
+			 &workers[count]))
+	 break;
+      started++;
+   }
+
+   if (!started)
+   {
+      fprintf(stderr, "Couldn't start threads.\n");
+      rc = EXIT_FAILURE;
+      goto quit;
+   }
+
+   /* If not all threads started, the running workers steal the rest */
+
+   for (count=0; count<numjobs; count++)
+   {
+      pthread_mutex_lock(&pool.donelock);
+      while (!jobs[count].done)
+	 pthread_cond_wait(&pool.donecond, &pool.donelock);
+      pthread_mutex_unlock(&pool.donelock);
+
+      if (jobs[count].outlen)
+	 fwrite(jobs[count].outtext, 1, jobs[count].outlen, stdout);
+      if (jobs[count].errlen)
+	 fwrite(jobs[count].errtext, 1, jobs[count].errlen, stderr);
+      fflush(stdout);
+      fflush(stderr);
+
+      free(jobs[count].outtext);
+      free(jobs[count].errtext);
+      jobs[count].outtext=jobs[count].errtext=NULL;
+
+      if (jobs[count].rc!=EXIT_SUCCESS)
+	 rc = EXIT_FAILURE;
+   }
+
+   for (count=0; count<started; count++)
+      pthread_join(workers[count].thread, NULL);
+
+  quit:
+   for (count=0; count<numthreads; count++)
+      pthread_mutex_destroy(&pool.queues[count].lock);
+   pthread_mutex_destroy(&pool.donelock);
+   pthread_cond_destroy(&pool.donecond);
+   free(order);
+   free(workers);
+   free(pool.queues);
+
+   return rc;
+}
+
+#endif /* HAVE_PTHREAD_H */
+
+/******************************************************************************
+ *    batch
+ *
+ * converts every pair of a manifest, using numthreads threads. A failing
+ * pair is reported and does not stop the others.
+ ******************************************************************************/
+
+static int
+batch(fdConverter* conv, const char* manifestname, int numthreads)
+{
+   bJob *jobs;
+   long  numjobs, count;
+   int	 rc = EXIT_SUCCESS;
+
+   if ((numjobs=readmanifest(manifestname, &jobs))<0)
+      return EXIT_FAILURE;
+
+#ifdef HAVE_PTHREAD_H
+   if (numthreads>1 && numjobs>1)
+      rc = parallelbatch(jobs, numjobs, manifestname, numthreads);
+   else
+#else
+   if (numthreads>1)
+      fprintf(stderr, "Warning: no thread support, ignoring -j.\n");
+#endif
+   {
+      /* A single converter is reset between the jobs, so tables and buffers
+	 are only set up once */
+
+      for (count=0; count<numjobs; count++)
+      {
+	 runjob(conv, manifestname, &jobs[count], stdout, stderr);
+	 if (jobs[count].rc!=EXIT_SUCCESS)
+	    rc = EXIT_FAILURE;
+      }
+   }
+
+   freejobs(jobs, numjobs);
+   return rc;
+}
+
+/******************************************************************************/
+
+int
+main(int argc, char** argv)
+{
+   fdConverter *conv;
+   int   rc;
+   int   numthreads = 1;
+   char *fdfilename=0, *clibfilename=0, *outfilename=0, *batchfilename=0;
+   char *serversocket=0, *clientsocket=0;
+   double start=elapsed();
+
+   int count;
+
+   /* before the options are read, as -D and --only already allocate */
+
+   for (count=1; count<argc; count++)
+      if (strcmp(argv[count], "--alloc-profile")==0 ||
+	  strcmp(argv[count], "--alloc-profile=json")==0)
+      {
+	 AllocProfile=argv[count][15] ? 2 : 1;
+	 fP_Enable();
+      }
+
+   for (count=1; count<argc; count++)
+   {
+      char *option=argv[count];
+      if (*option=='-')
+      {
+	 option++;
+	 if (strcmp(option, "o")==0)
+	 {
+	    if (count==argc-1 || outfilename)
+	    {
+	       printusage(argv[0]);
+	       return EXIT_FAILURE;
+	    }
+	    if (strcmp(argv[++count], "-"))
+	       outfilename=argv[count];
+	 }
+	 else if (option[0]=='D' || option[0]=='U')
+	 {
+	    if (!option[1] && count==argc-1)
+	    {
+	       printusage(argv[0]);
+	       return EXIT_FAILURE;
+	    }
+	    if (addmacro(option[1] ? option+1 : argv[++count], option[0]=='U'))
+	       return EXIT_FAILURE;
+	 }
+	 else if (strcmp(option, "MD")==0)
+	    DepMode = 1;
+	 else if (strcmp(option, "MP")==0)
+	    DepPhony = 1;
+	 else if (strcmp(option, "MF")==0 || strcmp(option, "MT")==0)
+	 {
+	    if (count==argc-1)
+	    {
+	       printusage(argv[0]);
+	       return EXIT_FAILURE;
+	    }
+	    if (option[1]=='F')
+	       DepFile=argv[++count];
+	    else
+	       DepTarget=argv[++count];
+	 }
+	 else if (strcmp(option, "j")==0)
+	 {
+	    if (count==argc-1 || (numthreads=atoi(argv[++count]))<1)
+	    {
+	       printusage(argv[0]);
+	       return EXIT_FAILURE;
+	    }
+	 }
+	 else
+	 {
+	    if (*option=='-') /* Accept GNU-style '--' options */
+	       option++;
+
+	    if (strcmp(option, "quiet") == 0)
+	       Quiet = 1;
+	    else if (strcmp(option, "stream") == 0)
+	       Stream = 1;
+	    else if (strcmp(option, "stats") == 0)
+	       Stats = 1;
+	    else if (strcmp(option, "stats=json") == 0)
+	       Stats = 2;
+	    else if (strcmp(option, "alloc-profile") == 0 ||
+		     strcmp(option, "alloc-profile=json") == 0)
+	       ; /* see above */
+	    else if (strcmp(option, "cache")==0 ||
+		     strcmp(option, "cache-size")==0)
+	    {
+	       if (count==argc-1)
+	       {
+		  printusage(argv[0]);
+		  return EXIT_FAILURE;
+	       }
+	       if (option[5])
+	       {
+		  if ((CacheSize=strtoul(argv[++count], NULL, 10))==0)
+		  {
+		     printusage(argv[0]);
+		     return EXIT_FAILURE;
+		  }
+	       }
+	       else
+		  CacheDir=argv[++count];
+	    }
+	    else if (strcmp(option, "only")==0 ||
+		     strcmp(option, "exclude")==0 ||
+		     strcmp(option, "only-from")==0 ||
+		     strcmp(option, "exclude-from")==0)
+	    {
+	       int exclude=option[0]=='e';
+
+	       if (count==argc-1)
+	       {
+		  printusage(argv[0]);
+		  return EXIT_FAILURE;
+	       }
+	       if (strchr(option, '-') ? readglobs(argv[++count], exclude)
+				       : addglob(argv[++count], exclude))
+		  return EXIT_FAILURE;
+	    }
+	    else if (strcmp(option, "batch")==0)
+	    {
+	       if (count==argc-1 || batchfilename)
+	       {
+		  printusage(argv[0]);
+		  return EXIT_FAILURE;
+	       }
+	       batchfilename=argv[++count];
+	    }
+	    else if (strcmp(option, "server")==0 ||
+		     strcmp(option, "client")==0)
+	    {
+	       char **socketname=option[0]=='s' ? &serversocket : &clientsocket;
+
+	       if (count==argc-1 || *socketname)
+	       {
+		  printusage(argv[0]);
+		  return EXIT_FAILURE;
+	       }
+	       *socketname=argv[++count];
+	    }
+	    else if (strcmp(option, "version")==0)
+	    {
+	       fprintf(stderr, "fd2sfd version " VERSION "\n");
+	       return EXIT_SUCCESS;
+	    }
+	    /* Unknown option */
+	    else
+	    {
+	       printusage(argv[0]);
+	       return EXIT_FAILURE;
+	    }
+	 }
+      }
+      else
+      {
+	 /* One of the filenames */
+	 if (!fdfilename)
+	    fdfilename=option;
+	 else if (!clibfilename)
+	    clibfilename=option;
+	 else if (!outfilename)
+	    outfilename=option;
+	 else
+	 {
+	    printusage(argv[0]);
+	    return EXIT_FAILURE;
+	 }
+      }
+   }
+
+   if (serversocket)
+   {
+      if (fdfilename || outfilename || batchfilename || clientsocket ||
+	  Filter || Stream || Macros || Stats || AllocProfile || DepMode ||
+	  CacheDir)
+      {
+	 printusage(argv[0]);
+	 return EXIT_FAILURE;
+      }
+      return server(serversocket);
+   }
+
+   if (batchfilename ? (fdfilename || outfilename || clientsocket)
+		     : (!fdfilename || !clibfilename) ||
+       (clientsocket && (Stream || Macros || Stats || AllocProfile ||
+			 DepMode || CacheDir)))
+   {
+      printusage(argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   /* Every output file needs a dependency file and target of its own */
+
+   if ((DepFile || DepTarget || DepPhony) && !DepMode)
+   {
+      printusage(argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   if (DepMode && (batchfilename ? DepFile || DepTarget
+		   : (!outfilename || strcmp(outfilename, "-")==0) &&
+		     (!DepFile || !DepTarget)))
+   {
+      fprintf(stderr, "-MD needs an output file%s.\n",
+	      batchfilename ? " per job, not -MF or -MT" : " or -MF and -MT");
+      return EXIT_FAILURE;
+   }
+
+   /* One automaton for all globs, shared by all threads */
+
+   if (Filter && fG_Compile(Filter))
+   {
+      fprintf(stderr, "No mem for --only and --exclude globs.\n");
+      return EXIT_FAILURE;
+   }
+
+   if (!CacheDir)
+      CacheDir=getenv("FD2SFD_CACHE");
+
+   if (clientsocket)
+      return client(clientsocket, fdfilename, clibfilename, outfilename,
+		    Quiet, FilterText ? FilterText : "");
+
+   if (!(conv=fC_ctor()))
+      return EXIT_FAILURE;
+
+   fC_SetQuiet(conv, Quiet);
+   fC_SetFilter(conv, Filter);
+   fC_SetMacros(conv, Macros);
+   fC_SetTiming(conv, Stats);
+
+   if (batchfilename)
+      rc = batch(conv, batchfilename, numthreads);
+   else
+      rc = convert(conv, fdfilename, clibfilename, outfilename,
+		   stdout, stderr);
+
+   if (Stats)
+   {
+      addstats(conv);
+      printstats(elapsed()-start);
+   }
+
+   fC_dtor(conv);
+   if (Filter)
+      fG_dtor(Filter);
+   free(FilterText);
+   if (Macros)
+      fM_dtor(Macros);
+   free(MacroText);
+
+   if (AllocProfile)
+      printallocs();
+
+   return rc;
+}
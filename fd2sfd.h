@@ -0,0 +1,208 @@
+/******************************************************************************
+ *
+ * fd2sfd.h -- the FD/clib to SFD conversion library (libfd2sfd)
+ *
+ * All state needed to convert one FD/clib pair lives in an fdConverter, so
+ * any number of conversions can run one after another (or side by side, with
+ * one converter each) inside a single process.
+ *
+ *   fdConverter *conv=fC_ctor();
+ *
+ *   if (fC_ReadFD(conv, "dos_lib.fd")==0 &&
+ *       fC_ReadClib(conv, "dos_protos.h")==0)
+ *      fC_Write(conv, stdout);
+ *
+ *   fC_Reset(conv);   ... and convert the next pair ...
+ *   fC_dtor(conv);
+ *
+ * fC_Write() leaves the converter untouched, so a converter that has read a
+ * pair can be kept around and written again later.
+ *
+ * An fd file too big to hold can be streamed instead: fC_OpenStream() reads
+ * only the clib file, and fC_WriteStream() writes each definition as soon
+ * as it has read it from the fd file, so memory stays the same whatever the
+ * size of the fd file.
+ *
+ *   if (fC_OpenStream(conv, "dos_lib.fd", "dos_protos.h")==0)
+ *      fC_WriteStream(conv, stdout);
+ *
+ * The SFD file is the same as fC_Write()'s as long as ##base comes before
+ * the first function. Warnings about the clib come in a different order,
+ * and nothing is left to be written again afterwards.
+ *
+ * Functions returning int return 0 on success and non-zero on failure; the
+ * reason has already been reported to the converter's error file then.
+ *
+ * An fdFilter restricts the functions written to those whose names match
+ * the globs given to it ('*', '?', and '\' to quote):
+ *
+ *   fdFilter *filter=fG_ctor();
+ *
+ *   fG_Add(filter, "Open*", 0);      ... written if it matches one of these
+ *   fG_Add(filter, "*Tags", 1);      ... and none of these
+ *   if (fG_Compile(filter)==0)
+ *      fC_SetFilter(conv, filter);
+ *
+ * A compiled filter is only read, so any number of converters can share
+ * it. fG_Add() and fG_Compile() return non-zero if there is no memory.
+ *
+ * The clib file is read the way the compiler would see it: the lines of
+ * #if, #ifdef and #ifndef groups that aren't compiled are left out, as are
+ * the directives themselves. The macros they depend on are those the clib
+ * file #defines, and those of an fdMacros set, given as to cc -D and -U:
+ *
+ *   fdMacros *macros=fM_ctor();
+ *
+ *   fM_Define(macros, "__MORPHOS__");     ... defined as 1
+ *   fM_Define(macros, "INCLUDE_VERSION=47");
+ *   fM_Undef(macros, "__amigaos4__");
+ *   fC_SetMacros(conv, macros);
+ *
+ * A group whose condition depends on a macro neither of them knows is read
+ * all through, as if the #if wasn't there. An fdMacros set is only read by
+ * the converters, which may share it.
+ *
+ * A converter counts what it reads and finds, from fC_ctor() on, and with
+ * fC_SetTiming() also the time each phase takes:
+ *
+ *   fdStats stats;
+ *
+ *   fC_SetTiming(conv, 1);
+ *   ... convert any number of pairs ...
+ *   fC_GetStats(conv, &stats);
+ *
+ * The times are in seconds, the CPU time that of the calling thread. A
+ * streamed conversion reads the fd file while it writes, so its fd time
+ * is part of fdPHASE_WRITE, and its hits and misses are the prototypes
+ * that a definition took and those that none did.
+ *
+ * fP_Enable() makes the library count its allocations, for all converters
+ * together, and where in fd2inline.c they are made. It must be called
+ * before anything else of the library, as the blocks are laid out
+ * differently then:
+ *
+ *   fdAllocStats stats;
+ *   fdAllocSite sites[64];
+ *   long num;
+ *
+ *   fP_Enable();
+ *   ... convert ...
+ *   fP_GetStats(&stats);
+ *   num=fP_GetSites(sites, 64);   ... the first 64, in no particular order
+ *
+ *****************************************************************************/
+
+#ifndef FD2SFD_H
+#define FD2SFD_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct fdConverter fdConverter;
+typedef struct fdFilter fdFilter;
+typedef struct fdMacros fdMacros;
+
+enum
+{
+   fdPHASE_FD,	    /* reading the fd file			*/
+   fdPHASE_INDEX,   /* hashing the definitions or prototypes	*/
+   fdPHASE_CLIB,    /* looking up the clib prototypes		*/
+   fdPHASE_HEADER,  /* the clib's directives and typedefs	*/
+   fdPHASE_WRITE,   /* writing the SFD file			*/
+   fdPHASES
+};
+
+typedef struct
+{
+   double	 wall[fdPHASES];   /* only with fC_SetTiming()	*/
+   double	 cpu[fdPHASES];
+   unsigned long fdlines, fdbytes;
+   unsigned long cliblines, clibbytes;
+   unsigned long defs;	   /* definitions read		*/
+   unsigned long hits;	   /* clib prototypes with a definition */
+   unsigned long misses;   /* ... and without		*/
+} fdStats;
+
+typedef struct
+{
+   unsigned long allocs;   /* malloc(), calloc() and realloc() calls */
+   unsigned long frees;
+   unsigned long bytes;	   /* ... asked for by the allocations	*/
+   unsigned long live;	   /* bytes not freed yet		*/
+   unsigned long peak;	   /* ... at most			*/
+   long		 sites;	   /* the places allocating		*/
+} fdAllocStats;
+
+typedef struct
+{
+   const char*	 function; /* where in fd2inline.c		*/
+   int		 line;
+   unsigned long allocs;   /* as in fdAllocStats		*/
+   unsigned long bytes;
+} fdAllocSite;
+
+fdConverter*
+fC_ctor		  (void);
+void
+fC_dtor		  (fdConverter* obj);
+void
+fC_Reset	  (fdConverter* obj); /* forget the last pair, keep buffers */
+void
+fC_SetQuiet	  (fdConverter* obj, int quiet);
+void
+fC_SetErrorFile	  (fdConverter* obj, FILE* errfile); /* default stderr */
+int
+fC_ReadFD	  (fdConverter* obj, const char* fdfilename);
+int
+fC_ReadClib	  (fdConverter* obj, const char* clibfilename);
+int
+fC_Write	  (fdConverter* obj, FILE* outfile);
+int
+fC_OpenStream	  (fdConverter* obj, const char* fdfilename,
+		   const char* clibfilename);
+int
+fC_WriteStream	  (fdConverter* obj, FILE* outfile);
+void
+fC_SetFilter	  (fdConverter* obj, const fdFilter* filter); /* NULL: all */
+void
+fC_SetMacros	  (fdConverter* obj, const fdMacros* macros); /* or NULL */
+void
+fC_SetTiming	  (fdConverter* obj, int timing);
+void
+fC_GetStats	  (const fdConverter* obj, fdStats* stats);
+
+fdFilter*
+fG_ctor		  (void);
+void
+fG_dtor		  (fdFilter* obj);
+int
+fG_Add		  (fdFilter* obj, const char* glob, int exclude);
+int
+fG_Compile	  (fdFilter* obj);
+int
+fG_Match	  (const fdFilter* obj, const char* name); /* 1: write it */
+
+fdMacros*
+fM_ctor		  (void);
+void
+fM_dtor		  (fdMacros* obj);
+int
+fM_Define	  (fdMacros* obj, const char* definition); /* name[=value] */
+int
+fM_Undef	  (fdMacros* obj, const char* name);
+
+void
+fP_Enable	  (void);
+void
+fP_GetStats	  (fdAllocStats* stats);
+long
+fP_GetSites	  (fdAllocSite* sites, long max); /* returns the number */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FD2SFD_H */
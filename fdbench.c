@@ -0,0 +1,168 @@
+/******************************************************************************
+ *
+ * fdbench -- time the phases of libfd2sfd on FD/clib pairs
+ *
+ * usage: fdbench [-n runs] fd-file clib-file [fd-file clib-file ...]
+ *
+ * Converts every pair runs times (default 9) and prints, for each phase,
+ * the median time and how far the runs were spread around it: the fastest
+ * and slowest run, and the difference of the two in percent of the
+ * median. The phases are those of a conversion: fC_ReadFD(), fC_ReadClib()
+ * and fC_Write(), and the streamed conversion of fC_OpenStream() and
+ * fC_WriteStream() as a whole. The SFD files go to /dev/null, the
+ * diagnostics of the first run of each pair to stderr.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "fd2sfd.h"
+
+enum { READFD, READCLIB, WRITE, STREAM, PHASES };
+
+static const char *const phasenames[PHASES]=
+{
+   "read fd", "read clib", "write", "stream"
+};
+
+static double
+now(void)
+{
+#ifdef CLOCK_MONOTONIC
+   struct timespec ts;
+
+   if (clock_gettime(CLOCK_MONOTONIC, &ts)==0)
+      return ts.tv_sec+ts.tv_nsec/1e9;
+#endif
+   {
+      struct timeval tv;
+
+      gettimeofday(&tv, NULL);
+      return tv.tv_sec+tv.tv_usec/1e6;
+   }
+}
+
+static int
+cmpdouble(const void* a, const void* b) /* for qsort */
+{
+   double x=*(const double*) a, y=*(const double*) b;
+
+   return x<y ? -1 : x>y;
+}
+
+/* one pass over a pair; the times of the phases go to times[phase] */
+
+static int
+run(fdConverter* conv, const char* fdfilename, const char* clibfilename,
+    FILE* devnull, double* times)
+{
+   double start, end;
+   int rc;
+
+   start=now();
+   rc=fC_ReadFD(conv, fdfilename);
+   end=now();
+   times[READFD]=end-start;
+
+   start=end;
+   rc=rc || fC_ReadClib(conv, clibfilename);
+   end=now();
+   times[READCLIB]=end-start;
+
+   start=end;
+   rc=rc || fC_Write(conv, devnull);
+   end=now();
+   times[WRITE]=end-start;
+   fC_Reset(conv);
+
+   start=now();
+   rc=rc || fC_OpenStream(conv, fdfilename, clibfilename) ||
+      fC_WriteStream(conv, devnull);
+   end=now();
+   times[STREAM]=end-start;
+   fC_Reset(conv);
+
+   return rc || fflush(devnull);
+}
+
+static void
+report(const char* fdfilename, double** times, int runs)
+{
+   int phase;
+
+   printf("%s\n", fdfilename);
+   for (phase=0; phase<PHASES; phase++)
+   {
+      double *t=times[phase], median;
+
+      qsort(t, runs, sizeof(double), cmpdouble);
+      median=runs%2 ? t[runs/2] : (t[runs/2-1]+t[runs/2])/2;
+      printf("  %-10s %10.3f ms  %10.3f .. %10.3f ms  %6.1f%%\n",
+	     phasenames[phase], median*1e3, t[0]*1e3, t[runs-1]*1e3,
+	     median>0 ? (t[runs-1]-t[0])/median*100 : 0.0);
+   }
+}
+
+int
+main(int argc, char** argv)
+{
+   double *times[PHASES], pass[PHASES];
+   fdConverter *conv;
+   FILE *devnull;
+   int runs=9, count, done, phase;
+
+   for (count=1; count<argc && strcmp(argv[count], "-n")==0; count+=2)
+      if (count+1>=argc || (runs=atoi(argv[count+1]))<1)
+	 break;
+   if (count>=argc || (argc-count)%2)
+   {
+      fprintf(stderr, "usage: fdbench [-n runs] fd-file clib-file "
+	      "[fd-file clib-file ...]\n");
+      return EXIT_FAILURE;
+   }
+
+   if (!(conv=fC_ctor()))
+      return EXIT_FAILURE;
+   if (!(devnull=fopen("/dev/null", "w")))
+   {
+      fprintf(stderr, "fdbench: can't open /dev/null\n");
+      return EXIT_FAILURE;
+   }
+   for (phase=0; phase<PHASES; phase++)
+      if (!(times[phase]=malloc(runs*sizeof(double))))
+      {
+	 fprintf(stderr, "fdbench: no mem\n");
+	 return EXIT_FAILURE;
+      }
+
+   printf("%d runs: median, fastest .. slowest, spread\n", runs);
+   for (; count<argc; count+=2)
+   {
+      /* warnings once, not for every run */
+
+      fC_SetQuiet(conv, 0);
+      for (done=0; done<runs; done++)
+      {
+	 if (run(conv, argv[count], argv[count+1], devnull, pass))
+	 {
+	    fprintf(stderr, "fdbench: can't convert %s and %s\n",
+		    argv[count], argv[count+1]);
+	    return EXIT_FAILURE;
+	 }
+	 fC_SetQuiet(conv, 1);
+	 for (phase=0; phase<PHASES; phase++)
+	    times[phase][done]=pass[phase];
+      }
+      report(argv[count], times, runs);
+   }
+
+   for (phase=0; phase<PHASES; phase++)
+      free(times[phase]);
+   fclose(devnull);
+   fC_dtor(conv);
+   return EXIT_SUCCESS;
+}
@@ -48,6 +48,8 @@ rm -rf ${RPM_BUILD_ROOT}
 %defattr(-,root,root)
 %doc COPYING %{Name}.readme
 %{_bindir}/*
+%{_libdir}/libfd2sfd.*
+%{_includedir}/fd2sfd.h
 %{_datadir}/fd2sfd
 %{_prefix}/os-include
 %{_prefix}/os-lib
@@ -0,0 +1,320 @@
+/******************************************************************************
+ *
+ * mkcorpus -- make a synthetic FD/clib pair for benchmarking fd2sfd
+ *
+ * usage: mkcorpus [options] functions basename
+ *
+ * Writes basename_lib.fd and basename_protos.h, a library of the given
+ * number of functions that looks like the real ones: ##bias gaps and
+ * ##private functions, comment blocks, TagList functions with their Tags
+ * forms, A functions with their varargs forms, function pointer
+ * parameters, and prototypes spread over several lines. The options give
+ * the share of each, in percent of the functions:
+ *
+ *   -b pct	a ##bias gap before the function (default 2)
+ *   -p pct	##private functions (default 5)
+ *   -c pct	a comment block before the function (default 10)
+ *   -v pct	TagList and A functions (default 15)
+ *   -f pct	a function pointer parameter (default 5)
+ *   -l pct	one parameter per line (default 20)
+ *   -s seed	for the random numbers (default 1)
+ *
+ * The same options and seed always give the same files, on any host.
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+   unsigned long bias, priv, comment, varargs, funcptr, longproto;
+} mcMix;
+
+static unsigned long mc_seed=1;
+
+/* a 32 bit xorshift, so that the files don't depend on the C library */
+
+static unsigned long
+mc_Random(unsigned long range)
+{
+   mc_seed^=(mc_seed<<13) & 0xffffffffUL;
+   mc_seed^=mc_seed>>17;
+   mc_seed^=(mc_seed<<5) & 0xffffffffUL;
+   return mc_seed % range;
+}
+
+static int
+mc_Chance(unsigned long pct)
+{
+   return mc_Random(100)<pct;
+}
+
+static const char *const mc_verbs[]=
+{
+   "Open", "Close", "Read", "Write", "Alloc", "Free", "Find", "Lock",
+   "Unlock", "Get", "Set", "Add", "Remove", "Create", "Delete", "Obtain",
+   "Release", "Examine", "Change", "Init"
+};
+
+static const char *const mc_nouns[]=
+{
+   "Object", "Window", "Screen", "Port", "Signal", "Memory", "Device",
+   "Handler", "Message", "Font", "Region", "Layer", "Semaphore", "Task",
+   "Record", "Buffer", "Hook", "Class", "Attr", "Node"
+};
+
+typedef struct
+{
+   const char* type;	/* how the prototype declares it */
+   const char* name;
+   const char* reg;	/* d or a */
+} mcParam;
+
+static const mcParam mc_params[]=
+{
+   { "LONG", "value", "d" },
+   { "ULONG", "flags", "d" },
+   { "UWORD", "width", "d" },
+   { "BOOL", "enable", "d" },
+   { "APTR", "data", "a" },
+   { "STRPTR", "name", "a" },
+   { "CONST_STRPTR", "title", "a" },
+   { "struct Window *", "window", "a" },
+   { "struct MsgPort *", "port", "a" },
+   { "struct Hook *", "hook", "a" },
+   { "const struct TextAttr *", "attr", "a" },
+   { "BPTR", "file", "d" }
+};
+
+static const char *const mc_results[]=
+{
+   "LONG", "ULONG", "BOOL", "APTR", "VOID", "struct Window *", "STRPTR",
+   "BPTR"
+};
+
+#define NUMOF(array) (sizeof (array)/sizeof (array)[0])
+#define MAXPARAMS 6
+
+typedef struct
+{
+   char	   name[64];
+   const char* result;
+   const mcParam* param[MAXPARAMS];
+   int	   numparams;
+   int	   funcptr;	/* param[0] is a function pointer		*/
+   int	   kind;	/* mc_PLAIN, mc_TAGLIST, mc_A			*/
+} mcFunc;
+
+enum { mc_PLAIN, mc_TAGLIST, mc_A };
+
+static void
+mc_Make(mcFunc* func, unsigned long number, const mcMix* mix)
+{
+   int count;
+
+   func->kind=mc_PLAIN;
+   if (mc_Chance(mix->varargs))
+      func->kind=mc_Chance(50) ? mc_TAGLIST : mc_A;
+   sprintf(func->name, "%s%s%lu%s", mc_verbs[mc_Random(NUMOF(mc_verbs))],
+	   mc_nouns[mc_Random(NUMOF(mc_nouns))], number,
+	   func->kind==mc_TAGLIST ? "TagList" : func->kind==mc_A ? "A" : "");
+   func->result=mc_results[mc_Random(NUMOF(mc_results))];
+
+   /* fd2sfd ends a statement at a line ending in ')', so a function
+      pointer comes first, and never alone */
+
+   func->funcptr=func->kind==mc_PLAIN && mc_Chance(mix->funcptr);
+   func->numparams=func->funcptr ? 2+mc_Random(MAXPARAMS-2)
+				 : mc_Random(MAXPARAMS-1);
+   for (count=0; count<func->numparams; count++)
+      func->param[count]=&mc_params[count<func->funcptr ? 4 :
+				    mc_Random(NUMOF(mc_params))];
+}
+
+/* the registers every parameter goes in; a function has no more than
+   MAXPARAMS of them, so there's always one left */
+
+static void
+mc_WriteFD(FILE* fd, const mcFunc* func)
+{
+   int count, d=0, a=0;
+
+   fprintf(fd, "%s(", func->name);
+   for (count=0; count<func->numparams; count++)
+      fprintf(fd, "%s%s%d", count ? "," : "", func->param[count]->name,
+	      count);
+   if (func->kind!=mc_PLAIN)
+      fprintf(fd, "%s%s", func->numparams ? "," : "",
+	      func->kind==mc_TAGLIST ? "tags" : "message");
+   fputs(")(", fd);
+   for (count=0; count<func->numparams; count++)
+   {
+      int data=func->param[count]->reg[0]=='d';
+
+      fprintf(fd, "%s%s%d", count ? "," : "", data ? "d" : "a",
+	      data ? d++ : a++);
+   }
+   if (func->kind!=mc_PLAIN)
+      fprintf(fd, "%sa%d", func->numparams ? "," : "", a);
+   fputs(")\n", fd);
+}
+
+static void
+mc_WriteParams(FILE* clib, const mcFunc* func, const char* last, int split)
+{
+   const char *sep=split ? ",\n\t" : ", ";
+   int count;
+
+   fputs(split ? "(\n\t" : "( ", clib);
+   for (count=0; count<func->numparams; count++)
+   {
+      const mcParam *param=func->param[count];
+
+      if (count)
+	 fputs(sep, clib);
+      if (count<func->funcptr)
+	 fprintf(clib, "LONG (*callback%d)(APTR object, LONG message)", count);
+      else
+	 fprintf(clib, "%s%s%s%d", param->type,
+		 param->type[strlen(param->type)-1]=='*' ? "" : " ",
+		 param->name, count);
+   }
+   if (last)
+      fprintf(clib, "%s%s", func->numparams ? sep : "", last);
+   else if (!func->numparams)
+      fputs("VOID", clib);
+   fputs(split ? "\n);\n" : " );\n", clib);
+}
+
+static void
+mc_WriteClib(FILE* clib, const mcFunc* func, const mcMix* mix)
+{
+   const char *result=func->result;
+   const char *blank=result[strlen(result)-1]=='*' ? "" : " ";
+   int split=mc_Chance(mix->longproto);
+   size_t len=strlen(func->name);
+
+   fprintf(clib, "%s%s%s", result, blank, func->name);
+   mc_WriteParams(clib, func, func->kind==mc_TAGLIST ?
+		  "const struct TagItem *tags" : func->kind==mc_A ?
+		  "APTR message" : NULL, split);
+
+   /* the varargs form: fooTagList has fooTags, fooA has foo */
+
+   if (func->kind==mc_TAGLIST)
+      fprintf(clib, "%s%s%.*sTags", result, blank, (int) len-7, func->name);
+   else if (func->kind==mc_A)
+      fprintf(clib, "%s%s%.*s", result, blank, (int) len-1, func->name);
+   if (func->kind!=mc_PLAIN)
+      mc_WriteParams(clib, func, func->kind==mc_TAGLIST ?
+		     "Tag tag1, ..." : "ULONG method, ...", split);
+}
+
+static void
+mc_usage(void)
+{
+   fprintf(stderr, "usage: mkcorpus [-b pct] [-p pct] [-c pct] [-v pct] "
+	   "[-f pct] [-l pct] [-s seed]\n\t\tfunctions basename\n");
+   exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char** argv)
+{
+   mcMix mix={2, 5, 10, 15, 5, 20};
+   unsigned long functions, number, bias=30;
+   char *fdname, *clibname;
+   FILE *fd, *clib;
+   int count, priv=0;
+
+   for (count=1; count<argc && argv[count][0]=='-'; count+=2)
+   {
+      unsigned long *pct=NULL, value;
+      char *end;
+
+      if (strlen(argv[count])!=2 || count+1>=argc)
+	 mc_usage();
+      value=strtoul(argv[count+1], &end, 10);
+      if (*end || (argv[count][1]!='s' && value>100))
+	 mc_usage();
+
+      switch (argv[count][1])
+      {
+	 case 'b': pct=&mix.bias; break;
+	 case 'p': pct=&mix.priv; break;
+	 case 'c': pct=&mix.comment; break;
+	 case 'v': pct=&mix.varargs; break;
+	 case 'f': pct=&mix.funcptr; break;
+	 case 'l': pct=&mix.longproto; break;
+	 case 's': mc_seed=value ? value : 1; break;
+	 default:  mc_usage();
+      }
+      if (pct)
+	 *pct=value;
+   }
+   if (count!=argc-2 || !(functions=strtoul(argv[count], NULL, 10)))
+      mc_usage();
+
+   if (!(fdname=malloc(strlen(argv[count+1])+16)) ||
+       !(clibname=malloc(strlen(argv[count+1])+16)))
+   {
+      fprintf(stderr, "mkcorpus: no mem\n");
+      return EXIT_FAILURE;
+   }
+   sprintf(fdname, "%s_lib.fd", argv[count+1]);
+   sprintf(clibname, "%s_protos.h", argv[count+1]);
+
+   if (!(fd=fopen(fdname, "w")) || !(clib=fopen(clibname, "w")))
+   {
+      fprintf(stderr, "mkcorpus: can't write %s\n", fd ? clibname : fdname);
+      return EXIT_FAILURE;
+   }
+
+   fprintf(fd, "* \"corpus.library\"\n##base _CorpusBase\n##bias 30\n"
+	   "##public\n");
+   fprintf(clib, "#ifndef CLIB_CORPUS_PROTOS_H\n#define CLIB_CORPUS_PROTOS_H"
+	   "\n\n/*\n**\t$VER: corpus_protos.h 1.0\n**\n**\t%lu functions"
+	   "\n*/\n\n#ifndef EXEC_TYPES_H\n#include <exec/types.h>\n#endif\n"
+	   "#ifndef UTILITY_TAGITEM_H\n#include <utility/tagitem.h>\n#endif\n\n",
+	   functions);
+
+   for (number=0; number<functions; number++)
+   {
+      mcFunc func;
+
+      mc_Make(&func, number, &mix);
+
+      if (mc_Chance(mix.bias))
+      {
+	 bias+=6*(1+mc_Random(8));
+	 fprintf(fd, "##bias %lu\n", bias);
+      }
+      if (mc_Chance(mix.priv)!=priv)
+      {
+	 priv=!priv;
+	 fputs(priv ? "##private\n" : "##public\n", fd);
+      }
+      if (mc_Chance(mix.comment))
+      {
+	 fprintf(fd, "*--- functions in V%lu or higher ---\n",
+		 36+number*10/functions);
+	 fprintf(clib, "/*\n**\t%s\n**\n**\tSynthetic function %lu.\n*/\n",
+		 func.name, number);
+      }
+      mc_WriteFD(fd, &func);
+      mc_WriteClib(clib, &func, &mix);
+      bias+=6;
+   }
+
+   fputs("##end\n", fd);
+   fputs("\n#endif /* CLIB_CORPUS_PROTOS_H */\n", clib);
+
+   if (fclose(fd) | fclose(clib))
+   {
+      fprintf(stderr, "mkcorpus: can't write %s\n", argv[count+1]);
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
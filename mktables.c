@@ -0,0 +1,418 @@
+/******************************************************************************
+ *
+ * mktables -- turn tables.def into the perfect hash tables of tables.inc
+ *
+ * usage: mktables tables.def tables.inc
+ *
+ * Runs on the build host. For every table, a seed and a displacement for
+ * every bucket are searched for, so that each key ends up in a slot of its
+ * own (see tables.h).
+ *
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+
+#define MAXSLOTS 65535	/* keeps d0*g within 32 bits */
+
+typedef struct
+{
+   char* key;
+   char* value;
+} mtEntry;
+
+typedef struct
+{
+   char*	name;
+   char*	inverse;
+   mtEntry*	entry;
+   unsigned long num, max;
+} mtTable;
+
+static const char* deffilename;
+
+static void*
+mt_Alloc(size_t size)
+{
+   void *result=malloc(size ? size : 1);
+
+   if (!result)
+   {
+      fprintf(stderr, "mktables: no mem\n");
+      exit(EXIT_FAILURE);
+   }
+   return result;
+}
+
+static char*
+mt_Dup(const char* str, size_t len)
+{
+   char *result=mt_Alloc(len+1);
+
+   memcpy(result, str, len);
+   result[len]='\0';
+   return result;
+}
+
+/* cuts the next blank separated word out of *line, NULL if there is none */
+
+static char*
+mt_Word(char** line)
+{
+   char *start=*line, *end;
+
+   while (*start==' ' || *start=='\t')
+      start++;
+   if (*start=='\0' || *start=='\n' || *start=='#')
+      return NULL;
+   for (end=start; *end && *end!=' ' && *end!='\t' && *end!='\n'; end++);
+   *line=end;
+   return mt_Dup(start, end-start);
+}
+
+static void
+mt_Add(mtTable* table, char* key, char* value)
+{
+   if (table->num==table->max)
+   {
+      mtEntry *entry;
+
+      table->max=table->max ? 2*table->max : 16;
+      entry=mt_Alloc(table->max*sizeof(mtEntry));
+      if (table->num)
+	 memcpy(entry, table->entry, table->num*sizeof(mtEntry));
+      free(table->entry);
+      table->entry=entry;
+   }
+   table->entry[table->num].key=key;
+   table->entry[table->num].value=value;
+   table->num++;
+}
+
+static int
+mt_Unique(const mtTable* table, int values)
+{
+   unsigned long i, j;
+
+   for (i=0; i<table->num; i++)
+      for (j=0; j<i; j++)
+	 if (!strcmp(values ? table->entry[i].value : table->entry[i].key,
+		     values ? table->entry[j].value : table->entry[j].key))
+	 {
+	    fprintf(stderr, "%s: %s \"%s\" twice in table %s\n", deffilename,
+	       values ? "value" : "key",
+	       values ? table->entry[i].value : table->entry[i].key,
+	       table->name);
+	    return 0;
+	 }
+   return 1;
+}
+
+/* biggest bucket first for qsort */
+
+static const unsigned long* mt_start;
+
+static int
+mt_cmpBucket(const void* a, const void* b)
+{
+   unsigned long x=*(const unsigned long*) a, y=*(const unsigned long*) b;
+   unsigned long countx=mt_start[x+1]-mt_start[x];
+   unsigned long county=mt_start[y+1]-mt_start[y];
+
+   if (countx!=county)
+      return countx<county ? 1 : -1;
+   return x<y ? -1 : x>y;
+}
+
+/******************************************************************************
+ * mt_Place tries to find the displacements for one seed and table size. The
+ * buckets are placed biggest first, trying every d0,d1 pair in turn.
+ ******************************************************************************/
+
+static int
+mt_Place(fdTable* hash, unsigned long* disp, const char** key,
+	 const char** value, const mtTable* table)
+{
+   unsigned long num=table->num, size=hash->size, buckets=hash->buckets;
+   unsigned long *keyhash=mt_Alloc(num*sizeof(unsigned long));
+   unsigned long *member=mt_Alloc(num*sizeof(unsigned long));
+   unsigned long *start=mt_Alloc((buckets+1)*sizeof(unsigned long));
+   unsigned long *order=mt_Alloc(buckets*sizeof(unsigned long));
+   unsigned long *slot=mt_Alloc(num*sizeof(unsigned long));
+   unsigned long i, k;
+   int result=1;
+
+   /* start[b]..start[b+1]-1 are the places in member of bucket b's keys */
+
+   memset(start, 0, (buckets+1)*sizeof(unsigned long));
+   memset(disp, 0, buckets*sizeof(unsigned long));
+   for (i=0; i<size; i++)
+      key[i]=value[i]=NULL;
+
+   for (i=0; i<num; i++)
+   {
+      keyhash[i]=fT_Hash(table->entry[i].key, strlen(table->entry[i].key),
+	 hash->seed);
+      start[keyhash[i] % buckets+1]++;
+   }
+   for (i=0; i<buckets; i++)
+      start[i+1]+=start[i];
+   for (i=0; i<num; i++)
+      member[start[keyhash[i] % buckets]++]=i;
+   for (i=buckets; i>0; i--)
+      start[i]=start[i-1];
+   start[0]=0;
+
+   for (i=0; i<buckets; i++)
+      order[i]=i;
+   mt_start=start;
+   qsort(order, buckets, sizeof(unsigned long), mt_cmpBucket);
+
+   for (i=0; i<buckets && result; i++)
+   {
+      unsigned long bucket=order[i], first=start[bucket], n=0, d;
+
+      if (first==start[bucket+1])
+	 break;
+
+      for (d=0; d<size*size; d++)
+      {
+	 disp[bucket]=d;
+	 for (n=0; first+n<start[bucket+1]; n++)
+	 {
+	    slot[n]=fT_Slot(hash, keyhash[member[first+n]]);
+	    if (key[slot[n]])
+	       break;
+	    for (k=0; k<n && slot[k]!=slot[n]; k++);
+	    if (k<n)
+	       break;
+	 }
+	 if (first+n==start[bucket+1])
+	    break;
+      }
+
+      if (d==size*size)
+	 result=0;
+      else
+	 for (n=0; first+n<start[bucket+1]; n++)
+	 {
+	    key[slot[n]]=table->entry[member[first+n]].key;
+	    value[slot[n]]=table->entry[member[first+n]].value;
+	 }
+   }
+
+   free(keyhash);
+   free(member);
+   free(start);
+   free(order);
+   free(slot);
+   return result;
+}
+
+static void
+mt_Quote(FILE* out, const char* str)
+{
+   if (str)
+      fprintf(out, "\"%s\"", str);
+   else
+      fputs("NULL", out);
+}
+
+static void
+mt_Array(FILE* out, const char* name, const char* part, const char** str,
+	 unsigned long size)
+{
+   unsigned long i;
+
+   fprintf(out, "static const char* const %s_%s[%lu]=\n{\n", name, part,
+      size);
+   for (i=0; i<size; i++)
+   {
+      fputs("   ", out);
+      mt_Quote(out, str[i]);
+      fputs(i+1<size ? ",\n" : "\n", out);
+   }
+   fputs("};\n\n", out);
+}
+
+static int
+mt_Write(FILE* out, const char* name, const mtTable* table)
+{
+   fdTable hash;
+   unsigned long *disp;
+   const char **key, **value;
+   unsigned long i;
+
+   hash.seed=0;
+   hash.buckets=table->num/2+1;
+   hash.size=table->num+table->num/4+1;
+   disp=mt_Alloc(hash.buckets*sizeof(unsigned long));
+   key=mt_Alloc(MAXSLOTS*sizeof(char*));
+   value=mt_Alloc(MAXSLOTS*sizeof(char*));
+   hash.key=key;
+   hash.value=value;
+   hash.disp=disp;
+
+   while (!mt_Place(&hash, disp, key, value, table))
+   {
+      /* every 16 seeds, make a little more room */
+
+      if (++hash.seed%16==0)
+	 hash.size++;
+      if (hash.size>MAXSLOTS)
+      {
+	 fprintf(stderr, "%s: table %s is too big\n", deffilename, name);
+	 return 0;
+      }
+   }
+
+   /* make sure the program will find what we put in */
+
+   for (i=0; i<table->num; i++)
+      if (fT_Lookup(&hash, table->entry[i].key,
+		    strlen(table->entry[i].key))!=table->entry[i].value)
+      {
+	 fprintf(stderr, "%s: lost \"%s\" in table %s\n", deffilename,
+	    table->entry[i].key, name);
+	 return 0;
+      }
+
+   mt_Array(out, name, "key", key, hash.size);
+   mt_Array(out, name, "value", value, hash.size);
+
+   fprintf(out, "static const unsigned long %s_disp[%lu]=\n{\n", name,
+      hash.buckets);
+   for (i=0; i<hash.buckets; i++)
+      fprintf(out, "   %luUL%s\n", disp[i], i+1<hash.buckets ? "," : "");
+   fputs("};\n\n", out);
+
+   fprintf(out, "static const fdTable %s=\n{\n"
+      "   %s_key, %s_value, %s_disp, %luUL, %luUL, %luUL\n};\n\n",
+      name, name, name, name, hash.seed, hash.size, hash.buckets);
+
+   free(disp);
+   free(key);
+   free(value);
+   return 1;
+}
+
+int
+main(int argc, char** argv)
+{
+   char line[512];
+   mtTable *tables=NULL;
+   unsigned long num=0, max=0, lineno=0, i, j;
+   FILE *in, *out;
+
+   if (argc!=3)
+   {
+      fprintf(stderr, "usage: mktables tables.def tables.inc\n");
+      return EXIT_FAILURE;
+   }
+   deffilename=argv[1];
+
+   if (!(in=fopen(argv[1], "r")))
+   {
+      fprintf(stderr, "mktables: can't open %s\n", argv[1]);
+      return EXIT_FAILURE;
+   }
+
+   while (fgets(line, sizeof line, in))
+   {
+      char *ptr=line, *key, *value;
+
+      lineno++;
+      if (!(key=mt_Word(&ptr)))
+	 continue;
+      value=mt_Word(&ptr);
+
+      if (!strcmp(key, "table"))
+      {
+	 if (!value)
+	 {
+	    fprintf(stderr, "%s:%lu: table without a name\n", argv[1], lineno);
+	    return EXIT_FAILURE;
+	 }
+	 if (num==max)
+	 {
+	    mtTable *table;
+
+	    max=max ? 2*max : 8;
+	    table=mt_Alloc(max*sizeof(mtTable));
+	    if (num)
+	       memcpy(table, tables, num*sizeof(mtTable));
+	    free(tables);
+	    tables=table;
+	 }
+	 free(key);
+	 tables[num].name=value;
+	 tables[num].inverse=mt_Word(&ptr);
+	 tables[num].entry=NULL;
+	 tables[num].num=tables[num].max=0;
+	 num++;
+      }
+      else if (!num)
+      {
+	 fprintf(stderr, "%s:%lu: entry outside of a table\n", argv[1],
+	    lineno);
+	 return EXIT_FAILURE;
+      }
+      else
+	 mt_Add(&tables[num-1], key, value ? value : key);
+   }
+   fclose(in);
+
+   for (i=0; i<num; i++)
+      if (!mt_Unique(&tables[i], 0) ||
+	  (tables[i].inverse && !mt_Unique(&tables[i], 1)))
+	 return EXIT_FAILURE;
+
+   if (!(out=fopen(argv[2], "w")))
+   {
+      fprintf(stderr, "mktables: can't write %s\n", argv[2]);
+      return EXIT_FAILURE;
+   }
+
+   fprintf(out, "/* %s -- generated from %s by mktables, do not edit */\n\n",
+      argv[2], argv[1]);
+
+   for (i=0; i<num; i++)
+   {
+      if (!mt_Write(out, tables[i].name, &tables[i]))
+      {
+	 fclose(out);
+	 remove(argv[2]);
+	 return EXIT_FAILURE;
+      }
+
+      if (tables[i].inverse)
+      {
+	 mtTable inverse=tables[i];
+
+	 inverse.entry=mt_Alloc(inverse.num*sizeof(mtEntry));
+	 for (j=0; j<inverse.num; j++)
+	 {
+	    inverse.entry[j].key=tables[i].entry[j].value;
+	    inverse.entry[j].value=tables[i].entry[j].key;
+	 }
+	 if (!mt_Write(out, tables[i].inverse, &inverse))
+	 {
+	    fclose(out);
+	    remove(argv[2]);
+	    return EXIT_FAILURE;
+	 }
+	 free(inverse.entry);
+      }
+   }
+
+   if (fclose(out))
+   {
+      fprintf(stderr, "mktables: can't write %s\n", argv[2]);
+      remove(argv[2]);
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
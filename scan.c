@@ -0,0 +1,282 @@
+/******************************************************************************
+ *
+ * scan.c -- the byte scanning kernels the fd and clib readers are built on
+ *
+ * The vector kernels compare a block of bytes against the characters of
+ * interest at once and turn the results into bit masks, one bit per byte,
+ * so the answer is found with a count of leading or trailing zeros instead
+ * of a loop over the block. The bytes left over at the end, less than a
+ * block, go through the plain C kernel.
+ *
+ *****************************************************************************/
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__>4 || \
+    (__GNUC__==4 && __GNUC_MINOR__>=9))
+#define FS_X86
+#include <immintrin.h>
+#endif
+
+/******************************************************************************
+ *    plain C
+ ******************************************************************************/
+
+static size_t
+fS_LineC(const char* str, size_t len, size_t* trimmed)
+{
+   size_t at, last=0;
+
+   for (at=0; at<len && str[at]!='\n' && str[at]!='\0'; at++)
+      if (str[at]!=' ' && (str[at]<'\t' || str[at]>'\r'))
+	 last=at+1;
+   *trimmed=last;
+   return at;
+}
+
+static size_t
+fS_BlanksC(const char* str, size_t len)
+{
+   size_t at;
+
+   for (at=0; at<len && (str[at]==' ' || str[at]=='\t'); at++);
+   return at;
+}
+
+static size_t
+fS_CommentEndC(const char* str, size_t len)
+{
+   size_t at;
+
+   for (at=0; at+1<len; at++)
+      if (str[at]=='*' && str[at+1]=='/')
+	 return at;
+   return len;
+}
+
+static const fdScan fS_C=
+{
+   "C", fS_LineC, fS_BlanksC, fS_CommentEndC
+};
+
+#ifdef FS_X86
+
+/* the number of the highest bit set in mask, which must not be 0 */
+
+static int
+fS_High(unsigned int mask)
+{
+   return 31-__builtin_clz(mask);
+}
+
+/******************************************************************************
+ *    SSE2, 16 bytes at a time
+ ******************************************************************************/
+
+static unsigned int
+fS_Blank16(__m128i v)
+{
+   __m128i blank=_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+      _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t'-1)),
+		    _mm_cmpgt_epi8(_mm_set1_epi8('\r'+1), v)));
+
+   return _mm_movemask_epi8(blank);
+}
+
+static size_t
+fS_LineSSE2(const char* str, size_t len, size_t* trimmed)
+{
+   size_t at, last=0, rest;
+
+   for (at=0; at+16<=len; at+=16)
+   {
+      __m128i v=_mm_loadu_si128((const __m128i*) (str+at));
+      unsigned int stop=_mm_movemask_epi8(
+	 _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+		      _mm_cmpeq_epi8(v, _mm_setzero_si128())));
+      unsigned int text=~fS_Blank16(v) & 0xffff;
+
+      if (stop)
+      {
+	 text&=(stop & -stop)-1;
+	 if (text)
+	    last=at+fS_High(text)+1;
+	 *trimmed=last;
+	 return at+__builtin_ctz(stop);
+      }
+      if (text)
+	 last=at+fS_High(text)+1;
+   }
+
+   len=fS_LineC(str+at, len-at, &rest);
+   *trimmed=rest ? at+rest : last;
+   return at+len;
+}
+
+static size_t
+fS_BlanksSSE2(const char* str, size_t len)
+{
+   size_t at;
+
+   for (at=0; at+16<=len; at+=16)
+   {
+      __m128i v=_mm_loadu_si128((const __m128i*) (str+at));
+      unsigned int text=~_mm_movemask_epi8(
+	 _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+		      _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')))) & 0xffff;
+
+      if (text)
+	 return at+__builtin_ctz(text);
+   }
+   return at+fS_BlanksC(str+at, len-at);
+}
+
+/* a '*' in one vector and a '/' in the same place of the next byte's one */
+
+static size_t
+fS_CommentEndSSE2(const char* str, size_t len)
+{
+   size_t at;
+
+   for (at=0; at+17<=len; at+=16)
+   {
+      __m128i star=_mm_loadu_si128((const __m128i*) (str+at));
+      __m128i slash=_mm_loadu_si128((const __m128i*) (str+at+1));
+      unsigned int end=_mm_movemask_epi8(
+	 _mm_and_si128(_mm_cmpeq_epi8(star, _mm_set1_epi8('*')),
+		       _mm_cmpeq_epi8(slash, _mm_set1_epi8('/'))));
+
+      if (end)
+	 return at+__builtin_ctz(end);
+   }
+   return at+fS_CommentEndC(str+at, len-at);
+}
+
+static const fdScan fS_SSE2=
+{
+   "SSE2", fS_LineSSE2, fS_BlanksSSE2, fS_CommentEndSSE2
+};
+
+/******************************************************************************
+ *    AVX2, 32 bytes at a time
+ ******************************************************************************/
+
+__attribute__((target("avx2"))) static unsigned int
+fS_Blank32(__m256i v)
+{
+   __m256i blank=_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+      _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t'-1)),
+		       _mm256_cmpgt_epi8(_mm256_set1_epi8('\r'+1), v)));
+
+   return _mm256_movemask_epi8(blank);
+}
+
+__attribute__((target("avx2"))) static size_t
+fS_LineAVX2(const char* str, size_t len, size_t* trimmed)
+{
+   size_t at, last=0, rest;
+
+   for (at=0; at+32<=len; at+=32)
+   {
+      __m256i v=_mm256_loadu_si256((const __m256i*) (str+at));
+      unsigned int stop=_mm256_movemask_epi8(
+	 _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+			 _mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+      unsigned int text=~fS_Blank32(v);
+
+      if (stop)
+      {
+	 text&=(stop & -stop)-1;
+	 if (text)
+	    last=at+fS_High(text)+1;
+	 *trimmed=last;
+	 return at+__builtin_ctz(stop);
+      }
+      if (text)
+	 last=at+fS_High(text)+1;
+   }
+
+   len=fS_LineC(str+at, len-at, &rest);
+   *trimmed=rest ? at+rest : last;
+   return at+len;
+}
+
+__attribute__((target("avx2"))) static size_t
+fS_BlanksAVX2(const char* str, size_t len)
+{
+   size_t at;
+
+   for (at=0; at+32<=len; at+=32)
+   {
+      __m256i v=_mm256_loadu_si256((const __m256i*) (str+at));
+      unsigned int text=~_mm256_movemask_epi8(
+	 _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+			 _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))));
+
+      if (text)
+	 return at+__builtin_ctz(text);
+   }
+   return at+fS_BlanksC(str+at, len-at);
+}
+
+__attribute__((target("avx2"))) static size_t
+fS_CommentEndAVX2(const char* str, size_t len)
+{
+   size_t at;
+
+   for (at=0; at+33<=len; at+=32)
+   {
+      __m256i star=_mm256_loadu_si256((const __m256i*) (str+at));
+      __m256i slash=_mm256_loadu_si256((const __m256i*) (str+at+1));
+      unsigned int end=_mm256_movemask_epi8(
+	 _mm256_and_si256(_mm256_cmpeq_epi8(star, _mm256_set1_epi8('*')),
+			  _mm256_cmpeq_epi8(slash, _mm256_set1_epi8('/'))));
+
+      if (end)
+	 return at+__builtin_ctz(end);
+   }
+   return at+fS_CommentEndC(str+at, len-at);
+}
+
+static const fdScan fS_AVX2=
+{
+   "AVX2", fS_LineAVX2, fS_BlanksAVX2, fS_CommentEndAVX2
+};
+
+#endif /* FS_X86 */
+
+/* the kernels this CPU can run, best first */
+
+static const fdScan*
+fS_Supported(int at)
+{
+   const fdScan *supported[3];
+   int num=0;
+
+#ifdef FS_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx2"))
+      supported[num++]=&fS_AVX2;
+   supported[num++]=&fS_SSE2;
+#endif
+   supported[num++]=&fS_C;
+   return at<num ? supported[at] : NULL;
+}
+
+const fdScan*
+fS_Get(void)
+{
+   const char *name=getenv("FD2SFD_SCAN");
+   const fdScan *scan;
+   int at;
+
+   if (name)
+      for (at=0; (scan=fS_Supported(at)); at++)
+	 if (strcmp(scan->name, name)==0)
+	    return scan;
+   return fS_Supported(0);
+}
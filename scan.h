@@ -0,0 +1,40 @@
+/******************************************************************************
+ *
+ * scan.h -- the byte scanning kernels the fd and clib readers are built on
+ *
+ * Every kernel exists as plain C, and on x86-64 also for SSE2 and AVX2,
+ * which look at 16 or 32 bytes at a time. fS_Get() picks the best one the
+ * CPU running the program supports; all of them give the same results.
+ * FD2SFD_SCAN=C (or SSE2 or AVX2) in the environment asks for a particular
+ * one, for comparing them. Looking that up takes a while, so fS_Get() is
+ * called once for a converter, not for every file.
+ *
+ * Blanks are the characters isspace() knows in the C locale, " \t\n\v\f\r".
+ *
+ *****************************************************************************/
+
+#ifndef FD2SFD_SCAN_H
+#define FD2SFD_SCAN_H
+
+#include <stddef.h>
+
+typedef struct
+{
+   const char* name;
+
+   /* the index of the first '\n' or NUL in str[0..len-1], or len if there's
+      none; *trimmed is set to one past the last non-blank byte before that
+      index, 0 if there's none */
+   size_t (*line)(const char* str, size_t len, size_t* trimmed);
+
+   /* the number of ' ' and '\t' at the start of str[0..len-1] */
+   size_t (*blanks)(const char* str, size_t len);
+
+   /* the index of the first '*' followed by '/' in str[0..len-1], or len */
+   size_t (*commentend)(const char* str, size_t len);
+} fdScan;
+
+const fdScan*
+fS_Get		(void);
+
+#endif /* FD2SFD_SCAN_H */
@@ -0,0 +1,648 @@
+/******************************************************************************
+ *
+ * fd2sfd -- forked from fd2inline 1.38
+ *
+ * The resident conversion server and the client talking to it.
+ *
+ * "fd2sfd --server socket" listens on a Unix domain socket and keeps a
+ * converter for each FD/clib pair it has been asked for, with the parsed
+ * definitions, their prototypes and the sorted name index. As long as both
+ * files are the same inodes with the same size and the same modification
+ * and change times, to the nanosecond where the system has them, a request
+ * for the same pair only has to write the SFD file again.
+ *
+ * The socket is only accessible to the user running the server, and a
+ * client that stops sending or receiving is dropped after a while, so that
+ * it can't keep the others waiting.
+ *
+ * "fd2sfd --client socket ..." takes the usual command line, sends the
+ * request to the server and writes what comes back, so the output and the
+ * diagnostics are the same as when converting directly.
+ *
+ *****************************************************************************/
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "fd2sfd.h"
+#include "server.h"
+
+/******************************************************************************
+ * The protocol
+ *
+ * Both requests and replies are a count followed by that many strings, each
+ * sent as a length followed by the bytes. Numbers are unsigned longs in host
+ * byte order; client and server always run on the same machine.
+ *
+ *   request: cwd, quiet ("0"/"1"), globs, fd-file, clib-file
+ *   reply:   result of reading ("0"/"1"), diagnostics of reading,
+ *	      result of writing, SFD output, diagnostics of writing
+ *
+ * The two sets of diagnostics are kept apart, so that the client can report
+ * a bad output file at the same point as fd2sfd itself would.
+ ******************************************************************************/
+
+#define REQUEST_STRINGS 5
+#define REPLY_STRINGS	5
+
+#define MAX_STRING	(64UL*1024*1024)
+#define TIMEOUT		30	/* seconds a client may stall for */
+
+static int
+writeall(int fd, const void* buffer, size_t length)
+{
+   const char *ptr=buffer;
+
+   while (length)
+   {
+      ssize_t written=write(fd, ptr, length);
+
+      if (written<0 && errno==EINTR)
+	 continue;
+      if (written<=0)
+	 return 1;
+      ptr+=written;
+      length-=written;
+   }
+   return 0;
+}
+
+static int
+readall(int fd, void* buffer, size_t length)
+{
+   char *ptr=buffer;
+
+   while (length)
+   {
+      ssize_t got=read(fd, ptr, length);
+
+      if (got<0 && errno==EINTR)
+	 continue;
+      if (got<=0)
+	 return 1;
+      ptr+=got;
+      length-=got;
+   }
+   return 0;
+}
+
+static int
+sendstrings(int fd, int count, const char** strings, const size_t* lengths)
+{
+   unsigned long num=count;
+   int i;
+
+   if (writeall(fd, &num, sizeof num))
+      return 1;
+   for (i=0; i<count; i++)
+   {
+      unsigned long len=lengths ? lengths[i] : strlen(strings[i]);
+
+      if (writeall(fd, &len, sizeof len) || writeall(fd, strings[i], len))
+	 return 1;
+   }
+   return 0;
+}
+
+/* reads exactly count strings; each is NUL terminated and must be freed */
+
+static int
+recvstrings(int fd, int count, char** strings, size_t* lengths)
+{
+   unsigned long num, len;
+   int i;
+
+   for (i=0; i<count; i++)
+      strings[i]=NULL;
+
+   if (readall(fd, &num, sizeof num) || num!=(unsigned long) count)
+      return 1;
+   for (i=0; i<count; i++)
+   {
+      if (readall(fd, &len, sizeof len) || len>MAX_STRING ||
+	  !(strings[i]=malloc(len+1)) || readall(fd, strings[i], len))
+      {
+	 while (i>=0)
+	 {
+	    free(strings[i]);
+	    strings[i--]=NULL;
+	 }
+	 return 1;
+      }
+      strings[i][len]='\0';
+      if (lengths)
+	 lengths[i]=len;
+   }
+   return 0;
+}
+
+static int
+opensocket(const char* socketname, struct sockaddr_un* addr)
+{
+   int fd;
+
+   if (strlen(socketname)>=sizeof addr->sun_path)
+   {
+      fprintf(stderr, "Socket name '%s' too long.\n", socketname);
+      return -1;
+   }
+
+   memset(addr, 0, sizeof *addr);
+   addr->sun_family=AF_UNIX;
+   strcpy(addr->sun_path, socketname);
+
+   if ((fd=socket(AF_UNIX, SOCK_STREAM, 0))<0)
+      perror("socket");
+   return fd;
+}
+
+/******************************************************************************
+ *    CLASS sEntry
+ *
+ * a converter that has read one FD/clib pair, together with what reading
+ * it reported. Entries are kept in most recently used order and the oldest
+ * is dropped when there are too many.
+ ******************************************************************************/
+
+#define MAX_ENTRIES 512
+
+/* what tells whether a file has changed since it was read */
+
+typedef struct
+{
+   dev_t  dev;
+   ino_t  ino;
+   off_t  size;
+   time_t mtime;
+   long	  mtimensec;
+   time_t ctime;
+   long	  ctimensec;
+} sStamp;
+
+static void
+sS_Set(sStamp* obj, const struct stat* st)
+{
+   obj->dev=st->st_dev;
+   obj->ino=st->st_ino;
+   obj->size=st->st_size;
+   obj->mtime=st->st_mtime;
+   obj->ctime=st->st_ctime;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+   obj->mtimensec=st->st_mtim.tv_nsec;
+   obj->ctimensec=st->st_ctim.tv_nsec;
+#elif defined(HAVE_STRUCT_STAT_ST_MTIMESPEC)
+   obj->mtimensec=st->st_mtimespec.tv_nsec;
+   obj->ctimensec=st->st_ctimespec.tv_nsec;
+#else
+   obj->mtimensec=obj->ctimensec=0;
+#endif
+}
+
+static int
+sS_Same(const sStamp* obj, const struct stat* st)
+{
+   sStamp now;
+
+   sS_Set(&now, st);
+   return obj->dev==now.dev && obj->ino==now.ino && obj->size==now.size &&
+	  obj->mtime==now.mtime && obj->mtimensec==now.mtimensec &&
+	  obj->ctime==now.ctime && obj->ctimensec==now.ctimensec;
+}
+
+typedef struct sEntry
+{
+   struct sEntry* next;
+   char*	  cwd;		/* the request this entry answers	 */
+   char*	  fdfilename;
+   char*	  clibfilename;
+   int		  quiet;
+   char*	  globs;	/* "+only\n-exclude\n..."		 */
+   sStamp	  fdstamp;	/* the files when they were read	 */
+   sStamp	  clibstamp;
+   fdConverter*	  conv;
+   fdFilter*	  filter;	/* made from globs, or NULL		 */
+   int		  rc;		/* result of reading the pair		 */
+   char*	  readerr;	/* ... and the diagnostics of it	 */
+   size_t	  readerrlen;
+} sEntry;
+
+static sEntry *entries;
+static int     numentries;
+
+static void
+sE_dtor(sEntry* obj)
+{
+   if (obj->conv)
+      fC_dtor(obj->conv);
+   if (obj->filter)
+      fG_dtor(obj->filter);
+   free(obj->cwd);
+   free(obj->globs);
+   free(obj->fdfilename);
+   free(obj->clibfilename);
+   free(obj->readerr);
+   free(obj);
+}
+
+static char*
+copystring(const char* str)
+{
+   char *result=malloc(strlen(str)+1);
+
+   if (result)
+      strcpy(result, str);
+   return result;
+}
+
+/* the filter for the globs of a request, in *filter (NULL if there are
+   none); returns 0 on success */
+
+static int
+makefilter(const char* globs, fdFilter** filter)
+{
+   *filter=NULL;
+   if (!*globs)
+      return 0;
+   if (!(*filter=fG_ctor()))
+      return 1;
+
+   while (*globs)
+   {
+      const char *end=strchr(globs, '\n');
+      char *glob;
+      int rc;
+
+      if (!end)
+	 end=globs+strlen(globs);
+      if (end==globs || !(glob=malloc(end-globs)))
+	 break;
+      memcpy(glob, globs+1, end-globs-1);
+      glob[end-globs-1]='\0';
+      rc=fG_Add(*filter, glob, globs[0]=='-');
+      free(glob);
+      if (rc)
+	 break;
+      globs=*end ? end+1 : end;
+   }
+
+   if (*globs || fG_Compile(*filter))
+   {
+      fG_dtor(*filter);
+      *filter=NULL;
+      return 1;
+   }
+   return 0;
+}
+
+/* finds (and moves to the front) the entry for a request, or creates it */
+
+static sEntry*
+sE_lookup(const char* cwd, const char* fdfilename, const char* clibfilename,
+	  int quiet, const char* globs, const struct stat* fdst,
+	  const struct stat* clibst)
+{
+   sEntry **link, *obj;
+   FILE *errfile;
+
+   for (link=&entries; (obj=*link); link=&obj->next)
+   {
+      if (obj->quiet==quiet && strcmp(obj->globs, globs)==0 &&
+	  strcmp(obj->fdfilename, fdfilename)==0 &&
+	  strcmp(obj->clibfilename, clibfilename)==0 &&
+	  strcmp(obj->cwd, cwd)==0)
+      {
+	 *link=obj->next;
+
+	 if (sS_Same(&obj->fdstamp, fdst) && sS_Same(&obj->clibstamp, clibst))
+	 {
+	    obj->next=entries;
+	    entries=obj;
+	    return obj;
+	 }
+
+	 /* One of the files has changed */
+	 sE_dtor(obj);
+	 numentries--;
+	 break;
+      }
+   }
+
+   if (numentries==MAX_ENTRIES)
+   {
+      for (link=&entries; (*link)->next; link=&(*link)->next);
+      sE_dtor(*link);
+      *link=NULL;
+      numentries--;
+   }
+
+   if (!(obj=calloc(1, sizeof(sEntry))))
+      return NULL;
+
+   obj->cwd=copystring(cwd);
+   obj->fdfilename=copystring(fdfilename);
+   obj->clibfilename=copystring(clibfilename);
+   obj->quiet=quiet;
+   obj->globs=copystring(globs);
+   sS_Set(&obj->fdstamp, fdst);
+   sS_Set(&obj->clibstamp, clibst);
+   obj->conv=fC_ctor();
+   errfile=open_memstream(&obj->readerr, &obj->readerrlen);
+
+   if (!obj->cwd || !obj->fdfilename || !obj->clibfilename || !obj->globs ||
+       !obj->conv || makefilter(globs, &obj->filter) || !errfile)
+   {
+      if (errfile)
+	 fclose(errfile);
+      sE_dtor(obj);
+      return NULL;
+   }
+
+   fC_SetQuiet(obj->conv, quiet);
+   fC_SetFilter(obj->conv, obj->filter);
+   fC_SetErrorFile(obj->conv, errfile);
+   obj->rc=fC_ReadFD(obj->conv, fdfilename) ||
+	   fC_ReadClib(obj->conv, clibfilename);
+   fC_SetErrorFile(obj->conv, stderr);
+   fclose(errfile);
+
+   obj->next=entries;
+   entries=obj;
+   numentries++;
+   return obj;
+}
+
+/******************************************************************************
+ *    server
+ ******************************************************************************/
+
+static volatile sig_atomic_t stopserver;
+
+static void
+onsignal(int sig)
+{
+   (void) sig;
+   stopserver=1;
+}
+
+static void
+serverequest(int fd)
+{
+   char  *request[REQUEST_STRINGS];
+   char  *readerr=NULL, *out=NULL, *writeerr=NULL;
+   size_t readerrlen=0, outlen=0, writeerrlen=0;
+   const char *reply[REPLY_STRINGS];
+   size_t lengths[REPLY_STRINGS];
+   int	  readrc=1, writerc=1, i;
+   FILE  *readerrfile, *outfile, *writeerrfile;
+
+   if (recvstrings(fd, REQUEST_STRINGS, request, NULL))
+      return;
+
+   readerrfile=open_memstream(&readerr, &readerrlen);
+   outfile=open_memstream(&out, &outlen);
+   writeerrfile=open_memstream(&writeerr, &writeerrlen);
+
+   if (readerrfile && outfile && writeerrfile)
+   {
+      struct stat fdst, clibst;
+      sEntry *entry;
+
+      /* Relative names are relative to the client, and the names as given
+	 end up in the SFD file */
+
+      if (chdir(request[0]))
+	 fprintf(readerrfile, "Couldn't change to directory '%s'.\n",
+		 request[0]);
+      else if (stat(request[3], &fdst))
+	 fprintf(readerrfile, "Couldn't open file '%s'.\n", request[3]);
+      else if (stat(request[4], &clibst))
+      {
+	 /* Not cached; this gives the diagnostics of the fd file, too */
+	 fdConverter *conv=fC_ctor();
+	 fdFilter *filter;
+
+	 if (conv && makefilter(request[2], &filter)==0)
+	 {
+	    fC_SetQuiet(conv, request[1][0]=='1');
+	    fC_SetFilter(conv, filter);
+	    fC_SetErrorFile(conv, readerrfile);
+	    if (!fC_ReadFD(conv, request[3]))
+	       fC_ReadClib(conv, request[4]);
+	    if (filter)
+	       fG_dtor(filter);
+	 }
+	 if (conv)
+	    fC_dtor(conv);
+      }
+      else if (!(entry=sE_lookup(request[0], request[3], request[4],
+				 request[1][0]=='1', request[2], &fdst,
+				 &clibst)))
+	 fprintf(readerrfile, "No mem for FDs\n");
+      else
+      {
+	 fwrite(entry->readerr, 1, entry->readerrlen, readerrfile);
+
+	 if ((readrc=entry->rc)==0)
+	 {
+	    fC_SetErrorFile(entry->conv, writeerrfile);
+	    writerc=fC_Write(entry->conv, outfile);
+	    fC_SetErrorFile(entry->conv, stderr);
+	 }
+      }
+   }
+
+   if (readerrfile)
+      fclose(readerrfile);
+   if (outfile)
+      fclose(outfile);
+   if (writeerrfile)
+      fclose(writeerrfile);
+
+   reply[0]=readrc ? "1" : "0";
+   reply[1]=readerr ? readerr : "";
+   reply[2]=writerc ? "1" : "0";
+   reply[3]=out ? out : "";
+   reply[4]=writeerr ? writeerr : "";
+   lengths[0]=lengths[2]=1;
+   lengths[1]=readerr ? readerrlen : 0;
+   lengths[3]=out ? outlen : 0;
+   lengths[4]=writeerr ? writeerrlen : 0;
+   sendstrings(fd, REPLY_STRINGS, reply, lengths);
+
+   free(readerr);
+   free(out);
+   free(writeerr);
+   for (i=0; i<REQUEST_STRINGS; i++)
+      free(request[i]);
+}
+
+int
+server(const char* socketname)
+{
+   struct sockaddr_un addr;
+   struct sigaction sa;
+   struct timeval timeout;
+   mode_t mask;
+   int fd, rc;
+
+   if ((fd=opensocket(socketname, &addr))<0)
+      return EXIT_FAILURE;
+
+   /* Whoever can connect can have any file read, so only we may */
+
+   unlink(socketname);
+   mask=umask(0177);
+   rc=bind(fd, (struct sockaddr*) &addr, sizeof addr);
+   umask(mask);
+   if (rc || listen(fd, 16))
+   {
+      fprintf(stderr, "Couldn't listen on socket '%s': %s\n", socketname,
+	      strerror(errno));
+      close(fd);
+      return EXIT_FAILURE;
+   }
+
+   /* Requests change the directory, so remember where the socket is */
+
+   if (addr.sun_path[0]!='/')
+   {
+      char cwd[4096];
+
+      if (!getcwd(cwd, sizeof cwd) ||
+	  strlen(cwd)+1+strlen(socketname)>=sizeof addr.sun_path)
+      {
+	 fprintf(stderr, "Socket name '%s' too long.\n", socketname);
+	 close(fd);
+	 unlink(socketname);
+	 return EXIT_FAILURE;
+      }
+      strcat(cwd, "/");
+      strcat(cwd, socketname);
+      strcpy(addr.sun_path, cwd);
+   }
+
+   memset(&sa, 0, sizeof sa);
+   sa.sa_handler=onsignal;
+   sigaction(SIGINT, &sa, NULL);
+   sigaction(SIGTERM, &sa, NULL);
+   sa.sa_handler=SIG_IGN;
+   sigaction(SIGPIPE, &sa, NULL);
+
+   timeout.tv_sec=TIMEOUT;
+   timeout.tv_usec=0;
+
+   while (!stopserver)
+   {
+      int conn=accept(fd, NULL, NULL);
+
+      if (conn<0)
+      {
+	 if (errno==EINTR)
+	    continue;
+	 perror("accept");
+	 break;
+      }
+      setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+      setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+      serverequest(conn);
+      close(conn);
+   }
+
+   close(fd);
+   unlink(addr.sun_path);
+
+   while (entries)
+   {
+      sEntry *next=entries->next;
+      sE_dtor(entries);
+      entries=next;
+   }
+
+   return EXIT_SUCCESS;
+}
+
+/******************************************************************************
+ *    client
+ ******************************************************************************/
+
+int
+client(const char* socketname, const char* fdfilename,
+       const char* clibfilename, const char* outfilename, int quiet,
+       const char* globs)
+{
+   struct sockaddr_un addr;
+   char	 cwd[4096];
+   const char *request[REQUEST_STRINGS];
+   char	*reply[REPLY_STRINGS];
+   size_t lengths[REPLY_STRINGS];
+   int	 fd, rc, count;
+
+   if ((fd=opensocket(socketname, &addr))<0)
+      return EXIT_FAILURE;
+
+   if (connect(fd, (struct sockaddr*) &addr, sizeof addr))
+   {
+      fprintf(stderr, "Couldn't connect to '%s': %s\n", socketname,
+	      strerror(errno));
+      close(fd);
+      return EXIT_FAILURE;
+   }
+
+   if (!getcwd(cwd, sizeof cwd))
+   {
+      perror("getcwd");
+      close(fd);
+      return EXIT_FAILURE;
+   }
+
+   request[0]=cwd;
+   request[1]=quiet ? "1" : "0";
+   request[2]=globs;
+   request[3]=fdfilename;
+   request[4]=clibfilename;
+
+   if (sendstrings(fd, REQUEST_STRINGS, request, NULL) ||
+       recvstrings(fd, REPLY_STRINGS, reply, lengths))
+   {
+      fprintf(stderr, "Lost connection to '%s'.\n", socketname);
+      close(fd);
+      return EXIT_FAILURE;
+   }
+   close(fd);
+
+   fwrite(reply[1], 1, lengths[1], stderr);
+   rc = EXIT_FAILURE;
+
+   if (reply[0][0]=='0')
+   {
+      FILE *outfile=stdout;
+
+      if (outfilename && !(outfile=fopen(outfilename, "w")))
+	 fprintf(stderr, "Couldn't open output file.\n");
+      else
+      {
+	 fwrite(reply[4], 1, lengths[4], stderr);
+	 fwrite(reply[3], 1, lengths[3], outfile);
+	 if (reply[2][0]=='0')
+	    rc = EXIT_SUCCESS;
+	 if (outfile!=stdout && fclose(outfile))
+	 {
+	    fprintf(stderr, "Couldn't write output file.\n");
+	    rc = EXIT_FAILURE;
+	 }
+      }
+   }
+
+   for (count=0; count<REPLY_STRINGS; count++)
+      free(reply[count]);
+
+   return rc;
+}
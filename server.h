@@ -0,0 +1,17 @@
+/******************************************************************************
+ *
+ * server.h -- the resident fd2sfd server and its client
+ *
+ *****************************************************************************/
+
+#ifndef FD2SFD_SERVER_H
+#define FD2SFD_SERVER_H
+
+int
+server	       (const char* socketname);
+int
+client	       (const char* socketname, const char* fdfilename,
+		const char* clibfilename, const char* outfilename, int quiet,
+		const char* globs);
+
+#endif /* FD2SFD_SERVER_H */
@@ -0,0 +1,73 @@
+/******************************************************************************
+ *
+ * tables.h -- perfect hash tables for the built-in name tables
+ *
+ * The tables themselves are kept in tables.def. At build time mktables turns
+ * every one of them into an fdTable in tables.inc, where each key has a slot
+ * of its own, so that a lookup is one hash over the name and one compare.
+ *
+ * A key is hashed to a bucket, and every bucket has a displacement chosen by
+ * mktables that moves all keys of the bucket to free slots (hash, displace
+ * and compress). mktables and the program must agree on fT_Hash and fT_Slot,
+ * which is why both live here. All hashing is done in 32 bits, so a table
+ * generated on the build host works on any target.
+ *
+ *****************************************************************************/
+
+#ifndef FD2SFD_TABLES_H
+#define FD2SFD_TABLES_H
+
+#include <stddef.h>
+#include <string.h>
+
+typedef struct
+{
+   const char* const*	key;	/* size slots, NULL where unused	    */
+   const char* const*	value;
+   const unsigned long* disp;	/* d0*size+d1 for each bucket		    */
+   unsigned long	seed;
+   unsigned long	size;
+   unsigned long	buckets;
+} fdTable;
+
+static unsigned long
+fT_Hash(const char* str, size_t len, unsigned long seed)
+{
+   unsigned long hash=(2166136261UL ^ seed) & 0xffffffffUL;
+
+   while (len--)
+      hash=((hash ^ (unsigned char) *str++)*16777619UL) & 0xffffffffUL;
+   return hash;
+}
+
+/* the slot a key with the given hash has in table */
+
+static unsigned long
+fT_Slot(const fdTable* table, unsigned long hash)
+{
+   unsigned long mix, f, g, disp;
+
+   mix=(hash ^ (hash>>15))*0x2c1b3c6dUL & 0xffffffffUL;
+   mix=(mix ^ (mix>>12))*0x297a2d39UL & 0xffffffffUL;
+   mix^=mix>>15;
+
+   f=mix % table->size;
+   g=(mix>>16) % table->size;
+   disp=table->disp[hash % table->buckets];
+   return (f + disp/table->size*g + disp%table->size) % table->size;
+}
+
+/* the value stored for the name made of the first len chars of name */
+
+static const char*
+fT_Lookup(const fdTable* table, const char* name, size_t len)
+{
+   unsigned long slot=fT_Slot(table, fT_Hash(name, len, table->seed));
+   const char *key=table->key[slot];
+
+   if (key && strncmp(key, name, len)==0 && key[len]=='\0')
+      return table->value[slot];
+   return NULL;
+}
+
+#endif /* FD2SFD_TABLES_H */
@@ -0,0 +1,11 @@
+#ifndef CLIB_IFDEFCOMMENT_PROTOS_H
+#define CLIB_IFDEFCOMMENT_PROTOS_H
+LONG Zero( APTR a );
+#ifdef __MORPHOS__
+LONG One( APTR a, LONG b );
+#else
+LONG One( APTR a ); /* x */
+#endif
+LONG Two( APTR a );
+LONG Three( APTR a );
+#endif
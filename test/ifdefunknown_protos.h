@@ -0,0 +1,21 @@
+#ifndef CLIB_IFDEFUNKNOWN_PROTOS_H
+#define CLIB_IFDEFUNKNOWN_PROTOS_H
+#define KNOWN
+#ifdef UNKNOWN
+LONG One( APTR a );
+#endif
+#if defined(UNKNOWN)
+LONG Two( APTR a );
+#endif
+#if defined UNKNOWN && defined KNOWN
+LONG Three( APTR a );
+#endif
+#ifndef UNKNOWN
+LONG Four( APTR a );
+#endif
+#if !defined(KNOWN)
+LONG Five( LONG a );
+#else
+LONG Five( APTR a );
+#endif
+#endif